@@ -0,0 +1,215 @@
+#include "includes/geometryarena.h"
+
+#include <stddef.h>
+#include <string.h>
+
+
+// the smallest buffers worth making, so the first few objects don't each cause a regrow:
+
+static const GLsizeiptr	MIN_ARENA_VERTICES = 64 * 1024;
+static const GLsizeiptr	MIN_ARENA_INDICES  = 3 * 64 * 1024;
+
+
+// copy an object's (already laid out) vertices and its elements to the end of the arena
+// returns the range number to draw it with:
+
+int
+GeometryArena::Add( const void *vertices, int nv, const GLuint *elements, int ne )
+{
+	Reserve( numVertices + nv, numIndices + ne );
+
+	struct ArenaRange range = { (GLint)numVertices, (GLuint)numIndices, (GLsizei)ne, (GLsizei)nv };
+
+	if( nv > 0 )
+	{
+		if( vertexMap != NULL )
+			memcpy( vertexMap + numVertices * stride, vertices, (size_t)nv * stride );
+		else
+			glNamedBufferSubData( vbuffer, numVertices * stride, (GLsizeiptr)nv * stride, vertices );
+	}
+
+	if( ne > 0 )
+	{
+		if( indexMap != NULL )
+			memcpy( indexMap + numIndices, elements, (size_t)ne * sizeof(GLuint) );
+		else
+			glNamedBufferSubData( ebuffer, numIndices * sizeof(GLuint), (GLsizeiptr)ne * sizeof(GLuint), elements );
+	}
+
+	numVertices += nv;
+	numIndices += ne;
+
+	ranges.push_back( range );
+	return (int)ranges.size( ) - 1;
+}
+
+
+void
+GeometryArena::Bind( )
+{
+	glBindVertexArray( vao );
+}
+
+
+// make an immutable buffer of the given size, mapping it for good if the arena is persistent:
+
+GLuint
+GeometryArena::CreateBuffer( GLsizeiptr bytes, unsigned char **map )
+{
+	GLuint buffer;
+	glCreateBuffers( 1, &buffer );
+
+	if( persistent )
+	{
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glNamedBufferStorage( buffer, bytes, NULL, flags );
+		*map = (unsigned char *) glMapNamedBufferRange( buffer, 0, bytes, flags );
+	}
+	else
+	{
+		glNamedBufferStorage( buffer, bytes, NULL, GL_DYNAMIC_STORAGE_BIT );
+		*map = NULL;
+	}
+
+	return buffer;
+}
+
+
+GLuint
+GeometryArena::GetElementBuffer( )
+{
+	return ebuffer;
+}
+
+
+int
+GeometryArena::GetPacking( )
+{
+	return packing;
+}
+
+
+const struct ArenaRange&
+GeometryArena::GetRange( int i )
+{
+	return ranges[i];
+}
+
+
+int
+GeometryArena::GetStride( )
+{
+	return stride;
+}
+
+
+int
+GeometryArena::NumRanges( )
+{
+	return (int)ranges.size( );
+}
+
+
+void
+GeometryArena::Print( FILE *fpout )
+{
+	fprintf( fpout, "Geometry arena: %d ranges, %lld of %lld vertices (%d bytes each), %lld of %lld indices, %s\n",
+		(int)ranges.size( ), (long long)numVertices, (long long)vertexCapacity, stride,
+		(long long)numIndices, (long long)indexCapacity, persistent ? "persistently mapped" : "glNamedBufferSubData( )" );
+}
+
+
+// be sure there is room for this many vertices and indices in all
+// a full buffer is replaced by one at least twice the size, with the old contents copied over on the gpu:
+
+void
+GeometryArena::Reserve( GLsizeiptr vertices, GLsizeiptr indices )
+{
+	if( vao == 0 )
+	{
+		glCreateVertexArrays( 1, &vao );
+		SetupVertexArray( );
+	}
+
+	if( vertices > vertexCapacity )
+	{
+		GLsizeiptr capacity = 2 * vertexCapacity;
+		if( capacity < MIN_ARENA_VERTICES )
+			capacity = MIN_ARENA_VERTICES;
+		if( capacity < vertices )
+			capacity = vertices;
+
+		unsigned char *map;
+		GLuint buffer = CreateBuffer( capacity * stride, &map );
+		if( vbuffer != 0 )
+		{
+			if( numVertices > 0 )
+				glCopyNamedBufferSubData( vbuffer, buffer, 0, 0, numVertices * stride );
+			if( vertexMap != NULL )
+				glUnmapNamedBuffer( vbuffer );
+			glDeleteBuffers( 1, &vbuffer );
+		}
+
+		vbuffer = buffer;
+		vertexMap = map;
+		vertexCapacity = capacity;
+		glVertexArrayVertexBuffer( vao, 0, vbuffer, 0, stride );
+	}
+
+	if( indices > indexCapacity )
+	{
+		GLsizeiptr capacity = 2 * indexCapacity;
+		if( capacity < MIN_ARENA_INDICES )
+			capacity = MIN_ARENA_INDICES;
+		if( capacity < indices )
+			capacity = indices;
+
+		unsigned char *map;
+		GLuint buffer = CreateBuffer( capacity * sizeof(GLuint), &map );
+		if( ebuffer != 0 )
+		{
+			if( numIndices > 0 )
+				glCopyNamedBufferSubData( ebuffer, buffer, 0, 0, numIndices * sizeof(GLuint) );
+			if( indexMap != NULL )
+				glUnmapNamedBuffer( ebuffer );
+			glDeleteBuffers( 1, &ebuffer );
+		}
+
+		ebuffer = buffer;
+		indexMap = (GLuint *) map;
+		indexCapacity = capacity;
+		glVertexArrayElementBuffer( vao, ebuffer );
+	}
+}
+
+
+// the same attribute locations VertexBufferObject uses, all read from binding 0:
+
+void
+GeometryArena::SetupVertexArray( )
+{
+	for( int a = 0; a <= 4; a++ )
+		glVertexArrayAttribBinding( vao, a, 0 );
+
+	if( packing != VBO_PACK_NONE )
+	{
+		glVertexArrayAttribFormat( vao, 0, 3, GL_FLOAT,              GL_FALSE, offsetof(struct PackedPoint, x) );
+		glVertexArrayAttribFormat( vao, 1, 4, GL_INT_2_10_10_10_REV, GL_TRUE,  offsetof(struct PackedPoint, n) );
+		glVertexArrayAttribFormat( vao, 2, 2, GL_HALF_FLOAT,         GL_FALSE, offsetof(struct PackedPoint, s) );
+		glVertexArrayAttribFormat( vao, 3, 4, GL_INT_2_10_10_10_REV, GL_TRUE,  offsetof(struct PackedPoint, t) );
+		for( int a = 0; a <= 3; a++ )
+			glEnableVertexArrayAttrib( vao, a );
+
+		// no bitangent array: the shader crosses the normal and tangent instead
+	}
+	else
+	{
+		glVertexArrayAttribFormat( vao, 0, 3, GL_FLOAT, GL_FALSE, offsetof(struct Point, x) );
+		glVertexArrayAttribFormat( vao, 1, 3, GL_FLOAT, GL_FALSE, offsetof(struct Point, nx) );
+		glVertexArrayAttribFormat( vao, 2, 2, GL_FLOAT, GL_FALSE, offsetof(struct Point, s) );
+		glVertexArrayAttribFormat( vao, 3, 3, GL_FLOAT, GL_FALSE, offsetof(struct Point, u) );
+		glVertexArrayAttribFormat( vao, 4, 3, GL_FLOAT, GL_FALSE, offsetof(struct Point, ui) );
+		for( int a = 0; a <= 4; a++ )
+			glEnableVertexArrayAttrib( vao, a );
+	}
+}
@@ -1,6 +1,9 @@
 
 #include "includes/glslprogram.h"
+#include "includes/mappedfile.h"
 #include <string.h>
+#include <string>
+#include <vector>
 #include "glm/glm/ext.hpp"
 #include "glm/glm/gtc/matrix_transform.hpp"
 #include "glm/glm/gtc/type_ptr.hpp"
@@ -37,6 +40,13 @@ BinaryTypes[] =
 
 extern GLchar* Gstap;		// set later
 
+
+// every shader compiled so far, by file name and a hash of the exact source it was given,
+// so a stage that several programs use (env.vert) is read and compiled once and attached to each
+// they are kept for the whole run, whatever happens to the programs:
+
+static std::map<std::string, GLuint>	SharedShaders;
+
 static
 char*
 GetExtension(char* file)
@@ -58,6 +68,268 @@ GetExtension(char* file)
 }
 
 
+// ---------------------------------------------------------------------------------------------
+// shader sources go through a little preprocessing of their own before the GLSL compiler sees them:
+// #include "file" is replaced by that file (named relative to the file including it),
+// and the program's defines (see SetDefines( ) ) are put in right after the #version line
+// #line directives keep the compiler's messages pointing at the right line: the shader itself is
+// source string 0, and each included file is numbered in the order it was read
+
+#define MAX_INCLUDE_DEPTH	16
+
+static
+bool
+ExpandIncludes(const std::string& file, int depth, int* numFiles, std::string* source)
+{
+	if (depth > MAX_INCLUDE_DEPTH)
+	{
+		fprintf(stderr, "Shader file '%s' is included more than %d deep -- does it include itself?\n", file.c_str(), MAX_INCLUDE_DEPTH);
+		return false;
+	}
+
+	FILE* in;
+	if (fopen_s(&in, file.c_str(), "rb") != 0)
+	{
+		fprintf(stderr, "Cannot open shader file '%s'\n", file.c_str());
+		return false;
+	}
+
+	fseek(in, 0, SEEK_END);
+	long length = ftell(in);
+	fseek(in, 0, SEEK_SET);		// rewind
+
+	std::string text(length > 0 ? (size_t)length : 0, '\0');
+	if (length > 0)
+		fread(&text[0], 1, (size_t)length, in);
+	fclose(in);
+
+	int number = (*numFiles)++;
+	std::string directory = file.substr(0, file.find_last_of("\\/") + 1);
+
+	int line = 1;
+	for (size_t start = 0; start < text.size(); line++)
+	{
+		size_t end = text.find('\n', start);
+		end = (end == std::string::npos) ? text.size() : end + 1;
+
+		// is it #include "name"?
+
+		size_t p = text.find_first_not_of(" \t", start);
+		size_t open = std::string::npos;
+		if (p < end && text[p] == '#')
+		{
+			p = text.find_first_not_of(" \t", p + 1);
+			if (p < end && text.compare(p, 7, "include") == 0)
+			{
+				p = text.find_first_not_of(" \t", p + 7);
+				if (p < end && text[p] == '"')
+					open = p + 1;
+			}
+		}
+
+		size_t close = (open != std::string::npos) ? text.find('"', open) : std::string::npos;
+		if (close == std::string::npos || close >= end)
+		{
+			source->append(text, start, end - start);
+			start = end;
+			continue;
+		}
+
+		char directive[32];
+		sprintf(directive, "#line 1 %d\n", *numFiles);
+		source->append(directive);
+		if (!ExpandIncludes(directory + text.substr(open, close - open), depth + 1, numFiles, source))
+			return false;
+
+		sprintf(directive, "\n#line %d %d\n", line + 1, number);
+		source->append(directive);
+		start = end;
+	}
+
+	return true;
+}
+
+
+// a shader's whole source, its includes expanded and these defines put in
+// returns false (and says why) if it, or something it includes, can't be read:
+
+static
+bool
+ReadShaderSource(const char* file, const std::string& defines, std::string* source)
+{
+	source->clear();
+	int numFiles = 0;
+	if (!ExpandIncludes(file, 0, &numFiles, source))
+		return false;
+
+	if (defines.empty())
+		return true;
+
+	// after the #version line, which has to come first (or at the top, if there isn't one):
+
+	size_t version = source->find("#version");
+	size_t at = 0;
+	int line = 1;
+	if (version != std::string::npos)
+	{
+		at = source->find('\n', version);
+		at = (at == std::string::npos) ? source->size() : at + 1;
+		for (size_t i = 0; i < at; i++)
+			line += ((*source)[i] == '\n') ? 1 : 0;
+	}
+
+	char directive[32];
+	sprintf(directive, "#line %d 0\n", line);
+	std::string inserted = defines;
+	if (inserted.back() != '\n')
+		inserted += '\n';
+	if (at > 0 && (*source)[at - 1] != '\n')
+		inserted = '\n' + inserted;
+	source->insert(at, inserted + directive);
+	return true;
+}
+
+
+// ---------------------------------------------------------------------------------------------
+// the program binary cache:
+// a linked program is kept as <first shader>.<hash of the shader names>.glbin,
+// keyed on everything that can change the binary: the shaders' sources (and gstap, if it is put in),
+// the driver (its vendor, renderer and version strings), and the binary formats it can load
+// a file whose key doesn't match, or that the driver turns down, is just compiled and written again
+
+struct ProgramBinaryHeader
+{
+	char			magic[8];
+	unsigned int		version;
+	unsigned int		format;			// what glGetProgramBinary( ) said it was
+	unsigned long long	key;
+	unsigned int		length;			// of the binary that follows
+	unsigned int		pad;
+};
+
+#define PROGRAM_BINARY_MAGIC	"GLSLPROG"
+#define PROGRAM_BINARY_VERSION	1
+
+
+// the key and the file name for a program made from these files (and these sources read from them)
+// the defines go into the name too, so each permutation of a shader has a binary of its own
+// returns false if there is no binary format to cache in:
+
+static
+bool
+ProgramBinaryKey(const std::vector<char*>& files, const std::vector<std::string>& sources, const std::string& defines, bool gstap,
+	std::string* name, unsigned long long* key)
+{
+	GLint numFormats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+	if (numFormats <= 0)
+		return false;
+
+	std::vector<GLint> formats(numFormats);
+	glGetIntegerv(GL_PROGRAM_BINARY_FORMATS, &formats[0]);
+
+	unsigned long long hash = HashBytes(&formats[0], formats.size() * sizeof(GLint));
+	const GLenum strings[3] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+	for (int i = 0; i < 3; i++)
+	{
+		const char* str = (const char*)glGetString(strings[i]);
+		if (str != NULL)
+			hash = HashBytes(str, std::strlen(str) + 1, hash);
+	}
+
+	if (gstap)
+		hash = HashBytes(Gstap, std::strlen(Gstap), hash);
+
+	unsigned long long names = HashBytes(defines.c_str(), defines.size());
+	for (size_t i = 0; i < files.size(); i++)
+	{
+		names = HashBytes(files[i], std::strlen(files[i]) + 1, names);
+		hash = HashBytes(sources[i].c_str(), sources[i].size() + 1, hash);
+	}
+
+	char suffix[32];
+	sprintf(suffix, ".%08x%s", (unsigned int)(names ^ (names >> 32)), GLSL_BINARY_SUFFIX);
+	*name = std::string(files[0]) + suffix;
+	*key = hash;
+	return true;
+}
+
+
+// load the cached binary into the program
+// returns false if it is missing, stale, or the driver won't take it:
+
+static
+bool
+ReadProgramBinary(GLuint program, const std::string& name, unsigned long long key)
+{
+	MappedFile file;
+	if (!file.Open(name.c_str()) || file.Size() < sizeof(struct ProgramBinaryHeader))
+		return false;
+
+	struct ProgramBinaryHeader header;
+	memcpy(&header, file.Data(), sizeof(header));
+	if (memcmp(header.magic, PROGRAM_BINARY_MAGIC, sizeof(header.magic)) != 0 || header.version != PROGRAM_BINARY_VERSION ||
+		header.key != key || sizeof(header) + (size_t)header.length > file.Size())
+	{
+#ifdef _DEBUG
+		fprintf(stderr, "Program binary '%s' is out of date -- compiling\n", name.c_str());
+#endif
+		return false;
+	}
+
+	glProgramBinary(program, header.format, file.Data() + sizeof(header), (GLsizei)header.length);
+	GLint success;
+	glGetProgramiv(program, GL_LINK_STATUS, &success);
+	while (glGetError() != GL_NO_ERROR)		// an unknown format is an error, not just a failed link
+		success = GL_FALSE;
+
+	if (!success)
+		fprintf(stderr, "The driver turned down program binary '%s' -- compiling\n", name.c_str());
+	return success != GL_FALSE;
+}
+
+
+// write the linked program's binary
+// (the program must have been linked with GL_PROGRAM_BINARY_RETRIEVABLE_HINT set):
+
+static
+void
+WriteProgramBinary(GLuint program, const std::string& name, unsigned long long key)
+{
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
+
+	struct ProgramBinaryHeader header = { };
+	memcpy(header.magic, PROGRAM_BINARY_MAGIC, sizeof(header.magic));
+	header.version = PROGRAM_BINARY_VERSION;
+	header.key = key;
+
+	std::vector<GLubyte> binary(length);
+	GLenum format;
+	glGetProgramBinary(program, length, &length, &format, &binary[0]);
+	header.format = format;
+	header.length = (unsigned int)length;
+
+	FILE* fp;
+	if (fopen_s(&fp, name.c_str(), "wb") != 0)
+	{
+		fprintf(stderr, "Cannot write program binary '%s'\n", name.c_str());
+		return;
+	}
+
+	bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+	ok = ok && fwrite(&binary[0], 1, (size_t)length, fp) == (size_t)length;
+	ok = (fclose(fp) == 0) && ok;
+	if (!ok)
+	{
+		fprintf(stderr, "Cannot write program binary '%s'\n", name.c_str());
+		remove(name.c_str());
+	}
+}
+
+
 GLSLProgram::GLSLProgram()
 {
 	Verbose = false;
@@ -71,6 +343,10 @@ GLSLProgram::GLSLProgram()
 	CanDoGeometryShaders = IsExtensionSupported("GL_EXT_geometry_shader4");
 	CanDoFragmentShaders = IsExtensionSupported("GL_ARB_fragment_shader");
 	CanDoBinaryFiles = IsExtensionSupported("GL_ARB_get_program_binary");
+	CanDoParallelCompile = IsExtensionSupported("GL_KHR_parallel_shader_compile");
+	Submitted = false;
+	FromBinary = false;
+	Valid = false;
 
 #ifdef _DEBUG
 	fprintf(stderr, "Can do: ");
@@ -80,7 +356,8 @@ GLSLProgram::GLSLProgram()
 	if (CanDoTessEvaluationShaders)	fprintf(stderr, "tess evaluation shaders, ");
 	if (CanDoGeometryShaders)		fprintf(stderr, "geometry shaders, ");
 	if (CanDoFragmentShaders)		fprintf(stderr, "fragment shaders, ");
-	if (CanDoBinaryFiles)			fprintf(stderr, "binary shader files ");
+	if (CanDoBinaryFiles)			fprintf(stderr, "binary shader files, ");
+	if (CanDoParallelCompile)		fprintf(stderr, "parallel shader compiles ");
 	fprintf(stderr, "\n");
 #endif // !_DEBUG
 	
@@ -89,30 +366,74 @@ GLSLProgram::GLSLProgram()
 
 // this is what is exposed to the user
 // file1 - file5 are defaulted as NULL if not given
+// the linked program is cached as a binary next to file0 (see ProgramBinaryKey( ) ),
+//	so the next run loads it instead of compiling, as long as nothing it was made from has changed
+// the shaders may #include other files, and are specialized by any SetDefines( ) (see ReadShaderSource( ) )
 // CreateHelper is a varargs procedure, so must end in a NULL argument,
 //	which I know to supply but I'm worried users won't
 
 bool
 GLSLProgram::Create(char* file0, char* file1, char* file2, char* file3, char* file4, char* file5)
+{
+	CreateHelper(file0, file1, file2, file3, file4, file5, NULL);
+	return Finish();
+}
+
+
+// Create( ) in two halves, so a batch of programs can compile at once:
+// Submit( ) hands the sources to the driver and starts the link without asking how either went
+// (with GL_KHR_parallel_shader_compile the driver does it on its own threads in the meantime),
+// and Finish( ) waits for it, reports any errors, and says whether the program is usable
+// so submit every program, do something else, then finish them all
+
+bool
+GLSLProgram::Submit(char* file0, char* file1, char* file2, char* file3, char* file4, char* file5)
 {
 	return CreateHelper(file0, file1, file2, file3, file4, file5, NULL);
 }
 
 
-// this is the varargs version of the Create method
+// has the driver finished compiling and linking what was submitted, so Finish( ) won't wait?
+// (without GL_KHR_parallel_shader_compile there is no way to ask, so it always says yes)
+
+bool
+GLSLProgram::IsReady()
+{
+	if (!Submitted || FromBinary || !CanDoParallelCompile)
+		return true;
+
+	GLint done;
+	glGetProgramiv(Program, GL_COMPLETION_STATUS_KHR, &done);
+	return done != GL_FALSE;
+}
+
+
+// this is the varargs version of the Submit method
 
 bool
 GLSLProgram::CreateHelper(char* file0, ...)
 {
-	GLsizei n = 0;
-	GLchar* buf;
 	Valid = true;
+	Submitted = true;
+	FromBinary = false;
+	PendingShaders.clear();
+	PendingFiles.clear();
+
+	// let the driver compile on as many threads as it likes (once is enough):
+
+	static bool threadsSet = false;
+	if (CanDoParallelCompile && !threadsSet)
+	{
+		glMaxShaderCompilerThreadsKHR(0xffffffff);
+		threadsSet = true;
+	}
 
 	IncludeGstap = false;
 	Cshader = Vshader = TCshader = TEshader = Gshader = Fshader = 0;
 	Program = 0;
 	AttributeLocs.clear();
-	UniformLocs.clear();
+	UniformSlots.clear();
+	Uniforms.clear();
 
 	if (Program == 0)
 	{
@@ -128,10 +449,50 @@ GLSLProgram::CreateHelper(char* file0, ...)
 	// I am depending on the caller passing in a NULL as the final argument.
 	// If they don't, bad things will happen.
 
-	char* file = file0;
+	std::vector<char*> files;
+	for (char* file = file0; file != NULL; file = va_arg(args, char*))
+		files.push_back(file);
+
+	va_end(args);
+
+	// read the shaders' sources (anything else, like a .nvb, is already a binary):
+
+	std::vector<std::string> sources(files.size());
+	std::vector<bool> readable(files.size(), false);
+	for (size_t i = 0; i < files.size(); i++)
+	{
+		char* extension = GetExtension(files[i]);
+		for (int t = 0; t < (int)(sizeof(ShaderTypes) / sizeof(struct GLshadertype)); t++)
+		{
+			if (extension != NULL && std::strcmp(extension, ShaderTypes[t].extension) == 0)
+			{
+				readable[i] = ReadShaderSource(files[i], Defines, &sources[i]);
+				break;
+			}
+		}
+	}
+
+	// if this program was linked from these same sources before, on this same driver, just load it:
+
+	CacheBinary = CanDoBinaryFiles && !files.empty();
+	for (size_t i = 0; i < files.size(); i++)
+		CacheBinary = CacheBinary && readable[i];		// not a binary already, and there to key on
+
+	if (CacheBinary)
+		CacheBinary = ProgramBinaryKey(files, sources, Defines, IncludeGstap, &BinaryName, &BinaryKey);
+
+	if (CacheBinary && ReadProgramBinary(Program, BinaryName, BinaryKey))
+	{
+		if (Verbose)
+			fprintf(stderr, "Shader Program loaded from '%s'.\n", BinaryName.c_str());
+		FromBinary = true;
+		return Valid;
+	}
+
 	int type;
-	while (file != NULL)
+	for (size_t f = 0; f < files.size(); f++)
 	{
+		char* file = files[f];
 		int maxBinaryTypes = sizeof(BinaryTypes) / sizeof(struct GLbinarytype);
 		type = -1;
 		char* extension = GetExtension(file);
@@ -158,7 +519,7 @@ GLSLProgram::CreateHelper(char* file0, ...)
 			}
 		}
 
-		GLuint shader;
+		GLenum stage;
 		bool SkipToNextVararg = false;
 		if (type < 0)
 		{
@@ -195,7 +556,7 @@ GLSLProgram::CreateHelper(char* file0, ...)
 				}
 				else
 				{
-					shader = glCreateShader(GL_COMPUTE_SHADER);
+					stage = GL_COMPUTE_SHADER;
 				}
 				break;
 
@@ -208,7 +569,7 @@ GLSLProgram::CreateHelper(char* file0, ...)
 				}
 				else
 				{
-					shader = glCreateShader(GL_VERTEX_SHADER);
+					stage = GL_VERTEX_SHADER;
 				}
 				break;
 
@@ -221,7 +582,7 @@ GLSLProgram::CreateHelper(char* file0, ...)
 				}
 				else
 				{
-					shader = glCreateShader(GL_TESS_CONTROL_SHADER);
+					stage = GL_TESS_CONTROL_SHADER;
 				}
 				break;
 
@@ -234,7 +595,7 @@ GLSLProgram::CreateHelper(char* file0, ...)
 				}
 				else
 				{
-					shader = glCreateShader(GL_TESS_EVALUATION_SHADER);
+					stage = GL_TESS_EVALUATION_SHADER;
 				}
 				break;
 
@@ -250,7 +611,7 @@ GLSLProgram::CreateHelper(char* file0, ...)
 					//glProgramParameteriEXT( Program, GL_GEOMETRY_INPUT_TYPE_EXT,  InputTopology );
 					//glProgramParameteriEXT( Program, GL_GEOMETRY_OUTPUT_TYPE_EXT, OutputTopology );
 					//glProgramParameteriEXT( Program, GL_GEOMETRY_VERTICES_OUT_EXT, 1024 );
-					shader = glCreateShader(GL_GEOMETRY_SHADER);
+					stage = GL_GEOMETRY_SHADER;
 				}
 				break;
 
@@ -263,109 +624,149 @@ GLSLProgram::CreateHelper(char* file0, ...)
 				}
 				else
 				{
-					shader = glCreateShader(GL_FRAGMENT_SHADER);
+					stage = GL_FRAGMENT_SHADER;
 				}
 				break;
 			}
 		}
 
 
-		// read the shader source into a buffer:
+		// the shader's source (ReadShaderSource( ) has already said why, if it couldn't be read,
+		// and a binary has already been loaded):
+
+		if (!SkipToNextVararg && !readable[f])
+		{
+			if (type >= 0)
+				Valid = false;
+			SkipToNextVararg = true;
+		}
 
 		if (!SkipToNextVararg)
 		{
-			FILE* in;
-			int length;
-			FILE* logfile;
+			GLchar* strings[2] = { };
+			int n = 0;
 
-			if (fopen_s(&in, file, "rb") != 0)
+			if (IncludeGstap)
 			{
-				fprintf(stderr, "Cannot open shader file '%s'\n", file);
-				Valid = false;
-				SkipToNextVararg = true;
+				strings[n] = Gstap;
+				n++;
 			}
 
-			if (!SkipToNextVararg)
-			{
-				fseek(in, 0, SEEK_END);
-				length = ftell(in);
-				fseek(in, 0, SEEK_SET);		// rewind
-
-				buf = new GLchar[length + 1];
-				fread(buf, sizeof(GLchar), length, in);
-				buf[length] = '\0';
-				fclose(in);
+			strings[n] = (GLchar*)sources[f].c_str();
+			n++;
 
-				GLchar* strings[2] = { };
-				int n = 0;
+			// the same source may already have been compiled for another program:
 
-				if (IncludeGstap)
-				{
-					strings[n] = Gstap;
-					n++;
-				}
-
-				strings[n] = buf;
-				n++;
+			char hash[24];
+			unsigned long long h = HASH_START;
+			for (int i = 0; i < n; i++)
+				h = HashBytes(strings[i], std::strlen(strings[i]), h);
+			sprintf(hash, "|%016llx", h);
+			std::string key = std::string(file) + hash;
 
+			GLuint shader;
+			std::map<std::string, GLuint>::iterator shared = SharedShaders.find(key);
+			if (shared != SharedShaders.end())
+			{
+				shader = shared->second;
+				if (Verbose)
+					fprintf(stderr, "Shader '%s' is already compiled.\n", file);
+			}
+			else
+			{
 				// Tell GL about the source:
 
+				shader = glCreateShader(stage);
 				glShaderSource(shader, n, (const GLchar**)strings, NULL);
-				delete[] buf;
 				CheckGlErrors("Shader Source");
 
-				// compile:
+				// compile (Finish( ) asks how it went):
 
 				glCompileShader(shader);
-				GLint infoLogLen;
-				GLint compileStatus;
 				CheckGlErrors("CompileShader:");
-				glGetShaderiv(shader, GL_COMPILE_STATUS, &compileStatus);
-
-				if (compileStatus == 0)
-				{
-					fprintf(stderr, "Shader '%s' did not compile.\n", file);
-					glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &infoLogLen);
-					if (infoLogLen > 0)
-					{
-						GLchar* infoLog = new GLchar[infoLogLen + 1];
-						glGetShaderInfoLog(shader, infoLogLen, NULL, infoLog);
-						infoLog[infoLogLen] = '\0';
-						if (fopen_s(&logfile, "glsllog.txt", "w") == 0)
-						{
-							fprintf(logfile, "\n%s\n", infoLog);
-							fclose(logfile);
-						}
-						fprintf(stderr, "\n%s\n", infoLog);
-						delete[] infoLog;
-					}
-					glDeleteShader(shader);
-					Valid = false;
-				}
-				else
-				{
-					if (Verbose)
-						fprintf(stderr, "Shader '%s' compiled.\n", file);
-
-					glAttachShader(this->Program, shader);
-				}
+				SharedShaders[key] = shader;
 			}
-		}
 
+			glAttachShader(this->Program, shader);
+			PendingShaders.push_back(shader);
+			PendingFiles.push_back(file);
+		}
 
 
-		// go to the next vararg file:
 
-		file = va_arg(args, char*);
 	}
 
-	va_end(args);
-
 	// link the entire shader program:
 
+	if (CacheBinary)
+		glProgramParameteri(Program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 	glLinkProgram(Program);
 	CheckGlErrors("Link Shader 1");
 
+	return Valid;
+}
+
+
+// wait for what Submit( ) started, and report how it went:
+
+bool
+GLSLProgram::Finish()
+{
+	if (!Submitted)
+		return Valid;
+	Submitted = false;
+
+	if (FromBinary)
+		return Valid;
+
+	// the shaders first, so a compile error is reported as one instead of as a failed link:
+
+	bool compiled = true;
+	for (size_t i = 0; i < PendingShaders.size(); i++)
+	{
+		GLuint shader = PendingShaders[i];
+		const char* file = PendingFiles[i].c_str();
+		GLint infoLogLen;
+		GLint compileStatus;
+		glGetShaderiv(shader, GL_COMPILE_STATUS, &compileStatus);
+
+		if (compileStatus == 0)
+		{
+			FILE* logfile;
+			fprintf(stderr, "Shader '%s' did not compile.\n", file);
+			glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &infoLogLen);
+			if (infoLogLen > 0)
+			{
+				GLchar* infoLog = new GLchar[infoLogLen + 1];
+				glGetShaderInfoLog(shader, infoLogLen, NULL, infoLog);
+				infoLog[infoLogLen] = '\0';
+				if (fopen_s(&logfile, "glsllog.txt", "w") == 0)
+				{
+					fprintf(logfile, "\n%s\n", infoLog);
+					fclose(logfile);
+				}
+				fprintf(stderr, "\n%s\n", infoLog);
+				delete[] infoLog;
+			}
+			compiled = false;
+		}
+		else
+		{
+			if (Verbose)
+				fprintf(stderr, "Shader '%s' compiled.\n", file);
+		}
+	}
+
+	PendingShaders.clear();
+	PendingFiles.clear();
+
+	if (!compiled)
+	{
+		glDeleteProgram(Program);
+		Valid = false;
+		return Valid;
+	}
+
 	GLchar* infoLog;
 	GLint infoLogLen;
 	GLint linkStatus;
@@ -407,6 +808,9 @@ GLSLProgram::CreateHelper(char* file0, ...)
 			if (Verbose)
 				fprintf(stderr, "Shader Program validated.\n");
 		}
+
+		if (Valid && CacheBinary)
+			WriteProgramBinary(Program, BinaryName, BinaryKey);
 	}
 
 	return Valid;
@@ -442,6 +846,17 @@ GLSLProgram::SetVerbose(bool v)
 }
 
 
+// the #define lines to put in each shader, just after its #version line, the next time it is compiled
+// (one shader file can be made into several programs, each specialized by its own defines)
+// e.g. "#define NORMAL_MAP\n#define NUM_LIGHTS 4\n"
+
+void
+GLSLProgram::SetDefines(const char* defines)
+{
+	Defines = (defines != NULL) ? defines : "";
+}
+
+
 void
 GLSLProgram::Use()
 {
@@ -568,43 +983,124 @@ GLSLProgram::SetAttributeVariable(char* name, VertexBufferObject& vb, GLenum whi
 
 
 
+	// where this program keeps a uniform, looked up (by the name's contents) the first time it is asked for
+	// returns -1 if there is no such uniform:
+
 	int
-		GLSLProgram::GetUniformLocation(char* name)
+		GLSLProgram::UniformSlot(const char* name)
 	{
-		std::map<char*, int>::iterator pos;
+		std::map<std::string, int>::iterator pos = UniformSlots.find(name);
+		if (pos != UniformSlots.end())
+			return pos->second;
 
-		pos = UniformLocs.find(name);
-		//if( Verbose )
-			//fprintf( stderr, "Uniform: pos = 0x%016x ; size = %d ; end = 0x%016x\n", pos, UniformLocs.size(), UniformLocs.end() );
-		if (pos == UniformLocs.end())
+		struct UniformValue u = { };
+		u.location = glGetUniformLocation(this->Program, name);
+		if (Verbose)
 		{
-			GLuint loc = glGetUniformLocation(this->Program, name);
-			UniformLocs[name] = loc;
-			if (Verbose)
-				fprintf(stderr, "Location of '%s' in Program %d = %d\n", name, this->Program, loc);
+			fprintf(stderr, "Location of '%s' in Program %d = %d\n", name, this->Program, u.location);
+			if (u.location == -1)
+				fprintf(stderr, "Location of uniform variable '%s' is -1\n", name);
 		}
-		else
+
+		int slot = -1;
+		if (u.location >= 0)
 		{
-			if (Verbose)
-			{
-				fprintf(stderr, "Location = %d\n", UniformLocs[name]);
-				if (UniformLocs[name] == -1)
-					fprintf(stderr, "Location of uniform variable '%s' is -1\n", name);
-			}
+			slot = (int)Uniforms.size();
+			Uniforms.push_back(u);
 		}
+		UniformSlots[name] = slot;
+		return slot;
+	}
+
+
+	// does the uniform in this slot have to be set to this value?
+	// (if so, it is remembered as the program's value from now on)
+
+	bool
+		GLSLProgram::UniformChanged(int slot, const void* value, size_t size)
+	{
+		if (slot < 0)
+			return false;
+
+		struct UniformValue& u = Uniforms[slot];
+		if (u.known && u.size == size && memcmp(u.value, value, size) == 0)
+		{
+			UniformsSkipped++;
+			return false;
+		}
+
+		memcpy(u.value, value, size);
+		u.size = size;
+		u.known = true;
+		UniformUploads++;
+		return true;
+	}
+
+
+	// how many uniform values have been set, in every program, and how many weren't because they hadn't changed:
+
+	void
+		GLSLProgram::GetUniformCounts(unsigned long long* uploads, unsigned long long* skipped)
+	{
+		*uploads = UniformUploads;
+		*skipped = UniformsSkipped;
+	}
 
-		return UniformLocs[name];
-	};
 
+	// set a uniform through its handle, if the value has changed
+	// (straight into the program, so it doesn't have to be the one in use):
+
+	void
+		GLSLProgram::Set(UniformHandle<int> u, int val)
+	{
+		if (UniformChanged(u.slot, &val, sizeof(val)))
+			glProgramUniform1i(Program, Uniforms[u.slot].location, val);
+	}
+
+
+	void
+		GLSLProgram::Set(UniformHandle<float> u, float val)
+	{
+		if (UniformChanged(u.slot, &val, sizeof(val)))
+			glProgramUniform1f(Program, Uniforms[u.slot].location, val);
+	}
+
+
+	void
+		GLSLProgram::Set(UniformHandle<glm::vec3> u, const glm::vec3& vec)
+	{
+		if (UniformChanged(u.slot, value_ptr(vec), sizeof(vec)))
+			glProgramUniform3fv(Program, Uniforms[u.slot].location, 1, value_ptr(vec));
+	}
+
+
+	void
+		GLSLProgram::Set(UniformHandle<glm::mat3> u, const glm::mat3& matrix)
+	{
+		if (UniformChanged(u.slot, value_ptr(matrix), sizeof(matrix)))
+			glProgramUniformMatrix3fv(Program, Uniforms[u.slot].location, 1, false, value_ptr(matrix));
+	}
+
+
+	void
+		GLSLProgram::Set(UniformHandle<glm::mat4> u, const glm::mat4& matrix)
+	{
+		if (UniformChanged(u.slot, value_ptr(matrix), sizeof(matrix)))
+			glProgramUniformMatrix4fv(Program, Uniforms[u.slot].location, 1, false, value_ptr(matrix));
+	}
+
+
+	// the same by name (which is looked up in a map each time, so keep a handle for anything set every frame)
+	// these still make the program the one in use (if it has the uniform), as they always have:
 
 	void
 		GLSLProgram::SetUniformVariable(char* name, int val)
 	{
-		int loc;
-		if ((loc = GetUniformLocation(name)) >= 0)
+		UniformHandle<int> u = GetUniform<int>(name);
+		if (u.slot >= 0)
 		{
 			this->Use();
-			glUniform1i(loc, val);
+			Set(u, val);
 		}
 	};
 
@@ -612,12 +1108,11 @@ GLSLProgram::SetAttributeVariable(char* name, VertexBufferObject& vb, GLenum whi
 	void
 		GLSLProgram::SetUniformVariable(char* name, float val)
 	{
-		int loc;
-		
-		if ((loc = GetUniformLocation(name)) >= 0)
+		UniformHandle<float> u = GetUniform<float>(name);
+		if (u.slot >= 0)
 		{
 			this->Use();
-			glUniform1f(loc, val);
+			Set(u, val);
 		}
 	};
 
@@ -625,11 +1120,11 @@ GLSLProgram::SetAttributeVariable(char* name, VertexBufferObject& vb, GLenum whi
 	void
 		GLSLProgram::SetUniformVariable(char* name, float val0, float val1, float val2)
 	{
-		int loc;
-		if ((loc = GetUniformLocation(name)) >= 0)
+		UniformHandle<glm::vec3> u = GetUniform<glm::vec3>(name);
+		if (u.slot >= 0)
 		{
 			this->Use();
-			glUniform3f(loc, val0, val1, val2);
+			Set(u, glm::vec3(val0, val1, val2));
 		}
 	};
 
@@ -637,53 +1132,44 @@ GLSLProgram::SetAttributeVariable(char* name, VertexBufferObject& vb, GLenum whi
 	void
 		GLSLProgram::SetUniformVariable(char* name, float vals[3])
 	{
-		int loc;
-
-		if ((loc = GetUniformLocation(name)) >= 0)
+		UniformHandle<glm::vec3> u = GetUniform<glm::vec3>(name);
+		if (u.slot >= 0)
 		{
 			this->Use();
-			glUniform3fv(loc, 1, vals);
+			Set(u, glm::vec3(vals[0], vals[1], vals[2]));
 		}
 	};
 
 	void
 	GLSLProgram::SetUniformVariable(char* name, glm::mat4& matrix)
 	{
-		int loc;
-
-		if ((loc = GetUniformLocation(name)) >= 0)
+		UniformHandle<glm::mat4> u = GetUniform<glm::mat4>(name);
+		if (u.slot >= 0)
 		{
 			this->Use();
-			//fprintf(stderr, "%s mat4\n", name);
-			//glUniformMatrix4fv(loc, 16, true, &matrix[0][0]);
-			glUniformMatrix4fv(loc, 1, false, value_ptr(matrix));
+			Set(u, matrix);
 		}
 	};
 
 	void
 	GLSLProgram::SetUniformVariable(char* name, glm::mat3& matrix)
 	{
-		int loc;
-
-		if ((loc = GetUniformLocation(name)) >= 0)
+		UniformHandle<glm::mat3> u = GetUniform<glm::mat3>(name);
+		if (u.slot >= 0)
 		{
 			this->Use();
-			//fprintf(stderr, "%s mat4\n", name);
-			//glUniformMatrix3fv(loc, 16, true, &matrix[0][0]);
-			glUniformMatrix3fv(loc, 1, false, value_ptr(matrix));
+			Set(u, matrix);
 		}
 	};
 
 	void
 		GLSLProgram::SetUniformVariable(char* name, glm::vec3& vec)
 	{
-		int loc;
-
-		if ((loc = GetUniformLocation(name)) >= 0)
+		UniformHandle<glm::vec3> u = GetUniform<glm::vec3>(name);
+		if (u.slot >= 0)
 		{
 			this->Use();
-			//fprintf(stderr, "%s vec3\n", name);
-			glUniform3fv(loc, 1, value_ptr(vec) );
+			Set(u, vec);
 		}
 	};
 
@@ -751,6 +1237,8 @@ GLSLProgram::SetAttributeVariable(char* name, VertexBufferObject& vb, GLenum whi
 
 
 	int GLSLProgram::CurrentProgram = 0;
+	unsigned long long GLSLProgram::UniformUploads = 0;
+	unsigned long long GLSLProgram::UniformsSkipped = 0;
 
 
 
@@ -0,0 +1,413 @@
+#include "includes/hdrimage.h"
+#include "includes/mappedfile.h"
+#include "includes/threadpool.h"
+#include "includes/stb_image.h"
+
+#include <math.h>
+#include <string.h>
+
+
+#define ROWS_PER_JOB	32		// scanlines decoded by each thread pool job
+
+
+int
+HdrTexelBytes(int format)
+{
+	return (format == HDR_FLOAT) ? 12 : (format == HDR_HALF) ? 6 : 4;
+}
+
+
+// ---------------------------------------------------------------------------------------------
+// round-to-nearest-even float -> half, and back:
+
+unsigned short
+FloatToHalf(float f)
+{
+	unsigned int bits;
+	memcpy(&bits, &f, sizeof(bits));
+
+	unsigned int sign = (bits >> 16) & 0x8000;
+	int exponent = (int)((bits >> 23) & 0xff) - 127 + 15;
+	unsigned int mantissa = bits & 0x7fffff;
+
+	if (((bits >> 23) & 0xff) == 0xff)			// inf or nan
+		return (unsigned short)(sign | 0x7c00 | (mantissa != 0 ? 0x200 : 0));
+
+	if (exponent >= 31)					// too big: inf
+		return (unsigned short)(sign | 0x7c00);
+
+	if (exponent <= 0)					// denormal or zero
+	{
+		if (exponent < -10)
+			return (unsigned short)sign;
+		mantissa |= 0x800000;
+		int shift = 14 - exponent;
+		unsigned int half = mantissa >> shift;
+		unsigned int rest = mantissa & ((1u << shift) - 1);
+		unsigned int mid = 1u << (shift - 1);
+		if (rest > mid || (rest == mid && (half & 1)))
+			half++;
+		return (unsigned short)(sign | half);
+	}
+
+	unsigned int half = ((unsigned int)exponent << 10) | (mantissa >> 13);
+	unsigned int rest = mantissa & 0x1fff;
+	if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+		half++;						// may carry into the exponent, which is still right
+	return (unsigned short)(sign | half);
+}
+
+
+float
+HalfToFloat(unsigned short h)
+{
+	unsigned int sign = (unsigned int)(h & 0x8000) << 16;
+	int exponent = (h >> 10) & 0x1f;
+	unsigned int mantissa = h & 0x3ff;
+	unsigned int bits;
+
+	if (exponent == 0x1f)					// inf or nan
+		bits = sign | 0x7f800000 | (mantissa << 13);
+	else if (exponent != 0)
+		bits = sign | ((unsigned int)(exponent - 15 + 127) << 23) | (mantissa << 13);
+	else if (mantissa == 0)
+		bits = sign;
+	else							// denormal: normalize it
+	{
+		exponent = 1;
+		while ((mantissa & 0x400) == 0)
+		{
+			mantissa <<= 1;
+			exponent--;
+		}
+		bits = sign | ((unsigned int)(exponent - 15 + 127) << 23) | ((mantissa & 0x3ff) << 13);
+	}
+
+	float f;
+	memcpy(&f, &bits, sizeof(f));
+	return f;
+}
+
+
+// ---------------------------------------------------------------------------------------------
+// rgb -> GL_RGB9_E5, as EXT_texture_shared_exponent has it (negatives go to 0., too big clamps), and back:
+
+#define RGB9E5_MANTISSA_BITS	9
+#define RGB9E5_BIAS		15
+#define RGB9E5_MAX		65408.f		// ( 511 / 512 ) * 2^16
+
+unsigned int
+FloatToRgb9e5(const float rgb[3])
+{
+	float c[3];
+	float biggest = 0.f;
+	for (int i = 0; i < 3; i++)
+	{
+		c[i] = (rgb[i] > 0.f) ? rgb[i] : 0.f;			// (and a nan fails the test too)
+		c[i] = (c[i] < RGB9E5_MAX) ? c[i] : RGB9E5_MAX;
+		biggest = (c[i] > biggest) ? c[i] : biggest;
+	}
+
+	if (biggest == 0.f)
+		return 0;
+
+	int exponent;
+	frexpf(biggest, &exponent);					// biggest = m * 2^exponent, m in [ .5, 1 )
+	int shared = exponent - 1;					// floor( log2( biggest ) )
+	shared = (shared > -RGB9E5_BIAS - 1) ? shared : -RGB9E5_BIAS - 1;
+	shared += 1 + RGB9E5_BIAS;
+
+	float scale = ldexpf(1.f, RGB9E5_MANTISSA_BITS + RGB9E5_BIAS - shared);
+	if ((int)floorf(biggest * scale + 0.5f) == (1 << RGB9E5_MANTISSA_BITS))
+	{
+		shared++;
+		scale *= 0.5f;
+	}
+
+	unsigned int packed = (unsigned int)shared << 27;
+	for (int i = 0; i < 3; i++)
+		packed |= (unsigned int)floorf(c[i] * scale + 0.5f) << (RGB9E5_MANTISSA_BITS * i);
+	return packed;
+}
+
+
+void
+Rgb9e5ToFloat(unsigned int packed, float rgb[3])
+{
+	float scale = ldexpf(1.f, (int)(packed >> 27) - RGB9E5_BIAS - RGB9E5_MANTISSA_BITS);
+	for (int i = 0; i < 3; i++)
+		rgb[i] = (float)((packed >> (RGB9E5_MANTISSA_BITS * i)) & 0x1ff) * scale;
+}
+
+
+// ---------------------------------------------------------------------------------------------
+
+// one texel into the output format:
+
+static void
+StoreTexel(const float rgb[3], int format, unsigned char* out)
+{
+	if (format == HDR_FLOAT)
+	{
+		memcpy(out, rgb, 3 * sizeof(float));
+	}
+	else if (format == HDR_HALF)
+	{
+		unsigned short half[3] = { FloatToHalf(rgb[0]), FloatToHalf(rgb[1]), FloatToHalf(rgb[2]) };
+		memcpy(out, half, sizeof(half));
+	}
+	else
+	{
+		unsigned int packed = FloatToRgb9e5(rgb);
+		memcpy(out, &packed, sizeof(packed));
+	}
+}
+
+
+// rgbe straight to shared exponent, where the .hdr's exponent is in RGB9_E5's range:
+// the mantissas just shift up so the biggest fills 9 bits, which is exact (stbi's float, encoded, is the same)
+// returns false for a texel outside the range, which has to be clamped through float:
+
+static bool
+RgbeToRgb9e5(const unsigned char* t, unsigned int* packed)
+{
+	int biggest = (t[0] > t[1]) ? t[0] : t[1];
+	biggest = (biggest > t[2]) ? biggest : t[2];
+	if (t[3] == 0 || biggest == 0)
+	{
+		*packed = 0;
+		return true;
+	}
+
+	int top = 7;						// the biggest's top bit
+	while ((biggest & (1 << top)) == 0)
+		top--;
+
+	int shared = top + (int)t[3] - 128 - 8 + 1 + RGB9E5_BIAS;
+	if (shared < 0 || shared > 31)
+		return false;
+
+	int shift = RGB9E5_MANTISSA_BITS - 1 - top;
+	*packed = ((unsigned int)shared << 27) | ((unsigned int)t[2] << shift << 18) | ((unsigned int)t[1] << shift << 9) | ((unsigned int)t[0] << shift);
+	return true;
+}
+
+
+// the next header line (without its newline), or false at the end of the file:
+
+static bool
+HeaderLine(const char* data, size_t size, size_t* pos, std::string* line)
+{
+	if (*pos >= size)
+		return false;
+
+	const char* start = data + *pos;
+	const char* end = (const char*)memchr(start, '\n', size - *pos);
+	if (end == NULL)
+		return false;
+
+	line->assign(start, end);
+	*pos = (size_t)(end - data) + 1;
+	return true;
+}
+
+
+// skip one scanline, checking it is one this decodes
+// returns the number of bytes it takes, or 0 if it is damaged or in the old run-length format:
+
+static size_t
+SkipScanline(const unsigned char* p, size_t left, int width)
+{
+	if (width >= 8 && width < 0x8000 && left >= 4 && p[0] == 2 && p[1] == 2 && ((p[2] << 8) | p[3]) == width)
+	{
+		size_t pos = 4;
+		for (int c = 0; c < 4; c++)				// each channel's runs in turn
+		{
+			int n = 0;
+			while (n < width)
+			{
+				if (pos >= left)
+					return 0;
+				int count = p[pos++];
+				if (count > 128)
+				{
+					count -= 128;
+					pos += 1;
+				}
+				else
+				{
+					pos += count;
+				}
+				if (count == 0 || n + count > width || pos > left)
+					return 0;
+				n += count;
+			}
+		}
+		return pos;
+	}
+
+	// flat rgbe, but not with any of the old format's ( 1, 1, 1, count ) repeats:
+
+	size_t bytes = (size_t)width * 4;
+	if (bytes > left)
+		return 0;
+	for (size_t i = 0; i < bytes; i += 4)
+		if (p[i] == 1 && p[i + 1] == 1 && p[i + 2] == 1)
+			return 0;
+	return bytes;
+}
+
+
+// one scanline, that SkipScanline( ) has already checked, into rgbe:
+
+static void
+DecodeScanline(const unsigned char* p, int width, unsigned char* rgbe)
+{
+	if (!(width >= 8 && width < 0x8000 && p[0] == 2 && p[1] == 2 && ((p[2] << 8) | p[3]) == width))
+	{
+		memcpy(rgbe, p, (size_t)width * 4);
+		return;
+	}
+
+	p += 4;
+	for (int c = 0; c < 4; c++)
+	{
+		int n = 0;
+		while (n < width)
+		{
+			int count = *p++;
+			if (count > 128)
+			{
+				count -= 128;
+				unsigned char value = *p++;
+				for (int i = 0; i < count; i++)
+					rgbe[(n + i) * 4 + c] = value;
+			}
+			else
+			{
+				for (int i = 0; i < count; i++)
+					rgbe[(n + i) * 4 + c] = *p++;
+			}
+			n += count;
+		}
+	}
+}
+
+
+// the file, if it is one this decodes itself
+// returns 0 on success, 1 if it isn't a .hdr, 2 if it is one this leaves to stbi:
+
+static int
+DecodeHdr(const char* name, int format, int* width, int* height, std::vector<unsigned char>& texels)
+{
+	MappedFile file;
+	if (!file.Open(name))
+		return 1;
+
+	const char* data = file.Data();
+	size_t size = file.Size();
+	size_t pos = 0;
+	std::string line;
+
+	if (!HeaderLine(data, size, &pos, &line) || (line != "#?RADIANCE" && line != "#?RGBE"))
+		return 1;
+
+	while (HeaderLine(data, size, &pos, &line) && !line.empty())
+	{
+		if (line.compare(0, 7, "FORMAT=") == 0 && line != "FORMAT=32-bit_rle_rgbe")
+			return 2;
+	}
+
+	int w, h;
+	if (!HeaderLine(data, size, &pos, &line) || sscanf_s(line.c_str(), "-Y %d +X %d", &h, &w) != 2 || w <= 0 || h <= 0)
+		return 2;
+
+	// find where each scanline starts (the runs say how long they are, but not where they end
+	// without walking them), then decode bands of them in parallel:
+
+	const unsigned char* pixels = (const unsigned char*)data + pos;
+	size_t left = size - pos;
+	std::vector<size_t> starts(h);
+	size_t at = 0;
+	for (int y = 0; y < h; y++)
+	{
+		size_t bytes = SkipScanline(pixels + at, left - at, w);
+		if (bytes == 0)
+			return 2;
+		starts[y] = at;
+		at += bytes;
+	}
+
+	float scales[256];					// 2^( e - 136 ), as stbi does it
+	scales[0] = 0.f;
+	for (int e = 1; e < 256; e++)
+		scales[e] = ldexpf(1.f, e - (128 + 8));
+
+	size_t texelBytes = HdrTexelBytes(format);
+	texels.resize((size_t)w * h * texelBytes);
+	int numJobs = (h + ROWS_PER_JOB - 1) / ROWS_PER_JOB;
+
+	ThreadPool::Shared()->ParallelFor(numJobs, [&](int job)
+	{
+		std::vector<unsigned char> rgbe((size_t)w * 4);
+		int last = (job + 1) * ROWS_PER_JOB < h ? (job + 1) * ROWS_PER_JOB : h;
+
+		for (int y = job * ROWS_PER_JOB; y < last; y++)
+		{
+			DecodeScanline(pixels + starts[y], w, &rgbe[0]);
+
+			unsigned char* out = &texels[(size_t)(h - 1 - y) * w * texelBytes];		// the file is top row first
+			for (int x = 0; x < w; x++)
+			{
+				const unsigned char* t = &rgbe[x * 4];
+				unsigned int packed;
+				if (format == HDR_RGB9E5 && RgbeToRgb9e5(t, &packed))
+				{
+					memcpy(out + x * texelBytes, &packed, sizeof(packed));
+					continue;
+				}
+
+				float scale = scales[t[3]];
+				float rgb[3] = { t[0] * scale, t[1] * scale, t[2] * scale };
+				StoreTexel(rgb, format, out + x * texelBytes);
+			}
+		}
+	});
+
+	*width = w;
+	*height = h;
+	return 0;
+}
+
+
+// read an .hdr (or any image stbi_loadf( ) can, for the ones this doesn't decode) into rgb texels
+// returns 0 on success, 1 on failure:
+
+int
+ReadHdr(const char* name, int format, int* width, int* height, std::vector<unsigned char>& texels)
+{
+	if (DecodeHdr(name, format, width, height, texels) == 0)
+		return 0;
+
+#ifdef _DEBUG
+	fprintf(stderr, "'%s' isn't an .hdr this decodes -- reading it with stbi\n", name);
+#endif
+
+	int comps;
+	stbi_set_flip_vertically_on_load(1);
+	float* image = stbi_loadf(name, width, height, &comps, 3);
+	if (image == NULL)
+	{
+		fprintf(stderr, "Cannot read '%s'\n", name);
+		return 1;
+	}
+
+	size_t count = (size_t)*width * *height;
+	size_t texelBytes = HdrTexelBytes(format);
+	texels.resize(count * texelBytes);
+	for (size_t i = 0; i < count; i++)
+		StoreTexel(image + i * 3, format, &texels[i * texelBytes]);
+
+	stbi_image_free(image);
+	return 0;
+}
@@ -0,0 +1,584 @@
+#include "includes/iblbake.h"
+#include "includes/threadpool.h"
+
+#include <string.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE__)
+#include <xmmintrin.h>
+#define BAKE_SSE
+#endif
+
+
+#define ROWS_PER_JOB	4
+
+static const float PI = 3.14159265359f;		// as the shaders have it
+
+
+// an rgba texel, in one SSE register if there are any:
+
+#ifdef BAKE_SSE
+typedef __m128 Texel;
+
+static inline Texel	Load(const float* p)			{ return _mm_loadu_ps(p); }
+static inline void	Store(float* p, Texel a)		{ _mm_storeu_ps(p, a); }
+static inline Texel	Zero()					{ return _mm_setzero_ps(); }
+static inline Texel	Add(Texel a, Texel b)			{ return _mm_add_ps(a, b); }
+static inline Texel	Scale(Texel a, float s)			{ return _mm_mul_ps(a, _mm_set1_ps(s)); }
+static inline Texel	Lerp(Texel a, Texel b, float t)		{ return _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), _mm_set1_ps(t))); }
+#else
+struct Texel
+{
+	float	v[4];
+};
+
+static inline Texel	Load(const float* p)			{ Texel a; memcpy(a.v, p, sizeof(a.v)); return a; }
+static inline void	Store(float* p, Texel a)		{ memcpy(p, a.v, sizeof(a.v)); }
+static inline Texel	Zero()					{ Texel a = { { 0.f, 0.f, 0.f, 0.f } }; return a; }
+static inline Texel	Add(Texel a, Texel b)			{ for (int c = 0; c < 4; c++) a.v[c] += b.v[c]; return a; }
+static inline Texel	Scale(Texel a, float s)			{ for (int c = 0; c < 4; c++) a.v[c] *= s; return a; }
+static inline Texel	Lerp(Texel a, Texel b, float t)		{ for (int c = 0; c < 4; c++) a.v[c] += (b.v[c] - a.v[c]) * t; return a; }
+#endif
+
+
+// run f(face, row) over every row of every face, a band of rows per thread pool job:
+
+static void
+ForEachRow(int faces, int rows, std::function<void(int, int)> f)
+{
+	int bands = (rows + ROWS_PER_JOB - 1) / ROWS_PER_JOB;
+	ThreadPool::Shared()->ParallelFor(faces * bands, [&](int job)
+	{
+		int face = job / bands;
+		int first = (job % bands) * ROWS_PER_JOB;
+		int last = (first + ROWS_PER_JOB < rows) ? first + ROWS_PER_JOB : rows;
+		for (int y = first; y < last; y++)
+			f(face, y);
+	});
+}
+
+
+static void
+Normalize(float v[3])
+{
+	float len = sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+	v[0] /= len;
+	v[1] /= len;
+	v[2] /= len;
+}
+
+
+static void
+Cross(const float a[3], const float b[3], float out[3])
+{
+	out[0] = a[1] * b[2] - a[2] * b[1];
+	out[1] = a[2] * b[0] - a[0] * b[2];
+	out[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+
+// the direction through a point (in texels, from the corner) of a cube face,
+// in the order and orientation GL_TEXTURE_CUBE_MAP has them (as prefilter.cs does):
+
+static void
+CubeDirection(int face, float x, float y, int size, float d[3])
+{
+	float s = 2.f * x / (float)size - 1.f;
+	float t = 2.f * y / (float)size - 1.f;
+	switch (face)
+	{
+	case 0:		d[0] = 1.f;	d[1] = -t;	d[2] = -s;	break;
+	case 1:		d[0] = -1.f;	d[1] = -t;	d[2] = s;	break;
+	case 2:		d[0] = s;	d[1] = 1.f;	d[2] = t;	break;
+	case 3:		d[0] = s;	d[1] = -1.f;	d[2] = -t;	break;
+	case 4:		d[0] = s;	d[1] = -t;	d[2] = 1.f;	break;
+	default:	d[0] = -s;	d[1] = -t;	d[2] = -1.f;	break;
+	}
+}
+
+
+// and back: the face a direction hits, and where on it (0. - 1.), by the major axis as GL picks it:
+
+static void
+CubeFace(const float d[3], int* face, float* s, float* t)
+{
+	float ax = fabsf(d[0]), ay = fabsf(d[1]), az = fabsf(d[2]);
+	float ma, sc, tc;
+	if (ax >= ay && ax >= az)
+	{
+		*face = (d[0] > 0.f) ? 0 : 1;
+		ma = ax;
+		sc = (d[0] > 0.f) ? -d[2] : d[2];
+		tc = -d[1];
+	}
+	else if (ay >= az)
+	{
+		*face = (d[1] > 0.f) ? 2 : 3;
+		ma = ay;
+		sc = d[0];
+		tc = (d[1] > 0.f) ? d[2] : -d[2];
+	}
+	else
+	{
+		*face = (d[2] > 0.f) ? 4 : 5;
+		ma = az;
+		sc = (d[2] > 0.f) ? d[0] : -d[0];
+		tc = -d[1];
+	}
+	*s = 0.5f * (sc / ma + 1.f);
+	*t = 0.5f * (tc / ma + 1.f);
+}
+
+
+static void
+AllocateCube(struct IblCube* cube, int size, int levels)
+{
+	cube->size = size;
+	cube->offsets.resize(levels);
+	size_t floats = 0;
+	for (int l = 0; l < levels; l++)
+	{
+		int n = (size >> l) > 0 ? (size >> l) : 1;
+		cube->offsets[l] = floats;
+		floats += (size_t)6 * n * n * 4;
+	}
+	cube->texels.assign(floats, 0.f);
+}
+
+
+static inline float*
+CubeTexel(struct IblCube* cube, int level, int face, int x, int y)
+{
+	int n = (cube->size >> level) > 0 ? (cube->size >> level) : 1;
+	return &cube->texels[cube->offsets[level] + (((size_t)face * n + y) * n + x) * 4];
+}
+
+
+// a texel of a level, where x or y may be one off the face:
+// then it is the nearest texel of the face the direction through it hits
+
+static inline Texel
+FetchCube(const struct IblCube* cube, int level, int face, int x, int y)
+{
+	int n = (cube->size >> level) > 0 ? (cube->size >> level) : 1;
+	if (x < 0 || x >= n || y < 0 || y >= n)
+	{
+		float d[3], s, t;
+		CubeDirection(face, (float)x + 0.5f, (float)y + 0.5f, n, d);
+		CubeFace(d, &face, &s, &t);
+		x = (int)(s * (float)n);
+		y = (int)(t * (float)n);
+		x = (x < 0) ? 0 : (x >= n) ? n - 1 : x;
+		y = (y < 0) ? 0 : (y >= n) ? n - 1 : y;
+	}
+	return Load(&cube->texels[cube->offsets[level] + (((size_t)face * n + y) * n + x) * 4]);
+}
+
+
+static Texel
+BilinearCube(const struct IblCube* cube, int level, const float d[3])
+{
+	int n = (cube->size >> level) > 0 ? (cube->size >> level) : 1;
+	int face;
+	float s, t;
+	CubeFace(d, &face, &s, &t);
+
+	float x = s * (float)n - 0.5f;
+	float y = t * (float)n - 0.5f;
+	int x0 = (int)floorf(x);
+	int y0 = (int)floorf(y);
+	float fx = x - (float)x0;
+	float fy = y - (float)y0;
+
+	Texel top = Lerp(FetchCube(cube, level, face, x0, y0), FetchCube(cube, level, face, x0 + 1, y0), fx);
+	Texel bottom = Lerp(FetchCube(cube, level, face, x0, y0 + 1), FetchCube(cube, level, face, x0 + 1, y0 + 1), fx);
+	return Lerp(top, bottom, fy);
+}
+
+
+// textureLod( ) on a cube with GL_LINEAR_MIPMAP_LINEAR:
+
+static Texel
+SampleCube(const struct IblCube* cube, const float d[3], float lod)
+{
+	int last = (int)cube->offsets.size() - 1;
+	if (lod <= 0.f)
+		return BilinearCube(cube, 0, d);
+	if (lod >= (float)last)
+		return BilinearCube(cube, last, d);
+
+	int l = (int)lod;
+	float f = lod - (float)l;
+	Texel a = BilinearCube(cube, l, d);
+	return (f > 0.f) ? Lerp(a, BilinearCube(cube, l + 1, d), f) : a;
+}
+
+
+// texture( ) on a 2D image clamped to its edges, trilinear, at a known level:
+
+static Texel
+Bilinear2D(const std::vector<float>& rgba, int w, int h, float u, float v)
+{
+	float x = u * (float)w - 0.5f;
+	float y = v * (float)h - 0.5f;
+	int x0 = (int)floorf(x);
+	int y0 = (int)floorf(y);
+	float fx = x - (float)x0;
+	float fy = y - (float)y0;
+	int x1 = (x0 + 1 < w) ? x0 + 1 : w - 1;
+	int y1 = (y0 + 1 < h) ? y0 + 1 : h - 1;
+	x0 = (x0 < 0) ? 0 : (x0 >= w) ? w - 1 : x0;
+	y0 = (y0 < 0) ? 0 : (y0 >= h) ? h - 1 : y0;
+	x1 = (x1 < 0) ? 0 : x1;
+	y1 = (y1 < 0) ? 0 : y1;
+
+	Texel top = Lerp(Load(&rgba[((size_t)y0 * w + x0) * 4]), Load(&rgba[((size_t)y0 * w + x1) * 4]), fx);
+	Texel bottom = Lerp(Load(&rgba[((size_t)y1 * w + x0) * 4]), Load(&rgba[((size_t)y1 * w + x1) * 4]), fx);
+	return Lerp(top, bottom, fy);
+}
+
+
+// where env.frag reads the equirectangular image for a direction:
+
+static void
+SphericalUV(float d[3], float* u, float* v)
+{
+	Normalize(d);
+	*u = atan2f(d[2], d[0]) * 0.1591f + 0.5f;
+	*v = asinf(d[1]) * 0.3183f + 0.5f;
+}
+
+
+// the GGX importance samples prefilter.cs takes for each level, one level after another (first[l] to first[l+1]),
+// 4 floats each: the light direction around a +z normal (taking V = N) in xyz,
+// and in w the environment mip whose texels are about the size of the sample's share of the lobe
+// (of each level's count, the ones whose light is below the horizon are left out,
+// and at roughness 0 they are all the mirror direction, so one stands for them):
+
+void
+MakePrefilterSamples(const int counts[IBL_PREFILTER_LEVELS], std::vector<float>& samples, int first[IBL_PREFILTER_LEVELS + 1])
+{
+	const double resolution = (double)IBL_ENV_SIZE;
+	const double saTexel = 4. * M_PI / (6. * resolution * resolution);
+
+	samples.clear();
+	for (int l = 0; l < IBL_PREFILTER_LEVELS; l++)
+	{
+		double roughness = (double)l / (double)(IBL_PREFILTER_LEVELS - 1);
+		double a2 = roughness * roughness * roughness * roughness;
+		int count = (l == 0) ? 1 : counts[l];
+		first[l] = (int)samples.size() / 4;
+
+		for (int i = 0; i < count; i++)
+		{
+			// Hammersley point i of count:
+			unsigned int bits = (unsigned int)i;
+			bits = (bits << 16u) | (bits >> 16u);
+			bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+			bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+			bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+			bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+			double xi0 = (double)i / (double)count;
+			double xi1 = (double)bits * 2.3283064365386963e-10;
+
+			// the half vector, then the light reflected about it:
+			double phi = 2. * M_PI * xi0;
+			double cosTheta = sqrt((1. - xi1) / (1. + (a2 - 1.) * xi1));
+			double sinTheta = sqrt(1. - cosTheta * cosTheta);
+			double Lx = 2. * cosTheta * cos(phi) * sinTheta;
+			double Ly = 2. * cosTheta * sin(phi) * sinTheta;
+			double Lz = 2. * cosTheta * cosTheta - 1.;
+			if (Lz <= 0.)
+				continue;
+
+			// N.H = H.V = cos theta, so the pdf of L is D / 4:
+			double denom = cosTheta * cosTheta * (a2 - 1.) + 1.;
+			double D = a2 / (M_PI * denom * denom);
+			double pdf = D * cosTheta / (4. * cosTheta) + 0.0001;
+			double saSample = 1. / ((double)count * pdf + 0.0001);
+			double mipLevel = (l == 0) ? 0. : 0.5 * log2(saSample / saTexel);
+
+			samples.push_back((float)Lx);
+			samples.push_back((float)Ly);
+			samples.push_back((float)Lz);
+			samples.push_back((float)(mipLevel > 0. ? mipLevel : 0.));
+		}
+	}
+	first[IBL_PREFILTER_LEVELS] = (int)samples.size() / 4;
+}
+
+
+// env.frag drawn onto each face of a size x size cube, then box-filtered down to 1 x 1
+// the image's level is picked from how far its uv moves between neighbouring texels,
+// as the GPU's derivatives would (except across the u = 0 / 1 seam, where theirs jump):
+
+void
+BakeEnvironmentCube(const struct MipChain* env, int size, struct IblCube* cube)
+{
+	int numEnv = (int)env->levels.size();
+	std::vector< std::vector<float> > rgba(numEnv);
+	std::vector<float> src;
+	for (int l = 0; l < numEnv; l++)
+	{
+		const struct MipLevel& lev = env->levels[l];
+		MipLevelFloats(env, l, src);
+		rgba[l].assign((size_t)lev.width * lev.height * 4, 0.f);
+		for (size_t i = 0; i < (size_t)lev.width * lev.height; i++)
+			memcpy(&rgba[l][i * 4], &src[i * env->components], env->components * sizeof(float));
+	}
+
+	float W = (float)env->levels[0].width;
+	float H = (float)env->levels[0].height;
+	int levels = NumMipLevels(size, size);
+	AllocateCube(cube, size, levels);
+
+	ForEachRow(6, size, [&](int face, int y)
+	{
+		for (int x = 0; x < size; x++)
+		{
+			float d[3], u, v, ux, vx, uy, vy;
+			CubeDirection(face, (float)x + 0.5f, (float)y + 0.5f, size, d);
+			SphericalUV(d, &u, &v);
+			CubeDirection(face, (float)x + 1.5f, (float)y + 0.5f, size, d);
+			SphericalUV(d, &ux, &vx);
+			CubeDirection(face, (float)x + 0.5f, (float)y + 1.5f, size, d);
+			SphericalUV(d, &uy, &vy);
+
+			float dux = ux - u, duy = uy - u;
+			dux -= floorf(dux + 0.5f);
+			duy -= floorf(duy + 0.5f);
+			float rx = sqrtf(dux * W * dux * W + (vx - v) * H * (vx - v) * H);
+			float ry = sqrtf(duy * W * duy * W + (vy - v) * H * (vy - v) * H);
+			float lod = log2f(rx > ry ? rx : ry);
+
+			Texel c;
+			if (lod <= 0.f)
+				c = Bilinear2D(rgba[0], (int)W, (int)H, u, v);
+			else
+			{
+				int l = (int)lod;
+				float f = lod - (float)l;
+				if (l >= numEnv - 1)
+					c = Bilinear2D(rgba[numEnv - 1], env->levels[numEnv - 1].width, env->levels[numEnv - 1].height, u, v);
+				else
+					c = Lerp(Bilinear2D(rgba[l], env->levels[l].width, env->levels[l].height, u, v),
+						Bilinear2D(rgba[l + 1], env->levels[l + 1].width, env->levels[l + 1].height, u, v), f);
+			}
+			Store(CubeTexel(cube, 0, face, x, y), c);
+		}
+	});
+
+	for (int l = 1; l < levels; l++)
+	{
+		int n = (size >> l) > 0 ? (size >> l) : 1;
+		ForEachRow(6, n, [&](int face, int y)
+		{
+			for (int x = 0; x < n; x++)
+			{
+				Texel sum = Add(Add(Load(CubeTexel(cube, l - 1, face, 2 * x, 2 * y)), Load(CubeTexel(cube, l - 1, face, 2 * x + 1, 2 * y))),
+						Add(Load(CubeTexel(cube, l - 1, face, 2 * x, 2 * y + 1)), Load(CubeTexel(cube, l - 1, face, 2 * x + 1, 2 * y + 1))));
+				Store(CubeTexel(cube, l, face, x, y), Scale(sum, 0.25f));
+			}
+		});
+	}
+}
+
+
+// iem.frag: the cosine-weighted hemisphere around each texel's direction, on the same grid of angles
+// (its texture( ) reads the environment about one irradiance texel wide, so at log2(env / size)):
+
+void
+BakeIrradianceCube(const struct IblCube* env, int size, struct IblCube* iem)
+{
+	std::vector<float> grid;
+	for (float phi = 0.f; phi < 2.f * PI; phi += 0.025f)
+	{
+		for (float theta = 0.f; theta < 0.5f * PI; theta += 0.025f)
+		{
+			grid.push_back(sinf(theta) * cosf(phi));
+			grid.push_back(sinf(theta) * sinf(phi));
+			grid.push_back(cosf(theta));
+			grid.push_back(cosf(theta) * sinf(theta));
+		}
+	}
+	int numSamples = (int)grid.size() / 4;
+	float lod = log2f((float)env->size / (float)size);
+
+	AllocateCube(iem, size, 1);
+
+	ForEachRow(6, size, [&](int face, int y)
+	{
+		for (int x = 0; x < size; x++)
+		{
+			float N[3], right[3], up[3] = { 0.f, 1.f, 0.f };
+			CubeDirection(face, (float)x + 0.5f, (float)y + 0.5f, size, N);
+			Normalize(N);
+			Cross(up, N, right);
+			Normalize(right);
+			Cross(N, right, up);
+			Normalize(up);
+
+			Texel sum = Zero();
+			for (int i = 0; i < numSamples; i++)
+			{
+				const float* g = &grid[4 * i];
+				float d[3];
+				for (int c = 0; c < 3; c++)
+					d[c] = g[0] * right[c] + g[1] * up[c] + g[2] * N[c];
+				sum = Add(sum, Scale(SampleCube(env, d, lod), g[3]));
+			}
+			Store(CubeTexel(iem, 0, face, x, y), Scale(sum, PI * (1.f / (float)numSamples)));
+		}
+	});
+}
+
+
+// prefilter.frag (or prefilter.cs): each level the GGX lobe of its roughness,
+// counts[l] importance samples at level l (see MakePrefilterSamples( )):
+
+void
+BakePrefilterCube(const struct IblCube* env, int size, const int counts[IBL_PREFILTER_LEVELS], struct IblCube* out)
+{
+	std::vector<float> samples;
+	int first[IBL_PREFILTER_LEVELS + 1];
+	MakePrefilterSamples(counts, samples, first);
+
+	AllocateCube(out, size, IBL_PREFILTER_LEVELS);
+
+	for (int l = 0; l < IBL_PREFILTER_LEVELS; l++)
+	{
+		int n = (size >> l) > 0 ? (size >> l) : 1;
+		ForEachRow(6, n, [&](int face, int y)
+		{
+			for (int x = 0; x < n; x++)
+			{
+				float N[3], tangent[3], bitangent[3];
+				CubeDirection(face, (float)x + 0.5f, (float)y + 0.5f, n, N);
+				Normalize(N);
+				float up[3] = { 0.f, 0.f, 1.f };
+				if (fabsf(N[2]) >= 0.999f)
+				{
+					up[0] = 1.f;
+					up[2] = 0.f;
+				}
+				Cross(up, N, tangent);
+				Normalize(tangent);
+				Cross(N, tangent, bitangent);
+
+				Texel sum = Zero();
+				float totalWeight = 0.f;
+				for (int i = first[l]; i < first[l + 1]; i++)
+				{
+					const float* s = &samples[4 * i];
+					float L[3];
+					for (int c = 0; c < 3; c++)
+						L[c] = tangent[c] * s[0] + bitangent[c] * s[1] + N[c] * s[2];
+					sum = Add(sum, Scale(SampleCube(env, L, s[3]), s[2]));
+					totalWeight += s[2];
+				}
+				Store(CubeTexel(out, l, face, x, y), Scale(sum, 1.f / totalWeight));
+			}
+		});
+	}
+}
+
+
+// brdfLUT.frag: the scale and bias to F0 of the split-sum specular, NdotV across and roughness up
+// (the half vectors only depend on the roughness, so each row makes them once):
+
+void
+BakeBrdfTable(int size, struct IblTexels* out)
+{
+	const int SAMPLE_COUNT = 1024;
+
+	out->internalFormat = GL_RG16F;
+	out->width = size;
+	out->height = size;
+	out->faces = 1;
+	out->offsets.assign(1, 0);
+	out->texels.assign((size_t)size * size * 2, 0.f);
+
+	ForEachRow(1, size, [&](int face, int y)
+	{
+		float roughness = ((float)y + 0.5f) / (float)size;
+		float a = roughness * roughness;
+		float k = (roughness * roughness) * 0.5f;
+
+		// ImportanceSampleGGX( ) around N = +z, whose tangent frame is (0, -1, 0), (1, 0, 0):
+		std::vector<float> H(3 * SAMPLE_COUNT);
+		for (int i = 0; i < SAMPLE_COUNT; i++)
+		{
+			unsigned int bits = (unsigned int)i;
+			bits = (bits << 16u) | (bits >> 16u);
+			bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+			bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+			bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+			bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+			float xi0 = (float)i / (float)SAMPLE_COUNT;
+			float xi1 = (float)bits * 2.3283064365386963e-10f;
+
+			float phi = 2.f * PI * xi0;
+			float cosTheta = sqrtf((1.f - xi1) / (1.f + (a * a - 1.f) * xi1));
+			float sinTheta = sqrtf(1.f - cosTheta * cosTheta);
+			float h[3] = { sinf(phi) * sinTheta, -cosf(phi) * sinTheta, cosTheta };
+			Normalize(h);
+			memcpy(&H[3 * i], h, sizeof(h));
+		}
+
+		for (int x = 0; x < size; x++)
+		{
+			float NdotV = ((float)x + 0.5f) / (float)size;
+			float V[3] = { sqrtf(1.f - NdotV * NdotV), 0.f, NdotV };
+			float A = 0.f, B = 0.f;
+
+			for (int i = 0; i < SAMPLE_COUNT; i++)
+			{
+				const float* h = &H[3 * i];
+				float VdotH = V[0] * h[0] + V[2] * h[2];
+				float L[3];
+				for (int c = 0; c < 3; c++)
+					L[c] = 2.f * VdotH * h[c] - V[c];
+				Normalize(L);
+
+				float NdotL = (L[2] > 0.f) ? L[2] : 0.f;
+				float NdotH = (h[2] > 0.f) ? h[2] : 0.f;
+				VdotH = (VdotH > 0.f) ? VdotH : 0.f;
+
+				if (NdotL > 0.f)
+				{
+					float G = (NdotV / (NdotV * (1.f - k) + k)) * (NdotL / (NdotL * (1.f - k) + k));
+					float G_Vis = (G * VdotH) / (NdotH * NdotV);
+					float Fc = powf(1.f - VdotH, 5.f);
+
+					A += (1.f - Fc) * G_Vis;
+					B += Fc * G_Vis;
+				}
+			}
+
+			out->texels[((size_t)y * size + x) * 2 + 0] = A / (float)SAMPLE_COUNT;
+			out->texels[((size_t)y * size + x) * 2 + 1] = B / (float)SAMPLE_COUNT;
+		}
+	});
+}
+
+
+// the first levels of a cube as the rgb texels a lighting cache keeps:
+
+void
+CubeTexels(const struct IblCube* cube, int levels, struct IblTexels* out)
+{
+	out->internalFormat = GL_RGB16F;
+	out->width = cube->size;
+	out->height = cube->size;
+	out->faces = 6;
+	out->offsets.resize(levels);
+	out->texels.clear();
+
+	for (int l = 0; l < levels; l++)
+	{
+		int n = (cube->size >> l) > 0 ? (cube->size >> l) : 1;
+		out->offsets[l] = out->texels.size();
+		const float* src = &cube->texels[cube->offsets[l]];
+		for (size_t i = 0; i < (size_t)6 * n * n; i++)
+			out->texels.insert(out->texels.end(), src + 4 * i, src + 4 * i + 3);
+	}
+}
@@ -0,0 +1,251 @@
+#include "includes/common.h"
+#include "includes/hdrimage.h"
+#include "includes/iblbake.h"
+#include "includes/iblcache.h"
+#include "includes/mipchain.h"
+#include "includes/shirradiance.h"
+
+#include <string.h>
+#include <chrono>
+
+#ifndef STB_IMAGE_IMPLEMENTATION
+#define STB_IMAGE_IMPLEMENTATION
+#define STBI_NO_BMP
+#define STBI_NO_PSD
+#define STBI_NO_GIF
+#define STBI_NO_PIC
+#define STBI_NO_PNM
+#include "includes/stb_image.h"
+#endif // !STB_IMAGE_IMPLEMENTATION
+
+
+//	IblBaker: make the image-based lighting caches for an HDR image on the CPU
+//
+//	IblBaker [-iem] [-frag] [-check] image.hdr
+//
+//	writes, under the keys the program looks them up by (see iblcache.h):
+//		image.hdr.env.ktx		the environment cube and its mips
+//		image.hdr.sh9			its irradiance, as spherical harmonics
+//		image.hdr.iem.ktx		its irradiance, as a cube		(-iem: slow)
+//		image.hdr.prefilter.ktx		the prefiltered specular cube
+//		assets\brdfLUT.ktx		the BRDF table
+//
+//	-frag	prefilter as prefilter.frag does (for a program built without COMPUTE_PREFILTER)
+//	-check	write nothing: compare the caches the program made on the GPU against these instead,
+//		and exit with 1 if any level is further off than CHECK_TOLERANCE
+//
+//	it has to be run where the program runs, so the shaders it keys on are there
+
+
+// how many GGX samples prefilter.cs takes at each level (leflangj_finalproject.cpp's PREFILTER_SAMPLES):
+
+static const int ComputeSamples[IBL_PREFILTER_LEVELS] = { 1, 128, 256, 512, 1024 };
+
+// how far a GPU-made level may be from the CPU's (its RMS difference over the CPU level's RMS):
+
+#define CHECK_TOLERANCE		0.02
+
+
+static bool	Check = false;
+static bool	Failed = false;
+
+
+static double
+Seconds(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+// compare the file the program made with these texels, level by level:
+
+static void
+CheckTexels(const char* name, GLenum target, const std::string& key, const struct IblTexels* ref)
+{
+	struct IblTexels gpu;
+	if (ReadIblCacheTexels(name, target, key, &gpu) != 0)
+	{
+		fprintf(stderr, "'%s' isn't there, or is out of date, so can't be checked\n", name);
+		Failed = true;
+		return;
+	}
+
+	if (gpu.width != ref->width || gpu.height != ref->height || gpu.faces != ref->faces ||
+		gpu.internalFormat != ref->internalFormat || gpu.offsets.size() != ref->offsets.size())
+	{
+		fprintf(stderr, "'%s' is %dx%d with %d levels, not %dx%d with %d\n", name,
+			gpu.width, gpu.height, (int)gpu.offsets.size(), ref->width, ref->height, (int)ref->offsets.size());
+		Failed = true;
+		return;
+	}
+
+	for (size_t l = 0; l < ref->offsets.size(); l++)
+	{
+		size_t end = (l + 1 < ref->offsets.size()) ? ref->offsets[l + 1] : ref->texels.size();
+		double diff2 = 0., ref2 = 0., worst = 0.;
+		for (size_t i = ref->offsets[l]; i < end; i++)
+		{
+			double d = (double)gpu.texels[i] - (double)ref->texels[i];
+			diff2 += d * d;
+			ref2 += (double)ref->texels[i] * (double)ref->texels[i];
+			worst = (fabs(d) > worst) ? fabs(d) : worst;
+		}
+
+		double relative = (ref2 > 0.) ? sqrt(diff2 / ref2) : sqrt(diff2);
+		bool ok = relative <= CHECK_TOLERANCE;
+		fprintf(stderr, "  %s level %d: relative RMS difference %.4f, largest %.4f%s\n",
+			name, (int)l, relative, worst, ok ? "" : "  <-- too far off");
+		Failed = Failed || !ok;
+	}
+}
+
+
+// write the texels, or check the program's against them:
+
+static void
+Product(const char* name, GLenum target, const std::string& key, const struct IblTexels* texels)
+{
+	if (Check)
+		CheckTexels(name, target, key, texels);
+	else if (WriteIblCacheTexels(name, key, texels) != 0)
+		Failed = true;
+	else
+		fprintf(stderr, "Wrote '%s'\n", name);
+}
+
+
+int
+main(int argc, char* argv[])
+{
+	bool iem = false;
+	bool frag = false;
+	const char* hdr = NULL;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-iem") == 0)
+			iem = true;
+		else if (strcmp(argv[i], "-frag") == 0)
+			frag = true;
+		else if (strcmp(argv[i], "-check") == 0)
+			Check = true;
+		else if (argv[i][0] != '-' && hdr == NULL)
+			hdr = argv[i];
+		else
+		{
+			hdr = NULL;
+			break;
+		}
+	}
+
+	if (hdr == NULL)
+	{
+		fprintf(stderr, "Usage: %s [-iem] [-frag] [-check] image.hdr\n", argv[0]);
+		return 1;
+	}
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::string name(hdr);
+
+
+	// the image and its mips, just as the program loads them
+	// (whichever .mip the program left, or a shared-exponent one, as it makes by default -- see ENV_SHARED_EXPONENT):
+
+	struct MipChain* envChain = new MipChain;
+	if (ReadMipChain(hdr, GL_UNSIGNED_INT_5_9_9_9_REV, false, MIP_BOX, envChain) != 0 &&
+		ReadMipChain(hdr, GL_HALF_FLOAT, false, MIP_BOX, envChain) != 0)
+	{
+		int w, h;
+		std::vector<unsigned char> envImage;
+		if (ReadHdr(hdr, HDR_RGB9E5, &w, &h, envImage) != 0)
+			return 1;
+
+		delete envChain;
+		envChain = BuildMipChain(&envImage[0], w, h, 3, GL_UNSIGNED_INT_5_9_9_9_REV, false, MIP_BOX);
+		WriteMipChain(hdr, envChain);
+	}
+
+	std::string envKey, brdfKey;
+	const int fragmentSamples[IBL_PREFILTER_LEVELS] = { IBL_FRAGMENT_SAMPLES, IBL_FRAGMENT_SAMPLES, IBL_FRAGMENT_SAMPLES, IBL_FRAGMENT_SAMPLES, IBL_FRAGMENT_SAMPLES };
+	const int* samples = frag ? fragmentSamples : ComputeSamples;
+	IblKeys(hdr, frag ? "shaders\\prefilter.frag" : "shaders\\prefilter.cs", samples, &envKey, &brdfKey);
+	if (envKey.empty() || brdfKey.empty())
+	{
+		fprintf(stderr, "Cannot read the shaders to key the caches on -- run this where the program runs\n");
+		return 1;
+	}
+
+	fprintf(stderr, "'%s' is %dx%d (%.2f s)\n", hdr, envChain->levels[0].width, envChain->levels[0].height, Seconds(start));
+
+
+	// the environment cube:
+
+	struct IblCube env;
+	struct IblTexels texels;
+	BakeEnvironmentCube(envChain, IBL_ENV_SIZE, &env);
+	CubeTexels(&env, NumMipLevels(IBL_ENV_SIZE, IBL_ENV_SIZE), &texels);
+	fprintf(stderr, "Environment cube made (%.2f s)\n", Seconds(start));
+	Product((name + IBL_ENV_SUFFIX).c_str(), GL_TEXTURE_CUBE_MAP, envKey, &texels);
+
+
+	// the irradiance, from the first level no wider than 512 as the program projects it:
+
+	struct IrradianceSH sh;
+	int l = 0;
+	while (l + 1 < (int)envChain->levels.size() && envChain->levels[l].width > 512)
+		l++;
+	std::vector<float> shLevel;
+	MipLevelFloats(envChain, l, shLevel);
+	ProjectIrradianceSH(&shLevel[0], envChain->levels[l].width, envChain->levels[l].height, &sh);
+	delete envChain;
+
+	std::string shName = name + SH_IRRADIANCE_SUFFIX;
+	if (!Check)
+	{
+		if (WriteIrradianceSH(shName.c_str(), envKey, &sh) != 0)
+			Failed = true;
+		else
+			fprintf(stderr, "Wrote '%s'\n", shName.c_str());
+	}
+	else
+	{
+		struct IrradianceSH gpu;
+		if (ReadIrradianceSH(shName.c_str(), envKey, &gpu) != 0)
+			fprintf(stderr, "'%s' isn't there (the program may use the irradiance cube instead)\n", shName.c_str());
+		else if (memcmp(&gpu, &sh, sizeof(sh)) != 0)
+		{
+			fprintf(stderr, "  '%s' differs (they are both made on the CPU, so it should be the same)\n", shName.c_str());
+			Failed = true;
+		}
+	}
+
+	if (iem)
+	{
+		struct IblCube irradiance;
+		BakeIrradianceCube(&env, IBL_IEM_SIZE, &irradiance);
+		CubeTexels(&irradiance, 1, &texels);
+		fprintf(stderr, "Irradiance cube made (%.2f s)\n", Seconds(start));
+		Product((name + IBL_IEM_SUFFIX).c_str(), GL_TEXTURE_CUBE_MAP, envKey, &texels);
+	}
+
+
+	// the prefiltered specular cube:
+
+	struct IblCube prefiltered;
+	BakePrefilterCube(&env, IBL_PREFILTER_SIZE, samples, &prefiltered);
+	CubeTexels(&prefiltered, IBL_PREFILTER_LEVELS, &texels);
+	fprintf(stderr, "Prefiltered cube made (%.2f s)\n", Seconds(start));
+	Product((name + IBL_PREFILTER_SUFFIX).c_str(), GL_TEXTURE_CUBE_MAP, envKey, &texels);
+
+
+	// and the BRDF table:
+
+	BakeBrdfTable(IBL_BRDF_SIZE, &texels);
+	fprintf(stderr, "BRDF table made (%.2f s)\n", Seconds(start));
+	Product(IBL_BRDF_CACHE, GL_TEXTURE_2D, brdfKey, &texels);
+
+	if (Check)
+		fprintf(stderr, Failed ? "The GPU's lighting doesn't match\n" : "The GPU's lighting matches\n");
+
+	return Failed ? 1 : 0;
+}
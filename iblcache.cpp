@@ -0,0 +1,419 @@
+#include "includes/iblcache.h"
+#include "includes/hdrimage.h"
+#include "includes/mappedfile.h"
+
+#include <string.h>
+#include <functional>
+
+
+// the KTX 1.1 header, after the 12-byte identifier:
+
+static const unsigned char KtxIdentifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+struct KtxHeader
+{
+	unsigned int	endianness;
+	unsigned int	glType;
+	unsigned int	glTypeSize;
+	unsigned int	glFormat;
+	unsigned int	glInternalFormat;
+	unsigned int	glBaseInternalFormat;
+	unsigned int	pixelWidth;
+	unsigned int	pixelHeight;
+	unsigned int	pixelDepth;
+	unsigned int	numberOfArrayElements;
+	unsigned int	numberOfFaces;
+	unsigned int	numberOfMipmapLevels;
+	unsigned int	bytesOfKeyValueData;
+};
+
+#define KTX_ENDIANNESS	0x04030201
+
+
+// the only two kinds of texture the lighting uses, both half floats:
+
+static GLenum
+BaseFormat(GLenum internalFormat)
+{
+	return (internalFormat == GL_RG16F) ? GL_RG : GL_RGB;
+}
+
+
+// bytes in one face of one level, each row padded to 4 bytes (as KTX, and the default pack alignment, have it):
+
+static size_t
+FaceBytes(GLenum internalFormat, int width, int height)
+{
+	size_t texel = (internalFormat == GL_RG16F) ? 4 : 6;
+	size_t row = (texel * width + 3) & ~(size_t)3;
+	return row * height;
+}
+
+
+static int
+Components(GLenum internalFormat)
+{
+	return (internalFormat == GL_RG16F) ? 2 : 3;
+}
+
+
+// the key for a product made from these files and this description of how it is made
+// returns "" if any of the files can't be read (so nothing will match it):
+
+std::string
+IblCacheKey(const char** files, int numFiles, const char* parameters)
+{
+	unsigned long long hash = HASH_START;
+	for (int i = 0; i < numFiles; i++)
+	{
+		if (!HashFile(files[i], &hash))
+			return std::string();
+	}
+	hash = HashBytes(parameters, strlen(parameters), hash);
+
+	char key[32];
+	sprintf(key, "%016llx", hash);
+	return std::string(key);
+}
+
+
+// the keys InitIBL( ) (and the baker) file the lighting made from an HDR image under:
+// the environment cubes' has the image, their shaders (the specular prefilter done by prefilterShader,
+// taking these samples at each level), and the sizes; the BRDF table's has its shaders and the sizes
+
+void
+IblKeys(const char* hdr, const char* prefilterShader, const int samples[IBL_PREFILTER_LEVELS], std::string* envKey, std::string* brdfKey)
+{
+	char parameters[256];
+	sprintf(parameters, "env %d iem %d prefilter %dx%d (%d %d %d %d %d samples) brdf %d",
+		IBL_ENV_SIZE, IBL_IEM_SIZE, IBL_PREFILTER_SIZE, IBL_PREFILTER_LEVELS,
+		samples[0], samples[1], samples[2], samples[3], samples[4], IBL_BRDF_SIZE);
+
+	const char* envFiles[] = { hdr, "shaders\\env.vert", "shaders\\env.frag", "shaders\\iem.frag", prefilterShader };
+	const char* brdfFiles[] = { "shaders\\brdfLUT.vert", "shaders\\brdfLUT.frag" };
+
+	*envKey = IblCacheKey(envFiles, 5, parameters);
+	*brdfKey = IblCacheKey(brdfFiles, 2, parameters);
+}
+
+
+// check a mapped file is a lighting cache of this kind with this key, and find its levels
+// returns false if it is missing, has another key, or is damaged:
+
+static bool
+ParseKtx(MappedFile* file, const char* name, GLenum target, const std::string& key, struct KtxHeader* header, std::vector<size_t>& offsets)
+{
+	if (key.empty())
+		return false;
+
+	if (!file->Open(name))
+		return false;
+
+	const char* data = file->Data();
+	size_t size = file->Size();
+	size_t start = sizeof(KtxIdentifier) + sizeof(struct KtxHeader);
+
+	if (size < start || memcmp(data, KtxIdentifier, sizeof(KtxIdentifier)) != 0)
+	{
+		fprintf(stderr, "'%s' is not a KTX file\n", name);
+		return false;
+	}
+
+	memcpy(header, data + sizeof(KtxIdentifier), sizeof(struct KtxHeader));
+
+	unsigned int faces = (target == GL_TEXTURE_CUBE_MAP) ? 6 : 1;
+	if (header->endianness != KTX_ENDIANNESS || header->glType != GL_HALF_FLOAT ||
+		(header->glInternalFormat != GL_RGB16F && header->glInternalFormat != GL_RG16F) ||
+		header->numberOfFaces != faces || header->pixelDepth != 0 || header->numberOfArrayElements != 0 ||
+		header->numberOfMipmapLevels == 0 || start + header->bytesOfKeyValueData > size)
+	{
+		fprintf(stderr, "'%s' isn't a lighting cache this can read\n", name);
+		return false;
+	}
+
+
+	// look for the key among the key/value pairs:
+
+	bool found = false;
+	size_t kv = start;
+	size_t kvEnd = start + header->bytesOfKeyValueData;
+	while (kv + 4 <= kvEnd)
+	{
+		unsigned int pairBytes;
+		memcpy(&pairBytes, data + kv, 4);
+		kv += 4;
+		if (kv + pairBytes > kvEnd)
+			break;
+
+		const char* pair = data + kv;
+		size_t keyLength = strnlen(pair, pairBytes);
+		if (keyLength < pairBytes && strcmp(pair, IBL_CACHE_KEY) == 0)
+		{
+			std::string value(pair + keyLength + 1, strnlen(pair + keyLength + 1, pairBytes - keyLength - 1));
+			found = (value == key);
+		}
+		kv += (pairBytes + 3) & ~3u;
+	}
+
+	if (!found)
+	{
+#ifdef _DEBUG
+		fprintf(stderr, "Lighting cache '%s' is out of date -- making it again\n", name);
+#endif
+		return false;
+	}
+
+
+	// every level has to be there before anything is made:
+
+	int levels = (int)header->numberOfMipmapLevels;
+	offsets.resize(levels);
+	size_t at = kvEnd;
+	int l;
+	for (l = 0; l < levels; l++)
+	{
+		int w = (header->pixelWidth >> l) > 0 ? (header->pixelWidth >> l) : 1;
+		int h = (header->pixelHeight >> l) > 0 ? (header->pixelHeight >> l) : 1;
+		unsigned int imageSize;
+		if (at + 4 > size)
+			break;
+		memcpy(&imageSize, data + at, 4);
+		if (imageSize != FaceBytes(header->glInternalFormat, w, h) || at + 4 + (size_t)imageSize * faces > size)
+			break;
+		offsets[l] = at + 4;
+		at += 4 + (size_t)imageSize * faces;
+	}
+
+	if (l < levels)
+	{
+		fprintf(stderr, "Lighting cache '%s' is truncated\n", name);
+		return false;
+	}
+
+	return true;
+}
+
+
+// a texture made from the file, if it has this key (2D or cube, immutable storage,
+// clamped to its edges, and trilinear if it has mips)
+// returns 0 if the file is missing, has another key, or is damaged:
+
+GLuint
+ReadIblCache(const char* name, GLenum target, const std::string& key)
+{
+	MappedFile file;
+	struct KtxHeader header;
+	std::vector<size_t> offsets;
+	if (!ParseKtx(&file, name, target, key, &header, offsets))
+		return 0;
+
+	int levels = (int)header.numberOfMipmapLevels;
+	unsigned int faces = header.numberOfFaces;
+
+	GLuint tex;
+	glCreateTextures(target, 1, &tex);
+	glTextureStorage2D(tex, levels, header.glInternalFormat, header.pixelWidth, header.pixelHeight);
+
+	GLenum format = BaseFormat(header.glInternalFormat);
+	for (int l = 0; l < levels; l++)
+	{
+		int w = (header.pixelWidth >> l) > 0 ? (header.pixelWidth >> l) : 1;
+		int h = (header.pixelHeight >> l) > 0 ? (header.pixelHeight >> l) : 1;
+		size_t faceBytes = FaceBytes(header.glInternalFormat, w, h);
+
+		for (unsigned int f = 0; f < faces; f++)
+		{
+			const char* texels = file.Data() + offsets[l] + f * faceBytes;
+			if (target == GL_TEXTURE_CUBE_MAP)
+				glTextureSubImage3D(tex, l, 0, 0, f, w, h, 1, format, GL_HALF_FLOAT, texels);
+			else
+				glTextureSubImage2D(tex, l, 0, 0, w, h, format, GL_HALF_FLOAT, texels);
+		}
+	}
+
+	glTextureParameteri(tex, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTextureParameteri(tex, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTextureParameteri(tex, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glTextureParameteri(tex, GL_TEXTURE_MIN_FILTER, (levels > 1) ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+	glTextureParameteri(tex, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+#ifdef _DEBUG
+	fprintf(stderr, "Lighting cache '%s' read: %dx%d, %d levels\n", name, header.pixelWidth, header.pixelHeight, levels);
+#endif
+
+	return tex;
+}
+
+
+// the same, into floats on the CPU (for the baker to check against)
+// returns 0 on success, 1 if the file is missing, has another key, or is damaged:
+
+int
+ReadIblCacheTexels(const char* name, GLenum target, const std::string& key, struct IblTexels* out)
+{
+	MappedFile file;
+	struct KtxHeader header;
+	std::vector<size_t> offsets;
+	if (!ParseKtx(&file, name, target, key, &header, offsets))
+		return 1;
+
+	int levels = (int)header.numberOfMipmapLevels;
+	int components = Components(header.glInternalFormat);
+
+	out->internalFormat = header.glInternalFormat;
+	out->width = header.pixelWidth;
+	out->height = header.pixelHeight;
+	out->faces = header.numberOfFaces;
+	out->offsets.resize(levels);
+	out->texels.clear();
+
+	for (int l = 0; l < levels; l++)
+	{
+		int w = (header.pixelWidth >> l) > 0 ? (header.pixelWidth >> l) : 1;
+		int h = (header.pixelHeight >> l) > 0 ? (header.pixelHeight >> l) : 1;
+		size_t faceBytes = FaceBytes(header.glInternalFormat, w, h);
+		size_t rowBytes = faceBytes / h;
+
+		out->offsets[l] = out->texels.size();
+		for (int f = 0; f < out->faces; f++)
+		{
+			for (int y = 0; y < h; y++)
+			{
+				const unsigned char* row = (const unsigned char*)file.Data() + offsets[l] + f * faceBytes + y * rowBytes;
+				for (int i = 0; i < w * components; i++)
+				{
+					unsigned short half;
+					memcpy(&half, row + 2 * i, 2);
+					out->texels.push_back(HalfToFloat(half));
+				}
+			}
+		}
+	}
+
+	return 0;
+}
+
+
+// write a KTX file with the key, asking for each level's faces (half floats, rows padded) in turn
+// returns 0 on success, 1 on failure (the half-written file is removed):
+
+static int
+WriteKtx(const char* name, const std::string& key, GLenum internalFormat, int width, int height, unsigned int faces, int levels,
+	std::function<void(int, std::vector<unsigned char>&)> level)
+{
+	if (key.empty())
+		return 1;
+
+	GLenum format = BaseFormat(internalFormat);
+
+	unsigned int keyBytes = (unsigned int)(strlen(IBL_CACHE_KEY) + 1 + key.size() + 1);
+	unsigned int kvBytes = 4 + ((keyBytes + 3) & ~3u);
+
+	struct KtxHeader header = { };
+	header.endianness = KTX_ENDIANNESS;
+	header.glType = GL_HALF_FLOAT;
+	header.glTypeSize = 2;
+	header.glFormat = format;
+	header.glInternalFormat = internalFormat;
+	header.glBaseInternalFormat = format;
+	header.pixelWidth = width;
+	header.pixelHeight = height;
+	header.numberOfFaces = faces;
+	header.numberOfMipmapLevels = levels;
+	header.bytesOfKeyValueData = kvBytes;
+
+	FILE* fp;
+	if (fopen_s(&fp, name, "wb") != 0)
+	{
+		fprintf(stderr, "Cannot write lighting cache '%s'\n", name);
+		return 1;
+	}
+
+	std::vector<char> kv(kvBytes, 0);
+	memcpy(&kv[0], &keyBytes, 4);
+	memcpy(&kv[4], IBL_CACHE_KEY, strlen(IBL_CACHE_KEY));
+	memcpy(&kv[4 + strlen(IBL_CACHE_KEY) + 1], key.c_str(), key.size());
+
+	bool ok = fwrite(KtxIdentifier, sizeof(KtxIdentifier), 1, fp) == 1;
+	ok = ok && fwrite(&header, sizeof(header), 1, fp) == 1;
+	ok = ok && fwrite(&kv[0], 1, kvBytes, fp) == kvBytes;
+
+	std::vector<unsigned char> texels;
+	for (int l = 0; l < levels && ok; l++)
+	{
+		int w = (width >> l) > 0 ? (width >> l) : 1;
+		int h = (height >> l) > 0 ? (height >> l) : 1;
+		unsigned int imageSize = (unsigned int)FaceBytes(internalFormat, w, h);
+
+		texels.assign((size_t)imageSize * faces, 0);
+		level(l, texels);
+
+		ok = fwrite(&imageSize, 4, 1, fp) == 1;
+		ok = ok && fwrite(&texels[0], 1, texels.size(), fp) == texels.size();
+	}
+
+	ok = (fclose(fp) == 0) && ok;
+
+	if (!ok)
+	{
+		fprintf(stderr, "Cannot write lighting cache '%s'\n", name);
+		remove(name);
+		return 1;
+	}
+
+#ifdef _DEBUG
+	fprintf(stderr, "Lighting cache '%s' written: %dx%d, %d levels\n", name, width, height, levels);
+#endif
+
+	return 0;
+}
+
+
+// read the first levels of a texture back and write them, with the key
+// returns 0 on success, 1 on failure (the half-written file is removed):
+
+int
+WriteIblCache(const char* name, GLuint tex, GLenum target, int levels, GLenum internalFormat, const std::string& key)
+{
+	GLint width, height;
+	glGetTextureLevelParameteriv(tex, 0, GL_TEXTURE_WIDTH, &width);
+	glGetTextureLevelParameteriv(tex, 0, GL_TEXTURE_HEIGHT, &height);
+
+	unsigned int faces = (target == GL_TEXTURE_CUBE_MAP) ? 6 : 1;
+	GLenum format = BaseFormat(internalFormat);
+
+	// glGetTextureImage( ) hands back all six faces of a cube level at once, in KTX's order:
+
+	return WriteKtx(name, key, internalFormat, width, height, faces, levels, [&](int l, std::vector<unsigned char>& texels)
+	{
+		glGetTextureImage(tex, l, format, GL_HALF_FLOAT, (GLsizei)texels.size(), &texels[0]);
+	});
+}
+
+
+// write lighting made on the CPU, with the key
+// returns 0 on success, 1 on failure (the half-written file is removed):
+
+int
+WriteIblCacheTexels(const char* name, const std::string& key, const struct IblTexels* in)
+{
+	int components = Components(in->internalFormat);
+
+	return WriteKtx(name, key, in->internalFormat, in->width, in->height, in->faces, (int)in->offsets.size(),
+		[&](int l, std::vector<unsigned char>& texels)
+	{
+		int w = (in->width >> l) > 0 ? (in->width >> l) : 1;
+		int h = (in->height >> l) > 0 ? (in->height >> l) : 1;
+		size_t rowBytes = FaceBytes(in->internalFormat, w, h) / h;
+
+		const float* src = &in->texels[in->offsets[l]];
+		for (int row = 0; row < in->faces * h; row++)
+		{
+			for (int i = 0; i < w * components; i++)
+			{
+				unsigned short half = FloatToHalf(*src++);
+				memcpy(&texels[row * rowBytes + 2 * i], &half, 2);
+			}
+		}
+	});
+}
@@ -0,0 +1,47 @@
+#pragma once
+#ifndef FRAME_UNIFORMS_H
+#define FRAME_UNIFORMS_H
+
+#include "common.h"
+
+#include "glm/glm/glm.hpp"
+
+
+// the uniform blocks every program that draws the scene shares, written once a frame (see UniformRing)
+// they are laid out std140, as shaders\frameuniforms.glsl declares them, so each vec3 takes a vec4
+
+
+#define FRAME_UNIFORMS_BINDING		1	// uniform block bindings, must match frameuniforms.glsl
+#define LIGHT_UNIFORMS_BINDING		2	// (0 is the SH irradiance's, see shirradiance.h)
+#define SHADOW_UNIFORMS_BINDING		3
+
+#define FRAME_MAX_LIGHTS		4	// must match frameuniforms.glsl's MAX_LIGHTS
+
+
+// the camera:
+
+struct FrameUniforms
+{
+	glm::mat4	proj;
+	glm::mat4	view;
+	glm::vec4	camPos;				// xyz
+};
+
+
+// the lights:
+
+struct LightUniforms
+{
+	glm::vec4	positions[FRAME_MAX_LIGHTS];	// xyz
+	glm::vec4	colors[FRAME_MAX_LIGHTS];	// rgb
+};
+
+
+// each light's transform into its layer of the shadow maps:
+
+struct ShadowUniforms
+{
+	glm::mat4	lightSpace[FRAME_MAX_LIGHTS];
+};
+
+#endif // !FRAME_UNIFORMS_H
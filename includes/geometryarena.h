@@ -0,0 +1,94 @@
+#pragma once
+#ifndef GEOMETRY_ARENA_H
+#define GEOMETRY_ARENA_H
+
+#include "common.h"
+
+#include "vertexbufferobject.h"
+
+
+// one vertex buffer and one element buffer (and one vertex array) shared by many objects
+// each object gets a range of both: its elements are stored as-is and
+// drawn with its base vertex added in, so switching objects needs no rebinding
+//
+// the buffers are immutable (glBufferStorage( )) and, if asked, persistently mapped so
+// objects are copied straight in; when one fills up, a bigger one replaces it on the gpu
+// ranges are never handed back -- this is for geometry that is loaded once
+
+
+struct ArenaRange
+{
+	GLint		baseVertex;
+	GLuint		firstIndex;
+	GLsizei		numIndices;
+	GLsizei		numVertices;
+};
+
+
+class GeometryArena
+{
+    private:
+	GLuint				vao;
+	GLuint				vbuffer;
+	GLuint				ebuffer;
+	int				packing;		// VBO_PACK_NONE or VBO_PACK_NORMALS
+	int				stride;
+	bool				persistent;
+	GLsizeiptr			vertexCapacity;		// in vertices
+	GLsizeiptr			indexCapacity;		// in indices
+	GLsizeiptr			numVertices;
+	GLsizeiptr			numIndices;
+	unsigned char *			vertexMap;
+	GLuint *			indexMap;
+	std::vector <struct ArenaRange>	ranges;
+
+	GLuint	CreateBuffer( GLsizeiptr, unsigned char ** );
+	void	SetupVertexArray( );
+
+    public:
+	int	Add( const void *, int, const GLuint *, int );
+	void	Bind( );
+	GLuint	GetElementBuffer( );
+	int	GetPacking( );
+	const struct ArenaRange&	GetRange( int );
+	int	GetStride( );
+	int	NumRanges( );
+	void	Print( FILE * = stderr );
+	void	Reserve( GLsizeiptr, GLsizeiptr );
+
+	GeometryArena( int _packing = VBO_PACK_NONE, bool _persistent = true )
+	{
+		vao = vbuffer = ebuffer = 0;
+
+		// a shared vertex array can't hold per-object position scales,
+		// so only the normal/tangent/texture packing is allowed here:
+
+		packing = _packing & VBO_PACK_NORMALS;
+		stride = ( packing != VBO_PACK_NONE ) ? sizeof(struct PackedPoint) : sizeof(struct Point);
+		persistent = _persistent;
+		vertexCapacity = indexCapacity = 0;
+		numVertices = numIndices = 0;
+		vertexMap = NULL;
+		indexMap = NULL;
+	};
+
+	~GeometryArena( )
+	{
+		if( vbuffer != 0 )
+		{
+			if( vertexMap != NULL )
+				glUnmapNamedBuffer( vbuffer );
+			glDeleteBuffers( 1, &vbuffer );
+		}
+		if( ebuffer != 0 )
+		{
+			if( indexMap != NULL )
+				glUnmapNamedBuffer( ebuffer );
+			glDeleteBuffers( 1, &ebuffer );
+		}
+		if( vao != 0 )
+			glDeleteVertexArrays( 1, &vao );
+	};
+};
+
+#endif // !GEOMETRY_ARENA_H
@@ -18,12 +18,18 @@
 #include "includes/glut.h"
 #include "glm/glm/glm.hpp"
 #include <map>
+#include <string>
+#include <vector>
 #include <stdarg.h>
 
 #ifndef GL_COMPUTE_SHADER
 #define GL_COMPUTE_SHADER	0x91B9
 #endif
 
+// what a linked program's cached binary is named with (see Create( ) ):
+
+#define GLSL_BINARY_SUFFIX	".glbin"
+
 
 inline int GetOSU(int flag)
 {
@@ -36,6 +42,29 @@ inline int GetOSU(int flag)
 void	CheckGlErrors(const char*);
 
 
+// a uniform of a program, looked up once by GLSLProgram::GetUniform( ) and then set with GLSLProgram::Set( ),
+// which only calls GL when the value differs from the last one the program was given
+// (a handle is good until the program is made again, by Create( ) or Submit( ) ):
+
+template <typename T>
+struct UniformHandle
+{
+	int	slot;			// into the program's copy of its uniforms' values, -1 if it has no such uniform
+
+	UniformHandle() : slot(-1) { }
+};
+
+
+// what a program keeps for each of its uniforms:
+
+struct UniformValue
+{
+	GLint		location;		// -1 if the program has no such (active) uniform
+	bool		known;			// value[ ] holds what the program has
+	size_t		size;
+	unsigned char	value[sizeof(glm::mat4)];
+};
+
 
 class GLSLProgram
 {
@@ -43,52 +72,82 @@ private:
 	std::map<char*, int>	AttributeLocs;
 	char* Cfile;
 	unsigned int		Cshader;
+	std::string		Defines;		// #define lines put in every shader (see SetDefines( ) )
 	char* Ffile;
 	unsigned int		Fshader;
 	char* Gfile;
 	GLuint			Gshader;
+	bool			FromBinary;		// the program was loaded from its cached binary
 	bool			IncludeGstap;
 	GLenum			InputTopology;
 	GLenum			OutputTopology;
+	std::vector<std::string>	PendingFiles;
+	std::vector<GLuint>	PendingShaders;		// compiling, for Finish( ) to check
 	GLuint			Program;
+	bool			Submitted;		// and not yet finished
 	char* TCfile;
 	GLuint			TCshader;
 	char* TEfile;
 	GLuint			TEshader;
-	std::map<char*, int>	UniformLocs;
+	std::map<std::string, int>	UniformSlots;	// name -> its place in Uniforms
+	std::vector<struct UniformValue>	Uniforms;	// each uniform's location, and the value it was last set to
 	bool			Valid;
 	char* Vfile;
 	GLuint			Vshader;
 	bool			Verbose;
 
+	bool			CacheBinary;
+	std::string		BinaryName;
+	unsigned long long	BinaryKey;
+
 	static int		CurrentProgram;
+	static unsigned long long	UniformUploads;		// uniforms set, and
+	static unsigned long long	UniformsSkipped;	//	left alone because they already had the value
 
 	void	AttachShader(GLuint);
 	bool	CanDoBinaryFiles;
 	bool	CanDoComputeShaders;
 	bool	CanDoFragmentShaders;
 	bool	CanDoGeometryShaders;
+	bool	CanDoParallelCompile;
 	bool	CanDoTessControlShaders;
 	bool	CanDoTessEvaluationShaders;
 	bool	CanDoVertexShaders;
 	int	CompileShader(GLuint);
 	bool	CreateHelper(char*, ...);
 	int	GetAttributeLocation(char*);
-	int	GetUniformLocation(char*);
+	bool	UniformChanged(int, const void*, size_t);
+	int	UniformSlot(const char*);
 
 
 public:
 	GLSLProgram();
 
-	bool	Create(char*, char* = NULL, char* = NULL, char* = NULL, char* = NULL, char* = NULL);
+	bool	Create(char*, char* = NULL, char* = NULL, char* = NULL, char* = NULL, char* = NULL);		// loads a cached binary if it can
 	void	DispatchCompute(GLuint, GLuint = 1, GLuint = 1);
+	bool	Finish();
+	static void	GetUniformCounts(unsigned long long*, unsigned long long*);
+	template <typename T>
+	UniformHandle<T>	GetUniform(const char* name)
+	{
+		UniformHandle<T> handle;
+		handle.slot = UniformSlot(name);
+		return handle;
+	}
 	bool	IsExtensionSupported(const char*);
 	bool	IsNotValid();
+	bool	IsReady();
 	bool	IsValid();
 	void	LoadBinaryFile(char*);
 	void	LoadProgramBinary(const char*, GLenum);
 	void	SaveBinaryFile(char*);
 	void	SaveProgramBinary(const char*, GLenum*);
+	void	Set(UniformHandle<int>, int);
+	void	Set(UniformHandle<float>, float);
+	void	Set(UniformHandle<glm::vec3>, const glm::vec3&);
+	void	Set(UniformHandle<glm::mat3>, const glm::mat3&);
+	void	Set(UniformHandle<glm::mat4>, const glm::mat4&);
+	void	SetDefines(const char*);		// before Create( ) or Submit( )
 	void	SetAttributeVariable(char*, int);
 	void	SetAttributeVariable(char*, float);
 	void	SetAttributeVariable(char*, float, float, float);
@@ -114,6 +173,7 @@ public:
 	void	SetUniformVariable(char*, glm::vec3 &);
 
 	void	SetVerbose(bool);
+	bool	Submit(char*, char* = NULL, char* = NULL, char* = NULL, char* = NULL, char* = NULL);
 	void	Use();
 	void	Use(GLuint);
 	void	UseFixedFunction();
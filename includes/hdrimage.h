@@ -0,0 +1,39 @@
+#pragma once
+#ifndef HDR_IMAGE_H
+#define HDR_IMAGE_H
+
+#include "common.h"
+
+
+// Radiance .hdr images, decoded straight into the format they are uploaded in
+// instead of through 32-bit floats:
+//
+// the file is mapped, one quick pass finds where each (run-length encoded) scanline starts,
+// then bands of scanlines are decoded in parallel on the thread pool, each texel converted as it goes
+// the rows come out bottom first, as stbi_set_flip_vertically_on_load( 1 ) has them
+//
+// the few variants this doesn't decode itself (old-style runs, or a rotated or mirrored image)
+// are read by stbi_loadf( ) and converted afterwards
+
+
+enum HdrFormat
+{
+	HDR_FLOAT,		// rgb floats, 12 bytes a texel
+	HDR_HALF,		// rgb half floats (GL_RGB16F, GL_HALF_FLOAT), 6 bytes
+	HDR_RGB9E5		// shared exponent (GL_RGB9_E5, GL_UNSIGNED_INT_5_9_9_9_REV), 4 bytes:
+				//	the .hdr's 8-bit mantissas fit in its 9, so it only loses values past 2^16
+};
+
+
+int		HdrTexelBytes(int);
+int		ReadHdr(const char*, int, int*, int*, std::vector<unsigned char>&);
+
+
+// the conversions, for anything else that keeps texels in these formats:
+
+unsigned short	FloatToHalf(float);
+float		HalfToFloat(unsigned short);
+unsigned int	FloatToRgb9e5(const float[3]);
+void		Rgb9e5ToFloat(unsigned int, float[3]);
+
+#endif // !HDR_IMAGE_H
@@ -0,0 +1,42 @@
+#pragma once
+#ifndef IBL_BAKE_H
+#define IBL_BAKE_H
+
+#include "common.h"
+#include "iblcache.h"
+#include "mipchain.h"
+
+
+// the image-based lighting made on the CPU, every core and SSE, with the same maths as the shaders
+// that make it on the GPU, so it can be baked where there is no GPU and the GPU's can be checked against it:
+//
+//	BakeEnvironmentCube( )	env.frag, drawn onto each face, then glGenerateMipmap( )
+//	BakeIrradianceCube( )	iem.frag
+//	BakePrefilterCube( )	prefilter.frag (or prefilter.cs, with its per-level sample counts)
+//	BakeBrdfTable( )	brdfLUT.frag
+//
+// where a shader lets the GPU pick a mip level from screen-space derivatives, the level is worked out
+// from the texel footprint instead, and cube lookups filter across face edges (GL_TEXTURE_CUBE_MAP_SEAMLESS)
+// by fetching the neighbouring face's nearest texel, so the two agree closely but not to the bit
+
+
+// a cube map on the CPU: every level's six faces in GL's order, rows packed,
+// rgba floats (the alpha is unused, it just makes a texel one SSE register):
+
+struct IblCube
+{
+	int			size;			// of level 0's faces
+	std::vector<size_t>	offsets;		// of each level, into texels[ ]
+	std::vector<float>	texels;
+};
+
+
+void	MakePrefilterSamples(const int[IBL_PREFILTER_LEVELS], std::vector<float>&, int[IBL_PREFILTER_LEVELS + 1]);
+
+void	BakeEnvironmentCube(const struct MipChain*, int, struct IblCube*);
+void	BakeIrradianceCube(const struct IblCube*, int, struct IblCube*);
+void	BakePrefilterCube(const struct IblCube*, int, const int[IBL_PREFILTER_LEVELS], struct IblCube*);
+void	BakeBrdfTable(int, struct IblTexels*);
+void	CubeTexels(const struct IblCube*, int, struct IblTexels*);
+
+#endif // !IBL_BAKE_H
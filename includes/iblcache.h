@@ -0,0 +1,66 @@
+#pragma once
+#ifndef IBL_CACHE_H
+#define IBL_CACHE_H
+
+#include "common.h"
+
+#define GLEW_STATIC
+#include "glew.h"
+
+
+// the image-based lighting textures (the environment cube, its irradiance and prefiltered cubes,
+// and the BRDF table) kept on disk as KTX version 1 files, every face and mip level in half floats,
+// so a warm start reads them back instead of decoding the HDR image and convolving it again
+//
+// each file carries a key in its key/value data (IBL_CACHE_KEY) that is a hash of everything
+// that went into it: the source image's contents, the shaders' sources, and the sizes
+// a file whose key doesn't match is just made again
+//
+// the files can also be made ahead of time, without a GPU, by the baker (iblbaker.cpp),
+// which files what it makes under the same keys
+
+
+#define IBL_CACHE_KEY		"IBLcacheKey"
+
+
+// what the lighting is made at:
+
+#define IBL_ENV_SIZE		2048		// the environment cube's faces (and all their mips)
+#define IBL_IEM_SIZE		256		// the irradiance cube's faces (one level)
+#define IBL_PREFILTER_SIZE	512		// the prefiltered cube's faces,
+#define IBL_PREFILTER_LEVELS	5		//	one level per roughness 0, .25, .5, .75, 1
+#define IBL_BRDF_SIZE		1024		// the BRDF table, NdotV across and roughness up
+
+#define IBL_FRAGMENT_SAMPLES	1024		// what prefilter.frag takes at every level (the compute shader's are set per level)
+
+
+// where it is kept (the cubes next to the HDR image they are made from):
+
+#define IBL_ENV_SUFFIX		".env.ktx"
+#define IBL_IEM_SUFFIX		".iem.ktx"
+#define IBL_PREFILTER_SUFFIX	".prefilter.ktx"
+#define IBL_BRDF_CACHE		"assets\\brdfLUT.ktx"
+
+
+// a lighting texture on the CPU, in floats (2 or 3 per texel, as its internal format has it)
+// each level's faces one after another, rows packed:
+
+struct IblTexels
+{
+	GLenum			internalFormat;		// GL_RGB16F or GL_RG16F
+	int			width;
+	int			height;
+	int			faces;			// 6 for a cube, or 1
+	std::vector<size_t>	offsets;		// of each level, into texels[ ]
+	std::vector<float>	texels;
+};
+
+
+std::string	IblCacheKey(const char**, int, const char*);
+void		IblKeys(const char*, const char*, const int[IBL_PREFILTER_LEVELS], std::string*, std::string*);
+GLuint		ReadIblCache(const char*, GLenum, const std::string&);
+int		ReadIblCacheTexels(const char*, GLenum, const std::string&, struct IblTexels*);
+int		WriteIblCache(const char*, GLuint, GLenum, int, GLenum, const std::string&);
+int		WriteIblCacheTexels(const char*, const std::string&, const struct IblTexels*);
+
+#endif // !IBL_CACHE_H
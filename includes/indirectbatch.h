@@ -0,0 +1,84 @@
+#pragma once
+#ifndef INDIRECT_BATCH_H
+#define INDIRECT_BATCH_H
+
+#include "common.h"
+
+#include "vertexbufferobject.h"
+#include "geometryarena.h"
+#include "materialtable.h"
+
+
+// every object of a GeometryArena drawn with glMultiDrawElementsIndirect( ):
+// the draw commands are built once, after loading, and live in a buffer on the graphics card
+//
+// the draws are sorted by material, so one material's objects are one run of commands
+// and a pass that doesn't care about materials (the shadow passes) is a single call
+// each draw's material number (its MaterialTable layer, if there is a table) and whether its
+// bitangents are packed away are in a shader storage buffer that the vertex shader indexes with
+// gl_DrawIDARB (plus the first command of the call, handed in as a generic attribute),
+// so with a table a whole pass is still a single call
+
+
+#define DRAW_MATERIAL_BINDING	0	// shader storage binding of the per-draw material numbers
+#define DRAW_FIRST_ATTRIB	7	// must match objshader.vert
+
+
+// one draw's entry in that buffer (std430, must match objshader.vert):
+
+struct DrawInfo
+{
+	GLint		material;
+	GLint		decodeBitangent;	// 1 if the shader has to rebuild the bitangent, see VertexBufferObject::PackVertices( )
+};
+
+
+// the layout glMultiDrawElementsIndirect( ) reads:
+
+struct DrawElementsIndirectCommand
+{
+	GLuint		count;
+	GLuint		instanceCount;
+	GLuint		firstIndex;
+	GLint		baseVertex;
+	GLuint		baseInstance;
+};
+
+
+class IndirectBatch
+{
+    private:
+	GeometryArena *			arena;
+	GLuint				cbuffer;		// the DrawElementsIndirectCommands
+	GLuint				mbuffer;		// the material number of each draw
+	int				numDraws;
+	std::vector <std::string>	materials;		// material number -> name
+	std::vector <int>		firstDraw;		// material number -> its first command (plus one past the end)
+
+	void	Submit( int, int );
+
+    public:
+	int	Build( GeometryArena *, std::vector<VertexBufferObject*> *, MaterialTable * = NULL );
+	void	Draw( );
+	void	DrawMaterial( int );
+	const std::string&	GetMaterialName( int );
+	int	NumDraws( );
+	int	NumMaterials( );
+
+	IndirectBatch( )
+	{
+		arena = NULL;
+		cbuffer = mbuffer = 0;
+		numDraws = 0;
+	};
+
+	~IndirectBatch( )
+	{
+		if( cbuffer != 0 )
+			glDeleteBuffers( 1, &cbuffer );
+		if( mbuffer != 0 )
+			glDeleteBuffers( 1, &mbuffer );
+	};
+};
+
+#endif // !INDIRECT_BATCH_H
@@ -6,11 +6,31 @@
 
 #include "stb_image.h"
 
+struct CompressedImage;
+
 struct Texture
 {
     int textW, textH, nrComp;
     unsigned char* img;
     unsigned short* img16;
+    CompressedImage* bc;    // block-compressed mip chain, if textures are compressed (see texturecache.h)
+};
+
+// give back a texture's decoded image and compressed chain (once the graphics card has its own copy),
+// keeping its size:
+
+void FreeTextureImages(Texture*);
+
+// an image named in the .mtl file, waiting to be decoded:
+// LoadMtlFile() only collects these while it parses, then decodes them all at once on the thread pool
+
+struct TextureJob
+{
+    std::string path;
+    int typ, nchan;
+    bool wide;          // 16 bits a channel (normal and height maps)
+    bool normalMap;
+    Texture result;
 };
 
 class Material
@@ -26,6 +46,8 @@ private:
         bump
     };
 
+    std::vector<TextureJob> pending;
+
     void ReadImageTexture(char*, int, int);
 
 public:
@@ -47,6 +69,9 @@ public:
     void ReadNs(char*);
     void ReadRefl(char*);
 
+    std::vector<TextureJob>* GetPendingTextures();
+    void StorePendingTextures();
+
     Material()
     {
         Ns = Ni = d = 0.f;
@@ -62,9 +87,9 @@ public:
 
     ~Material()
     {
-        for (int i = 0; i < 4; i++)
+        for (Texture& t : *textures)
         {
-            stbi_image_free(textures[i].data()->img);
+            FreeTextureImages(&t);
         }
 
         delete textures;
@@ -80,17 +105,19 @@ struct mat
 class MaterialSet
 {
 private:
-    
+    bool compressTextures;
 
 public:
 
     std::vector <struct mat> obj_mats;
 
+    void CompressTextures(bool);
     int LoadMtlFile(char*);
     void Reset();
 
     MaterialSet()
     {
+        compressTextures = false;
         Reset();
     };
 
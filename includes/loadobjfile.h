@@ -9,9 +9,30 @@
 #include <GL/gl.h>
 
 #include "vertexbufferobject.h"
+#include "geometryarena.h"
 #include "loadmtlfile.h"
 
-int LoadObjFile(char*, std::vector<VertexBufferObject*>*, MaterialSet*);
+// how LoadObjFile( ) reads the file:
+
+enum ObjLoadMode
+{
+	OBJ_LOAD_STREAM,	// getc( ) one line at a time, then strtok_s( ) and atof( )
+	OBJ_LOAD_MAPPED,	// map the whole file and scan it in one pass
+	OBJ_LOAD_PARALLEL	// map the whole file and scan chunks of it on every core
+};
+
+// extra work LoadObjFileCached( ) can do (or them together):
+
+enum ObjLoadOptions
+{
+	OBJ_OPTIMIZE		= 1,	// reorder for the vertex cache and overdraw (see meshoptimize.h)
+	OBJ_PACK_NORMALS	= 2,	// upload with VBO_PACK_NORMALS
+	OBJ_PACK_POSITIONS	= 4	// upload with VBO_PACK_POSITIONS
+};
+
+int LoadObjFile(char*, std::vector<VertexBufferObject*>*, MaterialSet*, int = OBJ_LOAD_STREAM, std::vector<std::string>* = NULL);
+int	LoadObjFileCached(char*, std::vector<VertexBufferObject*>*, MaterialSet*, int = OBJ_LOAD_STREAM, int = 0, GeometryArena* = NULL);
+void	BenchObjFile(char*, int);
 void	Cross(float[3], float[3], float[3]);
 float	Unit(float[3]);
 float	Unit(float[3], float[3]);
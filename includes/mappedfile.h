@@ -0,0 +1,60 @@
+#pragma once
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include "common.h"
+
+
+// a read-only view of an entire file, mapped into the address space
+// so it can be scanned in place without any per-line copying:
+
+class MappedFile
+{
+    private:
+	const char *		data;
+	size_t			size;
+#ifdef WIN32
+	HANDLE			file;
+	HANDLE			mapping;
+#else
+	int			fd;
+#endif
+
+    public:
+	bool			Open( const char * );
+	void			Close( );
+	const char *		Data( );
+	size_t			Size( );
+
+	MappedFile( )
+	{
+		data = NULL;
+		size = 0;
+#ifdef WIN32
+		file = INVALID_HANDLE_VALUE;
+		mapping = NULL;
+#else
+		fd = -1;
+#endif
+	};
+
+	~MappedFile( )
+	{
+		Close( );
+	};
+};
+
+
+// the size and modification time of a file, which the on-disk caches are keyed on:
+
+bool	GetFileStamp( const char *, unsigned long long *, long long * );
+
+
+// a hash of some bytes, or of a whole file, for the caches that are keyed on contents instead:
+
+#define HASH_START	14695981039346656037ULL
+
+unsigned long long	HashBytes( const void *, size_t, unsigned long long = HASH_START );
+bool			HashFile( const char *, unsigned long long * );
+
+#endif // !MAPPED_FILE_H
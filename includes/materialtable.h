@@ -0,0 +1,87 @@
+#pragma once
+#ifndef MATERIAL_TABLE_H
+#define MATERIAL_TABLE_H
+
+#include "common.h"
+
+#define GLEW_STATIC
+#include "glew.h"
+
+#include "loadmtlfile.h"
+#include "textureupload.h"
+
+#include <atomic>
+#include <functional>
+
+
+// every material's five maps, kept in five 2D array textures (one layer per material)
+// that stay bound on units 5 - 9 for the whole pass, so switching materials is just a layer number
+//
+// all the layers of an array have to be the same size, so a map that is smaller or bigger
+// than the biggest one of its kind is resampled to fit when the table is built
+// if every material has a map block-compressed (see texturecache.h) at the same size, that array
+// is made in the compressed format instead; otherwise any compressed-only maps are decoded back
+// the mip chains are made on the CPU (see mipchain.h), a layer per thread pool job
+// the chains can also be streamed in through a TextureUploader after the first frame: every layer is
+// black until its chain arrives (a compressed layer is undefined until then)
+// the last layer is left black, for objects whose material isn't in the table
+// (a normal map is flat instead of black wherever there is no image, so it leaves the surface's normal alone)
+
+
+#define MATERIAL_TEXTURE_UNIT	5	// the first of the five units, must match objshader.frag
+
+
+enum MaterialMap
+{
+	MAP_DIFFUSE,
+	MAP_ROUGH,
+	MAP_METAL,
+	MAP_NORMAL,
+	MAP_HEIGHT,
+	NUM_MATERIAL_MAPS
+};
+
+
+class MaterialTable
+{
+    private:
+	GLuint				arrays[NUM_MATERIAL_MAPS];
+	GLuint				ibuffer;		// layer -> itself, for drawing objects one at a time
+	std::vector <std::string>	names;			// layer -> material name
+	std::vector <unsigned int>	present;		// layer -> a bit for each map it has an image for
+	TextureUploader *		uploader;		// NULL to upload the arrays before Build( ) returns
+	std::atomic <int>		loading;		// layers still being made on the thread pool
+
+	void	MakeArray( int, MaterialSet * );
+	bool	MakeCompressedArray( int, MaterialSet * );
+	void	Stream( std::function<void()> );
+
+    public:
+	void	Bind( );
+	int	Build( MaterialSet *, TextureUploader * = NULL );
+	int	Find( const std::string& );
+	void	Finish( );
+	bool	HasMap( int, int );
+	int	NumLayers( );
+	void	Select( int );
+	void	Unbind( );
+
+	MaterialTable( )
+	{
+		for( int i = 0; i < NUM_MATERIAL_MAPS; i++ )
+			arrays[i] = 0;
+		ibuffer = 0;
+		uploader = NULL;
+		loading = 0;
+	};
+
+	~MaterialTable( )
+	{
+		Finish( );
+		glDeleteTextures( NUM_MATERIAL_MAPS, arrays );
+		if( ibuffer != 0 )
+			glDeleteBuffers( 1, &ibuffer );
+	};
+};
+
+#endif // !MATERIAL_TABLE_H
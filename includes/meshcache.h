@@ -0,0 +1,71 @@
+#pragma once
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include "common.h"
+
+#include "vertexbufferobject.h"
+#include "geometryarena.h"
+
+
+// a binary copy of what LoadObjFile( ) builds from a .obj file, so a warm start can skip
+// the parsing and tangent math and hand the arrays straight to the graphics card
+//
+// layout:	MeshCacheHeader
+//		MeshCacheString	[ numMtllibs ]
+//		MeshCacheObject	[ numObjects ]
+//		char		strings[ stringBytes ]
+//		struct Point	points[ ]	(starts on a 16-byte boundary)
+//		GLuint		elements[ ]
+//
+// the cache is only used when the source's size and modification time, and the options, still match
+
+
+#define MESH_CACHE_MAGIC	"MESHCACH"
+#define MESH_CACHE_VERSION	4
+
+
+// how the meshes were processed before caching (a cache only serves the same options):
+
+#define MESH_CACHE_OPTIMIZED	1	// OptimizeMeshes( ) was run on them
+
+
+struct MeshCacheHeader
+{
+	char			magic[8];
+	unsigned int		version;
+	unsigned int		pointSize;		// sizeof(struct Point) when it was written
+	unsigned long long	sourceSize;
+	long long		sourceTime;
+	unsigned int		options;
+	unsigned int		reserved;
+	unsigned int		numMtllibs;
+	unsigned int		numObjects;
+	unsigned long long	stringBytes;
+};
+
+
+struct MeshCacheString
+{
+	unsigned int		offset;			// into the string table
+	unsigned int		length;
+};
+
+
+struct MeshCacheObject
+{
+	unsigned int		topology;
+	unsigned int		attributes;		// VboAttributes bits
+	unsigned int		numPoints;
+	unsigned int		numElements;
+	unsigned long long	pointOffset;		// from the start of the file
+	unsigned long long	elementOffset;
+	struct MeshCacheString	material;
+	float			bounds[6];		// xmin, ymin, zmin, xmax, ymax, zmax
+};
+
+
+int	ReadMeshCache(const char*, const char*, unsigned int, int, GeometryArena*, std::vector<VertexBufferObject*>*, std::vector<std::string>*);
+int	WriteMeshCache(const char*, const char*, unsigned int, std::vector<VertexBufferObject*>*, std::vector<std::string>&);
+
+#endif // !MESH_CACHE_H
@@ -0,0 +1,35 @@
+#pragma once
+#ifndef MESH_OPTIMIZE_H
+#define MESH_OPTIMIZE_H
+
+#include "common.h"
+
+#include "vertexbufferobject.h"
+
+
+// reorders indexed triangle lists so the post-transform vertex cache hits more often and
+// front-most surfaces tend to draw first, then renumbers the vertices in the order
+// they are first fetched
+//
+// the triangle order is Tipsify (Sander, Nehab, Barczak, "Fast Triangle Reordering for
+// Vertex Locality and Reduced Overdraw", 2007): fan around the vertex that will stay in
+// the cache the longest, and restart only at dead ends
+// the runs between those restarts are then sorted so that outward-facing ones draw first
+
+
+#define MESH_CACHE_SIZE		16	// post-transform cache entries to optimize for and to simulate
+
+
+struct VertexCacheStats
+{
+	float	acmr;		// average cache miss ratio:	vertices shaded per triangle (0.5 ... 3)
+	float	atvr;		// average transform to vertex ratio:	vertices shaded per vertex (1 ... 6)
+};
+
+
+struct VertexCacheStats	AnalyzeVertexCache(const std::vector<GLuint>&, int, int = MESH_CACHE_SIZE);
+void	OptimizeTriangleOrder(std::vector<GLuint>&, const std::vector<struct Point>&, int = MESH_CACHE_SIZE);
+void	OptimizeVertexFetch(std::vector<struct Point>&, std::vector<GLuint>&);
+void	OptimizeMeshes(std::vector<VertexBufferObject*>*, bool);
+
+#endif // !MESH_OPTIMIZE_H
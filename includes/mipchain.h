@@ -0,0 +1,83 @@
+#pragma once
+#ifndef MIP_CHAIN_H
+#define MIP_CHAIN_H
+
+#include "common.h"
+
+#define GLEW_STATIC
+#include "glew.h"
+
+
+// a whole mip chain made on the CPU instead of by glGenerateMipmap( ), so the filter is known
+// (the driver's is a plain box, in whatever space it likes) and it can be built off the GL thread
+//
+// 8-bit, 16-bit, half-float and float images, 1 - 4 channels interleaved, any size
+// (or rgb in one shared-exponent int, GL_UNSIGNED_INT_5_9_9_9_REV, for GL_RGB9_E5)
+// each level is filtered from the one above it in float, a band of rows per job on the thread pool
+// colour maps can be marked sRGB: their rgb is filtered in linear light and encoded back
+// (alpha, and every other kind of map, is filtered as it is stored)
+//
+// a chain can be kept next to its source image (<image>.mip) so a warm start reads it instead:
+//
+// layout:	MipChainHeader
+//		MipLevel		[ numLevels ]
+//		unsigned char		texels[ ]	(every level, largest first, rows packed)
+//
+// like the .bcn caches, it is only used while the source's size and modification time still match
+
+
+#define MIP_CHAIN_MAGIC		"MIPCHAIN"
+#define MIP_CHAIN_VERSION	1
+#define MIP_CHAIN_SUFFIX	".mip"
+
+
+enum MipFilter
+{
+	MIP_BOX,		// the average of the texels each new one covers
+	MIP_KAISER		// Kaiser-windowed sinc, 3 lobes: sharper, can ring a little on hard edges
+};
+
+
+struct MipChainHeader
+{
+	char			magic[8];
+	unsigned int		version;
+	unsigned int		type;			// GL_UNSIGNED_BYTE, GL_UNSIGNED_SHORT, GL_HALF_FLOAT,
+							//	GL_UNSIGNED_INT_5_9_9_9_REV or GL_FLOAT
+	unsigned int		components;
+	unsigned int		srgb;
+	unsigned int		filter;
+	unsigned int		numLevels;
+	unsigned long long	sourceSize;
+	long long		sourceTime;
+};
+
+
+struct MipLevel
+{
+	unsigned int		width;
+	unsigned int		height;
+	unsigned long long	offset;			// into texels[ ]
+	unsigned long long	bytes;
+};
+
+
+struct MipChain
+{
+	GLenum				type;
+	int				components;
+	bool				srgb;
+	int				filter;
+	std::vector <struct MipLevel>	levels;
+	std::vector <unsigned char>	texels;
+};
+
+
+int	NumMipLevels(int, int);
+struct MipChain*	BuildMipChain(const void*, int, int, int, GLenum, bool, int, int = 0);
+void	MipLevelFloats(const struct MipChain*, int, std::vector<float>&);
+GLuint	CreateMipTexture(const struct MipChain*, GLenum);
+int	ReadMipChain(const char*, GLenum, bool, int, struct MipChain*);
+int	WriteMipChain(const char*, const struct MipChain*);
+
+#endif // !MIP_CHAIN_H
@@ -0,0 +1,37 @@
+#pragma once
+#ifndef SH_IRRADIANCE_H
+#define SH_IRRADIANCE_H
+
+#include "common.h"
+
+
+// the diffuse (irradiance) lighting of an environment as 9 spherical harmonic (L2) coefficients
+// instead of a convolved cube map: the environment is projected onto the first nine SH basis
+// functions on the CPU, and objshader.frag sums them for its normal
+//
+// the coefficients are already convolved with the cosine lobe and divided by pi, so their sum
+// is what iemMap held (irradiance / pi), and they can be kept in a tiny file keyed like the
+// other lighting caches (see iblcache.h):
+//
+// layout:	char		key[ IBL key length + 1 ]
+//		float		sh[9][4]
+
+
+#define SH_COEFFICIENTS		9
+#define SH_IRRADIANCE_BINDING	0	// uniform block binding, must match objshader.frag
+#define SH_IRRADIANCE_SUFFIX	".sh9"	// the cache, next to the HDR image
+
+
+// as the uniform block has them (std140 pads each vec3 to a vec4):
+
+struct IrradianceSH
+{
+	float	sh[SH_COEFFICIENTS][4];
+};
+
+
+void	ProjectIrradianceSH(const float*, int, int, struct IrradianceSH*);
+int	ReadIrradianceSH(const char*, const std::string&, struct IrradianceSH*);
+int	WriteIrradianceSH(const char*, const std::string&, const struct IrradianceSH*);
+
+#endif // !SH_IRRADIANCE_H
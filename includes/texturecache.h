@@ -0,0 +1,71 @@
+#pragma once
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include "common.h"
+
+#define GLEW_STATIC
+#include "glew.h"
+
+
+// material maps block-compressed for the graphics card, full mip chain and all,
+// and kept in a cache file next to the source image (<image>.bcn) so a warm start
+// reads that instead of decoding the image
+//
+//	color (albedo) maps:	BC1	(GL_COMPRESSED_RGB_S3TC_DXT1_EXT)		4 bits a texel
+//	one-channel maps:	BC4	(GL_COMPRESSED_RED_RGTC1)			4 bits a texel
+//	normal maps:		BC5	(GL_COMPRESSED_RG_RGTC2), x and y only		8 bits a texel
+//				(the shader rebuilds z)
+//
+// the mips are filtered by mipchain.h (the colour maps' in linear light) before they are compressed
+//
+// layout:	TextureCacheHeader
+//		TextureCacheLevel	[ numLevels ]
+//		unsigned char		blocks[ ]	(every level, largest first)
+//
+// the cache is only used when the source's size and modification time, and the format, still match
+
+
+#define TEXTURE_CACHE_MAGIC	"TEXCACHE"
+#define TEXTURE_CACHE_VERSION	2
+#define TEXTURE_CACHE_SUFFIX	".bcn"
+
+
+struct TextureCacheHeader
+{
+	char			magic[8];
+	unsigned int		version;
+	unsigned int		format;			// the GL compressed internal format
+	unsigned long long	sourceSize;
+	long long		sourceTime;
+	unsigned int		numLevels;
+	unsigned int		reserved;
+};
+
+
+struct TextureCacheLevel
+{
+	unsigned int		width;
+	unsigned int		height;
+	unsigned long long	offset;			// into blocks[ ]
+	unsigned long long	bytes;
+};
+
+
+// a compressed image with its mip chain, as it is uploaded:
+
+struct CompressedImage
+{
+	GLenum				format;
+	std::vector <struct TextureCacheLevel>	levels;
+	std::vector <unsigned char>	blocks;
+};
+
+
+GLenum	CompressedFormatFor(int, bool);
+struct CompressedImage*	CompressImage(const void*, int, int, int, bool, GLenum);
+void	DecompressLevel(const struct CompressedImage*, int, unsigned char*, int);
+int	ReadTextureCache(const char*, GLenum, struct CompressedImage*);
+int	WriteTextureCache(const char*, const struct CompressedImage*);
+
+#endif // !TEXTURE_CACHE_H
@@ -0,0 +1,108 @@
+#pragma once
+#ifndef TEXTURE_UPLOAD_H
+#define TEXTURE_UPLOAD_H
+
+#include "common.h"
+
+#define GLEW_STATIC
+#include "glew.h"
+
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+#include <atomic>
+
+
+// texture uploads streamed through a ring of pixel buffer slots, so they don't all have to
+// be made (and waited for) before the first frame:
+//
+// the ring is one buffer, persistently mapped, split into equal slots
+// any thread can Upload( ): it waits for a free slot, copies the texels into it, and queues the slot
+// the GL thread calls Pump( ) once a frame: it copies the queued slots into their textures
+// (from the buffer, so the copy is the graphics card's), fences each one, and frees the slots
+// whose fences have passed
+//
+// an upload bigger than a slot is split into bands of rows (of blocks, if it's compressed)
+// the textures must already have their storage; until a region arrives it reads whatever it held
+
+
+#define UPLOAD_SLOT_SIZE	( 8 * 1024 * 1024 )
+#define UPLOAD_NUM_SLOTS	4
+
+
+class TextureUploader
+{
+    private:
+	enum SlotState
+	{
+		SLOT_FREE,
+		SLOT_FILLING,		// a thread is copying into it
+		SLOT_QUEUED,		// waiting for Pump( )
+		SLOT_IN_FLIGHT		// its copy into the texture has been issued, its fence hasn't passed
+	};
+
+	struct Region
+	{
+		int		slot;
+		GLuint		texture;
+		GLint		level;
+		GLint		y;
+		GLint		layer;			// < 0 for a 2D texture
+		GLsizei		width, height;
+		GLenum		format;
+		GLenum		type;			// 0 for a compressed format
+		GLsizei		bytes;
+	};
+
+	GLuint				buffer;
+	unsigned char *			mapped;
+	size_t				slotSize;
+	std::vector <int>		state;
+	std::vector <GLsync>		fences;
+	std::deque <struct Region>	queued;
+	std::mutex			lock;
+	std::condition_variable		freed;
+	std::thread::id			glThread;
+	std::atomic <int>		outstanding;		// regions asked for that haven't been issued
+	bool				shutdown;		// set by Shutdown( ): no more slots are handed out
+
+	int	AcquireSlot( );
+	void	Send( struct Region, const unsigned char *, size_t, int );
+
+    public:
+	bool	Busy( );
+	void	Finish( );
+	bool	Init( size_t = UPLOAD_SLOT_SIZE, int = UPLOAD_NUM_SLOTS );
+	void	Pump( bool = false );
+	void	Shutdown( );
+	void	Upload( GLuint, int, int, int, int, GLenum, GLenum, int, const void * );
+	void	UploadCompressed( GLuint, int, int, int, int, GLenum, const void * );
+
+	TextureUploader( )
+	{
+		buffer = 0;
+		mapped = NULL;
+		slotSize = 0;
+		outstanding = 0;
+		shutdown = false;
+	};
+
+	~TextureUploader( )
+	{
+		if( buffer != 0 )
+		{
+			Shutdown( );
+			Finish( );
+			for( GLsync f : fences )
+			{
+				if( f != NULL )
+					glDeleteSync( f );
+			}
+			glUnmapNamedBuffer( buffer );
+			glDeleteBuffers( 1, &buffer );
+		}
+	};
+};
+
+#endif // !TEXTURE_UPLOAD_H
@@ -0,0 +1,42 @@
+#pragma once
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include "common.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+
+
+// a fixed set of worker threads:
+// Submit( ) queues a job for them to run (in order) and returns right away, and
+// ParallelFor( ) spreads a loop across them and waits for it to finish
+// ParallelFor( ) also runs items on the calling thread, so it is safe to call
+// it from inside a job without starving the pool
+
+class ThreadPool
+{
+    private:
+	std::vector<std::thread>		workers;
+	std::deque< std::function<void()> >	jobs;
+	std::mutex				lock;
+	std::condition_variable			wake;
+	bool					stopping;
+
+	void	Worker( );
+
+    public:
+	int	NumThreads( );
+	void	ParallelFor( int, std::function<void(int)> );
+	void	Submit( std::function<void()> );
+
+	static ThreadPool *	Shared( );
+
+	ThreadPool( int = 0 );
+	~ThreadPool( );
+};
+
+#endif // !THREAD_POOL_H
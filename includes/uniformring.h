@@ -0,0 +1,67 @@
+#pragma once
+#ifndef UNIFORM_RING_H
+#define UNIFORM_RING_H
+
+#include "common.h"
+
+#define GLEW_STATIC
+#include "glew.h"
+
+
+// uniform blocks that change every frame, written into a ring of uniform buffer regions:
+//
+// the ring is one buffer, persistently mapped, split into one region per frame in flight
+// BeginFrame( ) moves on to the next region, waiting for its fence if the graphics card is still
+// reading what was written into it UNIFORM_RING_FRAMES frames ago; Bind( ) copies a block
+// into the region and binds that range to the block's binding point, where every program whose
+// block has that binding reads it; EndFrame( ) fences the region
+//
+// without persistently mapped buffers, the regions are written with glNamedBufferSubData( ) instead
+
+
+#define UNIFORM_RING_SIZE	( 16 * 1024 )		// each frame's region
+#define UNIFORM_RING_FRAMES	3
+
+
+class UniformRing
+{
+    private:
+	GLuint			buffer;
+	unsigned char *		mapped;			// NULL if the buffer isn't mapped
+	size_t			regionSize;
+	size_t			alignment;		// GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+	int			region;			// the one being written
+	size_t			used;			// of it
+	std::vector <GLsync>	fences;
+
+    public:
+	void	BeginFrame( );
+	void	Bind( GLuint, const void *, size_t );
+	void	EndFrame( );
+	bool	Init( size_t = UNIFORM_RING_SIZE, int = UNIFORM_RING_FRAMES );
+
+	UniformRing( )
+	{
+		buffer = 0;
+		mapped = NULL;
+		regionSize = 0;
+		alignment = 256;
+		region = 0;
+		used = 0;
+	};
+
+	~UniformRing( )
+	{
+		for( GLsync f : fences )
+		{
+			if( f != NULL )
+				glDeleteSync( f );
+		}
+		if( mapped != NULL )
+			glUnmapNamedBuffer( buffer );
+		if( buffer != 0 )
+			glDeleteBuffers( 1, &buffer );
+	};
+};
+
+#endif // !UNIFORM_RING_H
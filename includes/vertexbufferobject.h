@@ -13,6 +13,8 @@
 
 bool	IsExtensionSupported( const char * );
 
+struct VertexCacheStats;
+
 
 struct Point
 {
@@ -55,6 +57,54 @@ class Key
 typedef std::map< Key, int >	PMap;
 
 
+// which attributes a VertexBufferObject carries, so one can be saved and restored:
+
+enum VboAttributes
+{
+	VBO_NORMALS	= 1,
+	VBO_COLORS	= 2,
+	VBO_TEXCOORDS	= 4,
+	VBO_TANGENTS	= 8,
+	VBO_BITANGENTS	= 16,
+	VBO_INDEXED	= 32		// draw with the element array, not just the points in order
+};
+
+
+// smaller vertex layouts the points can be sent to the graphics card in (or them together):
+
+enum VboPacking
+{
+	VBO_PACK_NONE		= 0,
+	VBO_PACK_NORMALS	= 1,	// 10:10:10:2 normal and tangent (w = bitangent sign), half-float s,t
+	VBO_PACK_POSITIONS	= 2	// ... and 16-bit positions across the object's bounds
+};
+
+
+// the packed layouts:
+//	normal and tangent:	GL_INT_2_10_10_10_REV, normalized (the tangent's w is the bitangent's handedness)
+//	texture coordinates:	half floats
+//	position:		floats, or (VBO_PACK_POSITIONS) 16-bit unsigned normalized across the bounds
+// that is 24 or 20 bytes a vertex, instead of 56
+
+struct PackedPoint
+{
+	float		x, y, z;
+	GLuint		n;
+	GLuint		t;
+	GLushort	s, tt;
+};
+
+struct PackedQPoint
+{
+	GLushort	x, y, z, w;
+	GLuint		n;
+	GLuint		t;
+	GLushort	s, tt;
+};
+
+
+class GeometryArena;
+
 
 class VertexBufferObject
 {
@@ -70,6 +120,8 @@ class VertexBufferObject
 	GLenum				topology;
 	bool				verbose;
 	bool				collapseCommonVertices;
+	bool				weldVertices;
+	float				weldEpsilon;
 	bool				isFirstDraw;
 	bool				glBeginWasCalled;
 	bool				drawWasCalled;
@@ -77,24 +129,53 @@ class VertexBufferObject
 
 	std::vector <struct Point>	PointVec;
 	PMap				PointMap;
+	std::vector <GLuint>		WeldTable;		// open addressing, holds PointVec indices
 	std::vector <GLuint>		ElementVec;
 	struct Point *			parray;
 	GLuint *			earray;
 	GLuint				pbuffer;
 	GLuint				ebuffer;
 	GLuint				abuffer;
+	int				numDrawPoints;
+	int				numDrawElements;
+	int				packing;
+	float				decodeScale[3];		// packed position -> object space
+	float				decodeBias[3];
+	bool				decodeBitangent;	// rebuild the bitangent from the normal and tangent
+	GeometryArena *			arena;			// shared buffers to live in, if any
+	int				arenaRange;
 
-	const static GLuint RESTART_INDEX = ~0;	// 0xffffffff
 	const static int TWO_VALUES   = 2;
 	const static int THREE_VALUES = 3;
 
 	GLuint AddVertex( GLfloat, GLfloat, GLfloat );
+	void GrowWeldTable( );
 	void Reset( );
+	void DrawArena( );
+	void Upload( const struct Point *, int, const GLuint *, int );
+	void UploadArena( const struct Point *, int, const GLuint *, int );
+	void UploadPacked( const struct Point *, int );
+	int PackPoints( const struct Point *, int, int, std::vector<unsigned char> & );
 
     public:
+	const static GLuint RESTART_INDEX = ~0;	// 0xffffffff
+	const static int DECODE_SCALE_ATTRIB = 5;	// must match the vertex shaders
+	const static int DECODE_BIAS_ATTRIB  = 6;
+
 	void CollapseCommonVertices( bool );
+	bool DecodesBitangent( );
 	void Draw( );
+	int GetArenaRange( );
+	int GetAttributes( );
+	const std::vector<GLuint>& GetElements( );
 	std::string GetMaterial();
+	const std::vector<struct Point>& GetPoints( );
+	GLenum GetTopology( );
+	bool IsIndexed( );
+	bool Optimize( int, struct VertexCacheStats *, struct VertexCacheStats * );
+	void PackVertices( int );
+	bool Prepare( );
+	void SetArena( GeometryArena * );
 	void SetMaterial(char*);
 	void glBegin( GLenum );
 	void glColor3f( GLfloat, GLfloat, GLfloat );
@@ -111,6 +192,8 @@ class VertexBufferObject
 	void Print( char * = (char *)"", FILE * = stderr );
 	void RestartPrimitive( );
 	void SetVerbose( bool );
+	void UseBuffers( GLenum, int, const struct Point *, int, const GLuint *, int );
+	void WeldVertices( bool, float = 0.f );
 
 	VertexBufferObject( )
 	{
@@ -121,6 +204,14 @@ class VertexBufferObject
 		ebuffer = 0;
 		Reset( );
 		collapseCommonVertices = false;
+		weldVertices = false;
+		weldEpsilon = 0.f;
+		packing = VBO_PACK_NONE;
+		decodeScale[0] = decodeScale[1] = decodeScale[2] = 1.f;
+		decodeBias[0] = decodeBias[1] = decodeBias[2] = 0.f;
+		decodeBitangent = false;
+		arena = NULL;
+		arenaRange = -1;
 		restartFound = false;
 		glBeginWasCalled = false;
 	};
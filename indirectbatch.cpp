@@ -0,0 +1,167 @@
+#include "includes/indirectbatch.h"
+
+
+// make the draw commands and the per-draw material numbers for all the objects, which must
+// already be (or now get) uploaded into the arena as indexed triangle lists
+// the material numbers are the table's layers if a table is given, otherwise in order of first use
+// returns 0 on success, 1 if they can't be drawn this way (draw them one at a time instead):
+
+int
+IndirectBatch::Build( GeometryArena *_arena, std::vector<VertexBufferObject*> *object, MaterialTable *table )
+{
+	if( ! GLEW_ARB_multi_draw_indirect  ||  ! GLEW_ARB_shader_draw_parameters )
+	{
+		fprintf( stderr, "No multi-draw-indirect or shader draw parameters -- drawing objects one at a time\n" );
+		return 1;
+	}
+
+	arena = _arena;
+	materials.clear( );
+	firstDraw.clear( );
+
+	std::vector <struct DrawElementsIndirectCommand>	commands;
+	std::vector <int>					drawMaterial;
+	std::vector <bool>					drawDecode;
+
+	for( VertexBufferObject *vbo : *object )
+	{
+		if( ! vbo->Prepare( ) )
+			continue;		// nothing in it, so Draw( ) wouldn't draw it either
+
+		int range = vbo->GetArenaRange( );
+		if( range < 0  ||  vbo->GetTopology( ) != GL_TRIANGLES  ||  ! vbo->IsIndexed( ) )
+		{
+			fprintf( stderr, "Object '%s' isn't an indexed triangle list in the arena -- drawing objects one at a time\n",
+				vbo->GetMaterial( ).c_str( ) );
+			return 1;
+		}
+
+		std::string name = vbo->GetMaterial( );
+		int m = 0;
+		while( m < (int)materials.size( )  &&  materials[m] != name )
+			m++;
+		if( m == (int)materials.size( ) )
+			materials.push_back( name );
+
+		const struct ArenaRange &r = arena->GetRange( range );
+		struct DrawElementsIndirectCommand command = { (GLuint)r.numIndices, 1, r.firstIndex, r.baseVertex, 0 };
+		commands.push_back( command );
+		drawMaterial.push_back( m );
+		drawDecode.push_back( vbo->DecodesBitangent( ) );
+	}
+
+	numDraws = (int)commands.size( );
+	if( numDraws == 0 )
+		return 1;
+
+
+	// sort the commands by material (keeping the load order within each):
+
+	std::vector <struct DrawElementsIndirectCommand>	sorted;
+	std::vector <struct DrawInfo>			sortedMaterial;
+	sorted.reserve( numDraws );
+	sortedMaterial.reserve( numDraws );
+
+	for( int m = 0; m < (int)materials.size( ); m++ )
+	{
+		firstDraw.push_back( (int)sorted.size( ) );
+		for( int d = 0; d < numDraws; d++ )
+		{
+			if( drawMaterial[d] != m )
+				continue;
+
+			sorted.push_back( commands[d] );
+			struct DrawInfo dm = { ( table != NULL ) ? table->Find( materials[m] ) : m, drawDecode[d] ? 1 : 0 };
+			sortedMaterial.push_back( dm );
+		}
+	}
+	firstDraw.push_back( numDraws );
+
+
+	// both are written once and never touched again:
+
+	if( cbuffer != 0 )
+		glDeleteBuffers( 1, &cbuffer );
+	if( mbuffer != 0 )
+		glDeleteBuffers( 1, &mbuffer );
+
+	glCreateBuffers( 1, &cbuffer );
+	glNamedBufferStorage( cbuffer, numDraws * sizeof(struct DrawElementsIndirectCommand), &sorted[0], 0 );
+	glCreateBuffers( 1, &mbuffer );
+	glNamedBufferStorage( mbuffer, numDraws * sizeof(struct DrawInfo), &sortedMaterial[0], 0 );
+
+#ifdef _DEBUG
+	fprintf( stderr, "Indirect batch: %d draws, %d materials\n", numDraws, (int)materials.size( ) );
+#endif
+
+	return 0;
+}
+
+
+// every object, in one call:
+
+void
+IndirectBatch::Draw( )
+{
+	Submit( 0, numDraws );
+}
+
+
+// just the objects with this material (a run of commands), in one call:
+
+void
+IndirectBatch::DrawMaterial( int m )
+{
+	if( m < 0  ||  m >= (int)materials.size( ) )
+		return;
+
+	Submit( firstDraw[m], firstDraw[m + 1] - firstDraw[m] );
+}
+
+
+const std::string&
+IndirectBatch::GetMaterialName( int m )
+{
+	return materials[m];
+}
+
+
+int
+IndirectBatch::NumDraws( )
+{
+	return numDraws;
+}
+
+
+int
+IndirectBatch::NumMaterials( )
+{
+	return (int)materials.size( );
+}
+
+
+// gl_DrawIDARB starts over at 0 each call, so the first command's number goes along
+// as a "current" attribute value, the same way the decode scale and bias do
+// (the bitangent flag is per draw, in the material buffer, so the scale's w stays 0)
+// like VertexBufferObject::DrawArena( ), this leaves the arena's vertex array bound:
+
+void
+IndirectBatch::Submit( int first, int count )
+{
+	if( count <= 0 )
+		return;
+
+	arena->Bind( );
+
+	glVertexAttrib4f( VertexBufferObject::DECODE_SCALE_ATTRIB, 1.f, 1.f, 1.f, 0.f );
+	glVertexAttrib3f( VertexBufferObject::DECODE_BIAS_ATTRIB,  0.f, 0.f, 0.f );
+	glVertexAttribI1i( DRAW_FIRST_ATTRIB, first );
+
+	glBindBufferBase( GL_SHADER_STORAGE_BUFFER, DRAW_MATERIAL_BINDING, mbuffer );
+	glBindBuffer( GL_DRAW_INDIRECT_BUFFER, cbuffer );
+
+	glMultiDrawElementsIndirect( GL_TRIANGLES, GL_UNSIGNED_INT,
+		BUFFER_OFFSET( first * sizeof(struct DrawElementsIndirectCommand) ), count, 0 );
+
+	glBindBuffer( GL_DRAW_INDIRECT_BUFFER, 0 );
+}
@@ -1,4 +1,5 @@
 #include "includes/common.h"
+#include <algorithm>
 #include <set>
 
 #define GLEW_STATIC
@@ -13,8 +14,17 @@
 #include "glm/glm/gtc/type_ptr.hpp"
 
 // Provided Code
+#include "includes/frameuniforms.h"
 #include "includes/glslprogram.h"
+#include "includes/hdrimage.h"
+#include "includes/iblbake.h"
+#include "includes/iblcache.h"
+#include "includes/indirectbatch.h"
 #include "includes/loadobjfile.h"
+#include "includes/materialtable.h"
+#include "includes/mipchain.h"
+#include "includes/shirradiance.h"
+#include "includes/uniformring.h"
 #include "includes/vertexbufferobject.h"
 
 
@@ -174,6 +184,10 @@ const GLfloat FOGDENSITY = { 0.30f };
 const GLfloat FOGSTART = { 1.5 };
 const GLfloat FOGEND = { 4. };
 
+// the environment (and its lighting caches, which are named after it):
+
+#define ENV_HDR		"assets\\LA_Downtown_Helipad_GoldenHour_3k.hdr"
+
 
 // what options should we compile-in?
 // in general, you don't need to worry about these
@@ -186,6 +200,66 @@ const GLfloat FOGEND = { 4. };
 
 //#define ENABLE_SHADOWS
 
+// should we time the .obj loader modes against each other at startup?
+
+//#define BENCH_OBJ_LOADER
+
+// what to do to the loaded meshes (ObjLoadOptions):
+// reorder them for the vertex cache and overdraw (once, before the mesh cache is written),
+// and upload them with packed normals/tangents/texture coords (add OBJ_PACK_POSITIONS for 16-bit positions,
+// which the shared telescope arena can't use)
+
+const int MESH_OPTIONS = { OBJ_OPTIMIZE | OBJ_PACK_NORMALS };
+
+// should the material maps be block-compressed (BC1/BC4/BC5), through .bcn cache files next to the images?
+
+#define COMPRESS_TEXTURES
+
+// should the material maps be streamed into their textures over the first frames, instead of before them?
+// (through a ring of persistently mapped pixel buffers, if the graphics card has them)
+
+#define STREAM_TEXTURES
+
+// should the environment image be kept (in memory, in its texture, and in its .mip) as shared-exponent
+// GL_RGB9_E5, 4 bytes a texel, instead of half-float GL_RGB16F, 6 bytes?
+// (the .hdr's 8-bit mantissas fit in RGB9_E5's 9, so nothing is lost below 65408)
+
+#define ENV_SHARED_EXPONENT
+
+// should the diffuse lighting be 9 spherical harmonic coefficients (projected on the CPU)
+// instead of the convolved iemMap cube?
+
+#define SH_IRRADIANCE
+
+// should the specular lighting be prefiltered by a compute shader (every face of a mip in one dispatch,
+// fewer samples at the smoother mips) instead of drawing each face of each mip through prefilter.frag?
+
+#define COMPUTE_PREFILTER
+
+// how many GGX samples each of the prefiltered cube's mips takes (mip 0 is a mirror, so one is exact):
+
+const int PREFILTER_SAMPLES[IBL_PREFILTER_LEVELS] = { 1, 128, 256, 512, 1024 };
+
+// should the telescope be drawn with glMultiDrawElementsIndirect( )?
+// (if the graphics card can't, or the meshes don't fit, it is drawn an object at a time anyway)
+
+#define MULTI_DRAW_INDIRECT
+
+// should each of the telescope's materials be drawn with a permutation of objshader.frag made for it
+// (no parallax without a height map, no normal map without one, no shadow lookups with shadows off)
+// instead of with the uber shader that does all of it for every material?
+// (each permutation is compiled the first time a material needs it, then kept)
+
+#define SHADER_PERMUTATIONS
+
+// what every objshader program is built with, the uber shader and each permutation:
+
+#ifdef SH_IRRADIANCE
+const char* OBJ_SHADER_DEFINES = "#define SH_IRRADIANCE\n";
+#else
+const char* OBJ_SHADER_DEFINES = "";
+#endif
+
 // non-constant global variables:
 
 int		ActiveButton;			// current button that is down
@@ -211,23 +285,28 @@ float	Xrot, Yrot;				// rotation angles in degrees
 
 bool	Frozen;
 
-int    envW, envH, nrComp;
+int    envW, envH;
 
 unsigned char* Texture;
 int           width, height;
 
 GLSLProgram *Environment;
 GLSLProgram *Back;
-GLSLProgram *Iem;
+#ifndef SH_IRRADIANCE
+GLSLProgram *Iem;		// only the iemMap convolution uses it
+#endif
 GLSLProgram *Prefilter;
 GLSLProgram *Brdf;
 GLSLProgram *Uber;
+std::map<int, GLSLProgram*> UberVariants;	// objshader's permutations, by their UberKey( )
 
 GLSLProgram *GetDepth;
 
 GLuint framebuf;
 GLuint renderbuf;
 GLuint iemMap;
+GLuint irradianceBuffer;		// the SH coefficients' uniform block, if SH_IRRADIANCE
+IrradianceSH irradianceSH;
 GLuint prefilter;
 GLuint brdf;
 
@@ -235,16 +314,14 @@ GLuint depthMap;
 GLuint shadowMap;
 GLuint shadowColorMap;
 
-struct objtex_maps
-{
-    std::string name;
-    GLuint diffuse, rough, reflect, norm, bump;
-};
-
-std::vector<struct objtex_maps> objtextures;
+MaterialTable* materialTable;
+TextureUploader* uploader;
+UniformRing* uniformRing;		// the per-frame uniform blocks (see frameuniforms.h)
 
 VertexBufferObject* envCubeObj;
 std::vector<VertexBufferObject*> telescopeObj;
+GeometryArena* telescopeArena;
+IndirectBatch* telescopeBatch;
 VertexBufferObject* brdfQuad;
 
 MaterialSet* materiallib;
@@ -255,6 +332,30 @@ const unsigned int shadows[2] =
     2048
 };
 
+// what an objshader.frag permutation has, as bits of its key
+// (the key is these plus the number of lights times UBER_LIGHTS):
+
+enum UberFeatures
+{
+    UBER_PARALLAX = 1,
+    UBER_NORMAL_MAP = 2,
+    UBER_SHADOWS = 4,
+    UBER_LIGHTS = 8
+};
+
+// objshader's uniforms, looked up once in each program that draws with it (the uber shader and its permutations):
+
+// (the camera, the lights and the shadow transforms are in the per-frame uniform blocks instead)
+
+struct ObjUniforms
+{
+    UniformHandle<glm::mat4>    model;
+    UniformHandle<glm::mat3>    modelMatrix;
+    UniformHandle<float>        ao, expose, texScale;
+};
+
+std::map<GLSLProgram*, ObjUniforms> ObjUniformHandles;
+
 GLfloat CubeVertices[][3] =
 {
     { -1., -1., -1. },
@@ -306,6 +407,7 @@ GLfloat CubeNormals[][3] =
 // function prototypes:
 
 void	Animate();
+void	Close();
 void	Display();
 void	DoAxesMenu(int);
 void	DoColorMenu(int);
@@ -320,13 +422,19 @@ void	DoRasterString(float, float, float, char*);
 void	DoStrokeString(float, float, float, float, char*);
 float	ElapsedSeconds();
 void	InitGraphics();
+void	InitIBL();
 void	InitLists();
 void	InitMenus();
+void	MakeBrdfTable();
+void	MakeEnvironmentMaps();
 void	Keyboard(unsigned char, int, int);
+ObjUniforms& ObjShaderUniforms(GLSLProgram*);
 void	MouseButton(int, int, int, int);
 void	MouseMotion(int, int);
 void	Reset();
 void	Resize(int, int);
+int	UberKey(int, bool, int);
+GLSLProgram* UberVariant(int);
 void	Visibility(int);
 
 void            OsuSphere(float, int, int);
@@ -423,6 +531,18 @@ Animate()
 }
 
 
+// the program is going away (the Quit menu item, or the window's close box, after which freeglut exit( )s):
+// exit( ) joins the thread pool's workers, and any of them streaming textures in may be waiting for
+// upload slots that nothing will pump any more, so tell them to give up first
+
+void
+Close()
+{
+    if (uploader != NULL)
+        uploader->Shutdown();
+}
+
+
 // draw the complete scene:
 
 void
@@ -437,6 +557,15 @@ Display()
 
     glutSetWindow(MainWindow);
 
+    // copy in whatever textures have been streamed since the last frame:
+
+    if (uploader != NULL)
+        uploader->Pump();
+
+    // this frame's uniform blocks go in the ring's next region:
+
+    uniformRing->BeginFrame();
+
     glClearColor(0.f, 0.f, 0.f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
@@ -466,6 +595,17 @@ Display()
     glm::mat4 L3_td = glm::translate(model, light_translate[3]);
     L3_td = glm::scale(L3_td, glm::vec3(0.5f));
 
+    // the lights, for every program that reads them:
+
+    const int numLights = sizeof(light_translate) / sizeof(light_translate[0]);
+    struct LightUniforms lights = { };
+    for (int i = 0; i < numLights; i++)
+    {
+        lights.positions[i] = glm::vec4(light_translate[i], 1.f);
+        lights.colors[i] = glm::vec4(light_color[i], 1.f);
+    }
+    uniformRing->Bind(LIGHT_UNIFORMS_BINDING, &lights, sizeof(lights));
+
     glBindFramebuffer(GL_FRAMEBUFFER, depthMap);
 
     glCullFace(GL_FRONT);
@@ -484,24 +624,31 @@ Display()
     glm::mat3 objmodel = glm::transpose(glm::inverse(glm::mat3(objfile)));
 
     glm::mat4 lightProjection = glm::ortho(-500.0f, 500.0f, -500.0f, 500.0f, 0.f, 500.f);
-    glm::mat4 lightSpaceMatrix[4] = { };
+    struct ShadowUniforms shadowBlock = { };
 
-    for (int i = 0; i < 4; i++) {
+    for (int i = 0; i < numLights; i++) {
 
         glm::mat4 lightView = glm::lookAt(light_translate[i], glm::vec3(0., 0., 0.), glm::vec3(0., 1., 0.));
 
-        lightSpaceMatrix[i] = lightProjection * lightView;
+        shadowBlock.lightSpace[i] = lightProjection * lightView;
+    }
+
+    uniformRing->Bind(SHADOW_UNIFORMS_BINDING, &shadowBlock, sizeof(shadowBlock));
 
-        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, shadowColorMap, 0, i);
+    // all four layers at once: the geometry shader sends each triangle to every light's layer
 
-        GetDepth->SetUniformVariable((char*)"uLightSpaceMatrix", lightSpaceMatrix[i]);
-        GetDepth->SetUniformVariable((char*)"uModel", objfile);
+    GetDepth->SetUniformVariable((char*)"uModel", objfile);
 
-        glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+    glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
 
+    if (telescopeBatch != NULL)
+    {
+        telescopeBatch->Draw();
+    }
+    else
+    {
         for (auto obj : telescopeObj)
             obj->Draw();
-
     }
 
     ////objfile = glm::rotate(objfile, glm::radians(90.f), glm::vec3(0.f, 1.f, 0.f));
@@ -546,12 +693,6 @@ Display()
     else
         projection = glm::perspective(glm::radians(90.), 1., 0.1, 1000.);
 
-    Uber->Use();
-    Uber->SetUniformVariable((char*)"uProj", projection);
-    Uber->SetUniformVariable((char*)"uLightSpaceMatrix", *lightSpaceMatrix);
-    Uber->SetUniformVariable((char*)"ao", 0.2f);
-    Uber->SetUniformVariable((char*)"uExpose", 2.2f);
-
     //Back->Use();
     
 
@@ -583,6 +724,14 @@ Display()
 
     glm::vec3 current_cam = glm::row(modelview, 0);
 
+    // the camera, for every program that reads it:
+
+    struct FrameUniforms frame;
+    frame.proj = projection;
+    frame.view = modelview;
+    frame.camPos = glm::vec4(current_cam, 1.f);
+    uniformRing->Bind(FRAME_UNIFORMS_BINDING, &frame, sizeof(frame));
+
     // set the fog parameters:
 
     if (DepthCueOn != 0)
@@ -611,11 +760,12 @@ Display()
         glCallList(AxesList);
     }*/
 
-    Uber->SetUniformVariable((char*)"uView", modelview);
-    Uber->SetUniformVariable((char*)"uCamPos", current_cam);
-
+#ifdef SH_IRRADIANCE
+    glBindBufferBase(GL_UNIFORM_BUFFER, SH_IRRADIANCE_BINDING, irradianceBuffer);
+#else
     glActiveTexture(GL_TEXTURE1);
     glBindTexture(GL_TEXTURE_CUBE_MAP, iemMap);
+#endif
     glActiveTexture(GL_TEXTURE2);
     glBindTexture(GL_TEXTURE_CUBE_MAP, prefilter);
     glActiveTexture(GL_TEXTURE3);
@@ -632,80 +782,94 @@ Display()
     //objfile = glm::translate(objfile, glm::vec3(0.f, 0.f, -9.f));
     //objfile = glm::scale(objfile, glm::vec3(0.1f, 0.1f, 0.1f));
 
-    for (auto obj : telescopeObj)
+    // the rest of what objshader needs, set on the uber shader or on each permutation as it is used
+    // (only what has changed since the program last drew is actually set):
+
+    auto useObjShader = [&](GLSLProgram* program)
     {
-        std::string cur_mat = obj->GetMaterial();
-        GLuint dif = NULL, refl = NULL, rough = NULL, normal = NULL, bump = NULL;
+        ObjUniforms& u = ObjShaderUniforms(program);
+        program->Use();
+        program->Set(u.ao, 0.2f);
+        program->Set(u.expose, 2.2f);
+        program->Set(u.texScale, 1.f);
+        program->Set(u.modelMatrix, objmodel);
+        program->Set(u.model, objfile);
+    };
 
-        for (objtex_maps &textures : objtextures)
-        {
-            if (textures.name == cur_mat)
-            {
-                dif = textures.diffuse;
-                rough = textures.rough;
-                refl = textures.reflect;
-                normal = textures.norm;
-                bump = textures.bump;
+    materialTable->Bind();
 
-                break;
-            }
+#ifdef SHADER_PERMUTATIONS
+    // each material (a run of the batch's commands, or the objects made of it) with its permutation,
+    // sorted so each permutation is used once:
+
+#ifdef ENABLE_SHADOWS
+    bool shadowsOn = ShadowsOn != 0;
+#else
+    bool shadowsOn = true;		// the shadow maps are always made
+#endif
+
+    int numDraws = (telescopeBatch != NULL) ? telescopeBatch->NumMaterials() : (int)telescopeObj.size();
+    std::vector<std::pair<int, int>> draws(numDraws);
+    for (int i = 0; i < numDraws; i++)
+    {
+        int layer = (telescopeBatch != NULL) ? materialTable->Find(telescopeBatch->GetMaterialName(i))
+                                             : materialTable->Find(telescopeObj[i]->GetMaterial());
+        draws[i] = std::make_pair(UberKey(layer, shadowsOn, numLights), i);
+    }
+    std::sort(draws.begin(), draws.end());
 
-            continue;
+    for (int i = 0; i < numDraws; i++)
+    {
+        if (i == 0 || draws[i].first != draws[i - 1].first)
+            useObjShader(UberVariant(draws[i].first));
+
+        if (telescopeBatch != NULL)
+        {
+            telescopeBatch->DrawMaterial(draws[i].second);
+        }
+        else
+        {
+            VertexBufferObject* obj = telescopeObj[draws[i].second];
+            materialTable->Select(materialTable->Find(obj->GetMaterial()));
+            obj->Draw();
         }
+    }
+#else
+    useObjShader(Uber);
 
-        Uber->SetUniformVariable((char*)"uTexScale", 1.f);
-
-        glActiveTexture(GL_TEXTURE5);
-        glBindTexture(GL_TEXTURE_2D, dif);
-        glActiveTexture(GL_TEXTURE6);
-        glBindTexture(GL_TEXTURE_2D, rough);
-        glActiveTexture(GL_TEXTURE7);
-        glBindTexture(GL_TEXTURE_2D, refl);
-        glActiveTexture(GL_TEXTURE8);
-        glBindTexture(GL_TEXTURE_2D, normal);
-        glActiveTexture(GL_TEXTURE9);
-        glBindTexture(GL_TEXTURE_2D, bump);
-
-        Uber->SetUniformVariable((char*)"uModelMatrix", objmodel);
-        Uber->SetUniformVariable((char*)"uModel", objfile);
-        obj->Draw();
-
-        glActiveTexture(GL_TEXTURE5);
-        glBindTexture(GL_TEXTURE_2D, 0);
-        glActiveTexture(GL_TEXTURE6);
-        glBindTexture(GL_TEXTURE_2D, 0);
-        glActiveTexture(GL_TEXTURE7);
-        glBindTexture(GL_TEXTURE_2D, 0);
-        glActiveTexture(GL_TEXTURE8);
-        glBindTexture(GL_TEXTURE_2D, 0);
-        glActiveTexture(GL_TEXTURE9);
-        glBindTexture(GL_TEXTURE_2D, 0);
+    if (telescopeBatch != NULL)
+    {
+        telescopeBatch->Draw();
+    }
+    else
+    {
+        for (auto obj : telescopeObj)
+        {
+            materialTable->Select(materialTable->Find(obj->GetMaterial()));
+            obj->Draw();
+        }
     }
+#endif
+
+    materialTable->Unbind();
         
 
-    Uber->SetUniformVariable((char*)"lightPositions[0]", light_translate[0]);
-    Uber->SetUniformVariable((char*)"lightColors[0]", light_color[0]);
+    Uber->Use();
     Uber->SetUniformVariable((char*)"uModelMatrix", (glm::mat3 &)glm::transpose(glm::inverse(glm::mat3(L0_td))));
     Uber->SetUniformVariable((char*)"uModel", L0_td);
     //glCallList(SphereList);
     //renderSphere();
 
-    Uber->SetUniformVariable((char*)"lightPositions[1]", light_translate[1]);
-    Uber->SetUniformVariable((char*)"lightColors[1]", light_color[1]);
     Uber->SetUniformVariable((char*)"uModelMatrix", (glm::mat3&)glm::transpose(glm::inverse(glm::mat3(L1_td))));
     Uber->SetUniformVariable((char*)"uModel", L1_td);
     //glCallList(SphereList);
     //renderSphere();
 
-    Uber->SetUniformVariable((char*)"lightPositions[2]", light_translate[2]);
-    Uber->SetUniformVariable((char*)"lightColors[2]", light_color[2]);
     Uber->SetUniformVariable((char*)"uModelMatrix", (glm::mat3&)glm::transpose(glm::inverse(glm::mat3(L2_td))));
     Uber->SetUniformVariable((char*)"uModel", L2_td);
     //glCallList(SphereList);
     //renderSphere();
 
-    Uber->SetUniformVariable((char*)"lightPositions[3]", light_translate[3]);
-    Uber->SetUniformVariable((char*)"lightColors[3]", light_color[3]);
     Uber->SetUniformVariable((char*)"uModelMatrix", (glm::mat3&)glm::transpose(glm::inverse(glm::mat3(L3_td))));
     Uber->SetUniformVariable((char*)"uModel", L3_td);
     //glCallList(SphereList);
@@ -723,8 +887,6 @@ Display()
     Uber->Use(0);
     
     Back->Use();
-    Back->SetUniformVariable((char*)"uProj", projection);
-    Back->SetUniformVariable((char*)"uView", modelview);
     Back->SetUniformVariable((char*)"uExpose", 1.8f);
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_CUBE_MAP, envCube);
@@ -733,6 +895,10 @@ Display()
 
     Back->Use(0);
 
+    // nothing else this frame reads its uniform blocks:
+
+    uniformRing->EndFrame();
+
     //Brdf->Use();
     //brdfQuad->Draw();
     //renderQuad();
@@ -788,6 +954,92 @@ Display()
     // note: be sure to use glFlush( ) here, not glFinish( ) !
 
     glFlush();
+
+    if (DebugOn != 0)
+    {
+        unsigned long long uploads, skipped;
+        GLSLProgram::GetUniformCounts(&uploads, &skipped);
+        fprintf(stderr, "Uniforms so far: %llu set, %llu skipped as unchanged\n", uploads, skipped);
+    }
+}
+
+
+// the handles of objshader's uniforms in this program, looked up the first time it draws:
+
+ObjUniforms&
+ObjShaderUniforms(GLSLProgram* program)
+{
+    std::map<GLSLProgram*, ObjUniforms>::iterator found = ObjUniformHandles.find(program);
+    if (found != ObjUniformHandles.end())
+        return found->second;
+
+    ObjUniforms& u = ObjUniformHandles[program];
+    u.model = program->GetUniform<glm::mat4>("uModel");
+    u.modelMatrix = program->GetUniform<glm::mat3>("uModelMatrix");
+    u.ao = program->GetUniform<float>("ao");
+    u.expose = program->GetUniform<float>("uExpose");
+    u.texScale = program->GetUniform<float>("uTexScale");
+    return u;
+}
+
+
+// which permutation of objshader.frag draws a material (MaterialTable layer) best:
+// a height map the material doesn't have is black, which is no parallax, and a normal map it
+// doesn't have is flat, which is the surface's own normal,
+// so a permutation without that map draws it the same, only without the lookups
+
+int
+UberKey(int layer, bool shadows, int lights)
+{
+    int key = lights * UBER_LIGHTS;
+    if (materialTable->HasMap(layer, MAP_HEIGHT))
+        key |= UBER_PARALLAX;
+    if (materialTable->HasMap(layer, MAP_NORMAL))
+        key |= UBER_NORMAL_MAP;
+    if (shadows)
+        key |= UBER_SHADOWS;
+    return key;
+}
+
+
+// the permutation of objshader.frag for this key, compiled the first time it is asked for
+// (or loaded from its cached binary -- each has its own, see GLSLProgram::Create( ) )
+// if it can't be made, the uber shader stands in for it:
+
+GLSLProgram *
+UberVariant(int key)
+{
+    std::map<int, GLSLProgram*>::iterator found = UberVariants.find(key);
+    if (found != UberVariants.end())
+        return found->second;
+
+    std::string defines = OBJ_SHADER_DEFINES;
+    if (key & UBER_PARALLAX)
+        defines += "#define PARALLAX\n";
+    if (key & UBER_NORMAL_MAP)
+        defines += "#define NORMAL_MAP\n";
+    if (key & UBER_SHADOWS)
+        defines += "#define SHADOWS\n";
+    defines += "#define NUM_LIGHTS " + std::to_string(key / UBER_LIGHTS) + "\n";
+
+    GLSLProgram* variant = new GLSLProgram();
+    variant->SetDefines(defines.c_str());
+    variant->SetVerbose(false);
+    if (!variant->Create((char*)"shaders\\objshader.vert", (char*)"shaders\\objshader.frag"))
+    {
+        fprintf(stderr, "Uber Shader permutation %d cannot be created -- using the uber shader\n", key);
+        delete variant;
+        variant = Uber;
+    }
+#ifdef _DEBUG
+    else
+    {
+        fprintf(stderr, "Uber Shader permutation %d created:\n%s", key, defines.c_str());
+    }
+#endif
+
+    UberVariants[key] = variant;
+    return variant;
 }
 
 
@@ -865,6 +1117,7 @@ DoMainMenu(int id)
         // gracefully close out the graphics:
         // gracefully close the graphics window:
         // gracefully exit the program:
+        Close();
         glutSetWindow(MainWindow);
         glFinish();
         glutDestroyWindow(MainWindow);
@@ -1085,6 +1338,7 @@ InitGraphics()
     // MenuStateFunc -- declare when a pop-up menu is in use
     // TimerFunc -- trigger something to happen a certain time from now
     // IdleFunc -- what to do when nothing else is going on
+    // CloseFunc -- what to do when the window is closed
 
     glutSetWindow(MainWindow);
     glutDisplayFunc(Display);
@@ -1107,6 +1361,7 @@ InitGraphics()
     glutMenuStateFunc(NULL);
     glutTimerFunc(-1, NULL, 0);
     glutIdleFunc(Animate);
+    glutCloseFunc(Close);
 
     // init glew (a window must be open to do this):
 
@@ -1136,6 +1391,31 @@ InitGraphics()
     glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
     glEnable(GL_NORMALIZE);
 
+    // start every shader program compiling and linking now, and only ask how they went after the meshes and
+    // materials are loaded, so the driver's compiler threads (GL_KHR_parallel_shader_compile) overlap the loading:
+
+    Back = new GLSLProgram();
+    Back->Submit((char*)"shaders\\back.vert", (char*)"shaders\\back.frag");
+    Environment = new GLSLProgram();
+    Environment->Submit((char*)"shaders\\env.vert", (char*)"shaders\\env.frag");
+#ifndef SH_IRRADIANCE
+    Iem = new GLSLProgram();
+    Iem->Submit((char*)"shaders\\env.vert", (char*)"shaders\\iem.frag");
+#endif
+    Prefilter = new GLSLProgram();
+#ifdef COMPUTE_PREFILTER
+    Prefilter->Submit((char*)"shaders\\prefilter.cs");
+#else
+    Prefilter->Submit((char*)"shaders\\env.vert", (char*)"shaders\\prefilter.frag");
+#endif
+    Brdf = new GLSLProgram();
+    Brdf->Submit((char*)"shaders\\brdfLUT.vert", (char*)"shaders\\brdfLUT.frag");
+    Uber = new GLSLProgram();
+    Uber->SetDefines(OBJ_SHADER_DEFINES);
+    Uber->Submit((char*)"shaders\\objshader.vert", (char*)"shaders\\objshader.frag");
+    GetDepth = new GLSLProgram();
+    GetDepth->Submit((char*)"shaders\\GetDepth.vert", (char*)"shaders\\GetDepth.geom", (char*)"shaders\\GetDepth.frag");
+
     envCubeObj = new VertexBufferObject();
     envCubeObj->CollapseCommonVertices(false);
     envCubeObj->glBegin(GL_QUADS);
@@ -1160,8 +1440,16 @@ InitGraphics()
     //telescopeObj = new VertexBufferObject();
     //telescopeObj->CollapseCommonVertices(false);
     //telescopeObj->glBegin(GL_TRIANGLES);
+#ifdef BENCH_OBJ_LOADER
+    BenchObjFile((char*)"assets\\skyscanner_100.obj", 3);
+#endif
+
     materiallib = new MaterialSet();
-    LoadObjFile((char*)"assets\\skyscanner_100.obj", &telescopeObj, materiallib);
+#ifdef COMPRESS_TEXTURES
+    materiallib->CompressTextures(true);
+#endif
+    telescopeArena = new GeometryArena((MESH_OPTIONS & OBJ_PACK_NORMALS) ? VBO_PACK_NORMALS : VBO_PACK_NONE, true);
+    LoadObjFileCached((char*)"assets\\skyscanner_100.obj", &telescopeObj, materiallib, OBJ_LOAD_PARALLEL, MESH_OPTIONS, telescopeArena);
     //telescopeObj->glEnd();
 
     /*glShadeModel(GL_FLAT);
@@ -1192,9 +1480,19 @@ InitGraphics()
     //brdfQuad->SetVerbose(true);
 #endif // !_DEBUG
 
-    Back = new GLSLProgram();
+#ifdef _DEBUG
+    GLSLProgram* programs[] = { Back, Environment,
+#ifndef SH_IRRADIANCE
+        Iem,
+#endif
+        Prefilter, Brdf, Uber, GetDepth };
+    int ready = 0;
+    for (GLSLProgram* program : programs)
+        ready += program->IsReady() ? 1 : 0;
+    fprintf(stderr, "%d of the %d shader programs were ready by the time the assets were loaded\n", ready, (int)(sizeof(programs) / sizeof(programs[0])));
+#endif // _DEBUG
 
-    bool valid = Back->Create((char*)"shaders\\back.vert", (char*)"shaders\\back.frag");
+    bool valid = Back->Finish();
 #ifdef _DEBUG
     if (!valid)
     {
@@ -1208,9 +1506,7 @@ InitGraphics()
 #endif // _DEBUG
     Back->SetVerbose(false);
 
-    Environment = new GLSLProgram();
-
-    valid = Environment->Create((char*)"shaders\\env.vert", (char*)"shaders\\env.frag");
+    valid = Environment->Finish();
 #ifdef _DEBUG
     if (!valid)
     {
@@ -1224,9 +1520,8 @@ InitGraphics()
 #endif // _DEBUG
     Environment->SetVerbose(false);
 
-    Iem = new GLSLProgram();
-
-    valid = Iem->Create((char*)"shaders\\env.vert", (char*)"shaders\\iem.frag");
+#ifndef SH_IRRADIANCE
+    valid = Iem->Finish();
 #ifdef _DEBUG
     if (!valid)
     {
@@ -1239,10 +1534,9 @@ InitGraphics()
     }
 #endif // _DEBUG
     Iem->SetVerbose(false);
+#endif // !SH_IRRADIANCE
 
-    Prefilter = new GLSLProgram();
-
-    valid = Prefilter->Create((char*)"shaders\\env.vert", (char*)"shaders\\prefilter.frag");
+    valid = Prefilter->Finish();
 #ifdef _DEBUG
     if (!valid)
     {
@@ -1256,9 +1550,7 @@ InitGraphics()
 #endif // _DEBUG
     Prefilter->SetVerbose(false);
 
-    Brdf = new GLSLProgram();
-
-    valid = Brdf->Create((char*)"shaders\\brdfLUT.vert", (char*)"shaders\\brdfLUT.frag");
+    valid = Brdf->Finish();
 #ifdef _DEBUG
     if (!valid)
     {
@@ -1272,9 +1564,7 @@ InitGraphics()
 #endif // _DEBUG
     Brdf->SetVerbose(false);
 
-    Uber = new GLSLProgram();
-
-    valid = Uber->Create((char*)"shaders\\objshader.vert", (char*)"shaders\\objshader.frag");
+    valid = Uber->Finish();
 #ifdef _DEBUG
     if (!valid)
     {
@@ -1288,8 +1578,7 @@ InitGraphics()
 #endif // _DEBUG
     Uber->SetVerbose(false);
 
-    GetDepth = new GLSLProgram();
-    valid = GetDepth->Create((char*)"shaders\\GetDepth.vert", (char*)"shaders\\GetDepth.frag");
+    valid = GetDepth->Finish();
 #ifdef _DEBUG
     if (!valid)
     {
@@ -1302,16 +1591,18 @@ InitGraphics()
 #endif // _DEBUG
     GetDepth->SetVerbose(false);
 
+    // the depth buffer is layered too, one layer per light, so all four can be drawn in one pass:
+
     glGenFramebuffers(1, &depthMap);
     glGenTextures(1, &shadowMap);
-    glBindTexture(GL_TEXTURE_2D, shadowMap);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, shadowMap);
 
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, shadows[0], shadows[1], 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT, shadows[0], shadows[1], 4, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
 
     glGenTextures(1, &shadowColorMap);
     glBindTexture(GL_TEXTURE_2D_ARRAY, shadowColorMap);
@@ -1327,9 +1618,12 @@ InitGraphics()
     glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
     glBindFramebuffer(GL_FRAMEBUFFER, depthMap);
     
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, shadowMap, 0);
-    for (int i = 0; i < 4; i++)
-        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, shadowColorMap, 0, i);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, shadowMap, 0);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, shadowColorMap, 0);
+#ifdef _DEBUG
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        fprintf(stderr, "Layered shadow framebuffer is not complete!\n");
+#endif // _DEBUG
 
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
@@ -1339,32 +1633,157 @@ InitGraphics()
     /*glBindFramebuffer(GL_FRAMEBUFFER, framebuf);
     glBindRenderbuffer(GL_RENDERBUFFER, renderbuf);*/
 
-    glNamedRenderbufferStorage(renderbuf, GL_DEPTH_COMPONENT24, 2048, 2048);
+    glNamedRenderbufferStorage(renderbuf, GL_DEPTH_COMPONENT24, IBL_ENV_SIZE, IBL_ENV_SIZE);
     glNamedFramebufferRenderbuffer(framebuf, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, renderbuf);
     
+    // the image-based lighting, from its cache if it's there:
+
+    InitIBL();
+
+    // the uniform blocks that change every frame (see frameuniforms.h) are written through a ring of buffer regions:
+
+    uniformRing = new UniformRing();
+    uniformRing->Init();
+
+    // every material's maps go in one set of array textures, and the telescope's draws index it:
+
+    uploader = NULL;
+#ifdef STREAM_TEXTURES
+    uploader = new TextureUploader();
+    if (!uploader->Init())
+    {
+        delete uploader;
+        uploader = NULL;
+    }
+#endif
+
+    materialTable = new MaterialTable();
+    materialTable->Build(materiallib, uploader);
+
+    telescopeBatch = NULL;
+#ifdef MULTI_DRAW_INDIRECT
+    telescopeBatch = new IndirectBatch();
+    if (telescopeBatch->Build(telescopeArena, &telescopeObj, materialTable) != 0)
+    {
+        delete telescopeBatch;
+        telescopeBatch = NULL;
+    }
+#endif
+}
+
+
+// the image-based lighting: the environment cube, its irradiance and prefiltered cubes, and the BRDF table
+// they are kept in .ktx files keyed on everything that goes into them (see iblcache.h),
+// so they are only made when something has changed:
+
+void
+InitIBL()
+{
+    std::string envKey, brdfKey;
+#ifdef COMPUTE_PREFILTER
+    IblKeys(ENV_HDR, "shaders\\prefilter.cs", PREFILTER_SAMPLES, &envKey, &brdfKey);
+#else
+    const int fragmentSamples[IBL_PREFILTER_LEVELS] = { IBL_FRAGMENT_SAMPLES, IBL_FRAGMENT_SAMPLES, IBL_FRAGMENT_SAMPLES, IBL_FRAGMENT_SAMPLES, IBL_FRAGMENT_SAMPLES };
+    IblKeys(ENV_HDR, "shaders\\prefilter.frag", fragmentSamples, &envKey, &brdfKey);
+#endif
+
+    envCube = ReadIblCache(ENV_HDR IBL_ENV_SUFFIX, GL_TEXTURE_CUBE_MAP, envKey);
+#ifdef SH_IRRADIANCE
+    iemMap = 0;
+    bool irradianceCached = ReadIrradianceSH(ENV_HDR SH_IRRADIANCE_SUFFIX, envKey, &irradianceSH) == 0;
+#else
+    iemMap = ReadIblCache(ENV_HDR IBL_IEM_SUFFIX, GL_TEXTURE_CUBE_MAP, envKey);
+    bool irradianceCached = iemMap != 0;
+#endif
+    prefilter = ReadIblCache(ENV_HDR IBL_PREFILTER_SUFFIX, GL_TEXTURE_CUBE_MAP, envKey);
+    if (envCube == 0 || !irradianceCached || prefilter == 0)
+    {
+        glDeleteTextures(1, &envCube);
+        glDeleteTextures(1, &iemMap);
+        glDeleteTextures(1, &prefilter);
+
+        MakeEnvironmentMaps();
+
+        WriteIblCache(ENV_HDR IBL_ENV_SUFFIX, envCube, GL_TEXTURE_CUBE_MAP, NumMipLevels(IBL_ENV_SIZE, IBL_ENV_SIZE), GL_RGB16F, envKey);
+#ifdef SH_IRRADIANCE
+        WriteIrradianceSH(ENV_HDR SH_IRRADIANCE_SUFFIX, envKey, &irradianceSH);
+#else
+        WriteIblCache(ENV_HDR IBL_IEM_SUFFIX, iemMap, GL_TEXTURE_CUBE_MAP, 1, GL_RGB16F, envKey);
+#endif
+        WriteIblCache(ENV_HDR IBL_PREFILTER_SUFFIX, prefilter, GL_TEXTURE_CUBE_MAP, IBL_PREFILTER_LEVELS, GL_RGB16F, envKey);
+    }
+
+#ifdef SH_IRRADIANCE
+    glCreateBuffers(1, &irradianceBuffer);
+    glNamedBufferStorage(irradianceBuffer, sizeof(irradianceSH), &irradianceSH, 0);
+#endif
+
+    brdf = ReadIblCache(IBL_BRDF_CACHE, GL_TEXTURE_2D, brdfKey);
+    if (brdf == 0)
+    {
+        MakeBrdfTable();
+        WriteIblCache(IBL_BRDF_CACHE, brdf, GL_TEXTURE_2D, 1, GL_RG16F, brdfKey);
+    }
+}
+
+
+// decode the HDR image and render and convolve it into envCube, iemMap (or irradianceSH), and prefilter:
+
+void
+MakeEnvironmentMaps()
+{
     // Init the Env HDR
-    // Set STBI to flip images for texture loading
-    stbi_set_flip_vertically_on_load(1);
-    float* envImage = stbi_loadf((char*)"assets\\LA_Downtown_Helipad_GoldenHour_3k.hdr", &envW, &envH, &nrComp, 0);
-    if (envImage)
+    // it is decoded (in parallel) straight into the format its texture has, flipped for GL
+    // its mips are made on the CPU and kept next to it (<image>.mip), so a warm start skips the decode
+    // (the poles of the equirectangular image are squeezed a lot when the cube faces are drawn from it)
+#ifdef ENV_SHARED_EXPONENT
+    const int envFormat = HDR_RGB9E5;
+    const GLenum envType = GL_UNSIGNED_INT_5_9_9_9_REV;
+    const GLenum envInternalFormat = GL_RGB9_E5;
+#else
+    const int envFormat = HDR_HALF;
+    const GLenum envType = GL_HALF_FLOAT;
+    const GLenum envInternalFormat = GL_RGB16F;
+#endif
+    MipChain* envChain = new MipChain;
+    if (ReadMipChain(ENV_HDR, envType, false, MIP_BOX, envChain) != 0)
     {
-        glGenTextures(1, &envMapTexture);
-        glBindTexture(GL_TEXTURE_2D, envMapTexture);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, envW, envH, 0, GL_RGB, GL_FLOAT, envImage);
+        delete envChain;
+        envChain = NULL;
 
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        std::vector<unsigned char> envImage;
+        if (ReadHdr(ENV_HDR, envFormat, &envW, &envH, envImage) == 0)
+        {
+            envChain = BuildMipChain(&envImage[0], envW, envH, 3, envType, false, MIP_BOX);
+            WriteMipChain(ENV_HDR, envChain);
+        }
+    }
 
-        stbi_image_free(envImage);
+    if (envChain)
+    {
+        envW = envChain->levels[0].width;
+        envH = envChain->levels[0].height;
+        envMapTexture = CreateMipTexture(envChain, envInternalFormat);
+        glTextureParameteri(envMapTexture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTextureParameteri(envMapTexture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+#ifdef SH_IRRADIANCE
+        // the diffuse lighting only has the broad shape of the environment, so a small level does:
+        int l = 0;
+        while (l + 1 < (int)envChain->levels.size() && envChain->levels[l].width > 512)
+            l++;
+        std::vector<float> shLevel;
+        MipLevelFloats(envChain, l, shLevel);
+        ProjectIrradianceSH(&shLevel[0], envChain->levels[l].width, envChain->levels[l].height, &irradianceSH);
+#endif
+        delete envChain;
     }
 
     glGenTextures(1, &envCube);
     glBindTexture(GL_TEXTURE_CUBE_MAP, envCube);
     for (unsigned int i = 0; i < 6; ++i)
     {
-        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F, 2048, 2048, 0, GL_RGB, GL_FLOAT, nullptr);
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F, IBL_ENV_SIZE, IBL_ENV_SIZE, 0, GL_RGB, GL_FLOAT, nullptr);
     }
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
@@ -1389,7 +1808,7 @@ InitGraphics()
 
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, envMapTexture);
-    glViewport(0, 0, 2048, 2048);
+    glViewport(0, 0, IBL_ENV_SIZE, IBL_ENV_SIZE);
     glBindFramebuffer(GL_FRAMEBUFFER, framebuf);
     for (int i = 0; i < 6; ++i)
     {
@@ -1407,22 +1826,24 @@ InitGraphics()
     glBindTexture(GL_TEXTURE_CUBE_MAP, envCube);
     glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
 
+#ifndef SH_IRRADIANCE
     glGenTextures(1, &iemMap);
     glBindTexture(GL_TEXTURE_CUBE_MAP, iemMap);
     for (unsigned int i = 0; i < 6; ++i)
     {
-        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F, 256, 256, 0, GL_RGB, GL_FLOAT, nullptr);
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F, IBL_IEM_SIZE, IBL_IEM_SIZE, 0, GL_RGB, GL_FLOAT, nullptr);
     }
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    // it has no mips, so a mipmapping filter would leave it incomplete (and reading black):
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
 
     glBindFramebuffer(GL_FRAMEBUFFER, framebuf);
     //glBindRenderbuffer(GL_RENDERBUFFER, renderbuf);
-    glNamedRenderbufferStorage(renderbuf, GL_DEPTH_COMPONENT24, 256, 256);
+    glNamedRenderbufferStorage(renderbuf, GL_DEPTH_COMPONENT24, IBL_IEM_SIZE, IBL_IEM_SIZE);
 
     // pbr: solve diffuse integral by convolution to create an irradiance (cube)map.
     // -----------------------------------------------------------------------------
@@ -1432,7 +1853,7 @@ InitGraphics()
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_CUBE_MAP, envCube);
 
-    glViewport(0, 0, 256, 256); // don't forget to configure the viewport to the capture dimensions.
+    glViewport(0, 0, IBL_IEM_SIZE, IBL_IEM_SIZE); // don't forget to configure the viewport to the capture dimensions.
     glBindFramebuffer(GL_FRAMEBUFFER, framebuf);
     for (unsigned int i = 0; i < 6; ++i)
     {
@@ -1446,12 +1867,54 @@ InitGraphics()
     Iem->UnUse();
 
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
+#endif // !SH_IRRADIANCE
+
+#ifdef COMPUTE_PREFILTER
+    // pbr: prefilter the environment for each roughness, a mip and all six faces per dispatch,
+    // writing the faces as image layers (an image has to be RGBA, WriteIblCache( ) keeps only the RGB)
+    // ----------------------------------------------------------------------------------------------------
+    const int maxMipLevels = IBL_PREFILTER_LEVELS;
+    glCreateTextures(GL_TEXTURE_CUBE_MAP, 1, &prefilter);
+    glTextureStorage2D(prefilter, maxMipLevels, GL_RGBA16F, IBL_PREFILTER_SIZE, IBL_PREFILTER_SIZE);
+    glTextureParameteri(prefilter, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTextureParameteri(prefilter, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTextureParameteri(prefilter, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glTextureParameteri(prefilter, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTextureParameteri(prefilter, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    std::vector<float> samples;
+    int firstSample[maxMipLevels + 1];
+    MakePrefilterSamples(PREFILTER_SAMPLES, samples, firstSample);
+
+    GLuint sampleBuffer;
+    glCreateBuffers(1, &sampleBuffer);
+    glNamedBufferStorage(sampleBuffer, samples.size() * sizeof(float), &samples[0], 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, sampleBuffer);
+
+    glBindTextureUnit(0, envCube);
+
+    Prefilter->Use();
+    for (int mip = 0; mip < maxMipLevels; ++mip)
+    {
+        int mipSize = IBL_PREFILTER_SIZE >> mip;
+        Prefilter->SetUniformVariable((char*)"uFirstSample", firstSample[mip]);
+        Prefilter->SetUniformVariable((char*)"uSampleCount", firstSample[mip + 1] - firstSample[mip]);
+        glBindImageTexture(0, prefilter, mip, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+        Prefilter->DispatchCompute((mipSize + 7) / 8, (mipSize + 7) / 8, 6);
+    }
+    Prefilter->UnUse();
 
+    // (the readback into the cache, as well as the drawing, has to see the image stores)
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+    glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
+    glDeleteBuffers(1, &sampleBuffer);
+#else
     glGenTextures(1, &prefilter);
     glBindTexture(GL_TEXTURE_CUBE_MAP, prefilter);
     for (unsigned int i = 0; i < 6; ++i)
     {
-        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F, 512, 512, 0, GL_RGB, GL_FLOAT, nullptr);
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F, IBL_PREFILTER_SIZE, IBL_PREFILTER_SIZE, 0, GL_RGB, GL_FLOAT, nullptr);
     }
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
@@ -1470,12 +1933,12 @@ InitGraphics()
     glBindTexture(GL_TEXTURE_CUBE_MAP, envCube);
 
     glBindFramebuffer(GL_FRAMEBUFFER, framebuf);
-    unsigned int maxMipLevels = 5;
+    unsigned int maxMipLevels = IBL_PREFILTER_LEVELS;
     for (unsigned int mip = 0; mip < maxMipLevels; ++mip)
     {
         // reisze framebuffer according to mip-level size.
-        unsigned int mipWidth = static_cast<unsigned int>(512 * std::pow(0.5, mip));
-        unsigned int mipHeight = static_cast<unsigned int>(512 * std::pow(0.5, mip));
+        unsigned int mipWidth = static_cast<unsigned int>(IBL_PREFILTER_SIZE * std::pow(0.5, mip));
+        unsigned int mipHeight = static_cast<unsigned int>(IBL_PREFILTER_SIZE * std::pow(0.5, mip));
         glBindRenderbuffer(GL_RENDERBUFFER, renderbuf);
         glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, mipWidth, mipHeight);
         glViewport(0, 0, mipWidth, mipHeight);
@@ -1493,14 +1956,22 @@ InitGraphics()
     }
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
     Prefilter->UnUse();
+#endif // COMPUTE_PREFILTER
+}
+
+
+// integrate the BRDF into the brdf table:
 
+void
+MakeBrdfTable()
+{
     // pbr: generate a 2D LUT from the BRDF equations used.
     // ----------------------------------------------------
     glGenTextures(1, &brdf);
 
     // pre-allocate enough memory for the LUT texture.
     glBindTexture(GL_TEXTURE_2D, brdf);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, 1024, 1024, 0, GL_RG, GL_FLOAT, 0);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, IBL_BRDF_SIZE, IBL_BRDF_SIZE, 0, GL_RG, GL_FLOAT, 0);
     // be sure to set wrapping mode to GL_CLAMP_TO_EDGE
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
@@ -1510,10 +1981,10 @@ InitGraphics()
     // then re-configure capture framebuffer object and render screen-space quad with BRDF shader.
     glBindFramebuffer(GL_FRAMEBUFFER, framebuf);
     //glBindRenderbuffer(GL_RENDERBUFFER, renderbuf);
-    glNamedRenderbufferStorage(renderbuf, GL_DEPTH_COMPONENT24, 1024, 1024);
+    glNamedRenderbufferStorage(renderbuf, GL_DEPTH_COMPONENT24, IBL_BRDF_SIZE, IBL_BRDF_SIZE);
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, brdf, 0);
 
-    glViewport(0, 0, 1024, 1024);
+    glViewport(0, 0, IBL_BRDF_SIZE, IBL_BRDF_SIZE);
     Brdf->Use();
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     //brdfQuad->Draw();
@@ -1521,86 +1992,6 @@ InitGraphics()
     Brdf->Use(0);
 
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-    for (struct mat matter : materiallib->obj_mats)
-    {
-        struct objtex_maps cur_maps = { };
-        struct Texture curtex;
-
-        cur_maps.name = matter.n;
-
-        curtex = *matter.m->LoadKd();
-
-        glGenTextures(1, &cur_maps.diffuse);
-        glBindTexture(GL_TEXTURE_2D, cur_maps.diffuse);
-
-        glTextureParameteri(cur_maps.diffuse, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_LINEAR);
-        glTextureParameteri(cur_maps.diffuse, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTextureParameteri(cur_maps.diffuse, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTextureParameteri(cur_maps.diffuse, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, curtex.textW, curtex.textH, 0, GL_RGB, GL_UNSIGNED_BYTE, curtex.img);
-        glGenerateMipmap(GL_TEXTURE_2D);
-        glBindTexture(GL_TEXTURE_2D, 0);
-
-        curtex = *matter.m->LoadNs();
-
-        glGenTextures(1, &cur_maps.rough);
-        glBindTexture(GL_TEXTURE_2D, cur_maps.rough);
-
-        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-        glTextureParameteri(cur_maps.rough, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_LINEAR);
-        glTextureParameteri(cur_maps.rough, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTextureParameteri(cur_maps.rough, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTextureParameteri(cur_maps.rough, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, curtex.textW, curtex.textH, 0, GL_RED, GL_UNSIGNED_BYTE, curtex.img);
-        glGenerateMipmap(GL_TEXTURE_2D);
-        glBindTexture(GL_TEXTURE_2D, 0);
-
-        curtex = *matter.m->LoadRefl();
-
-        glGenTextures(1, &cur_maps.reflect);
-        glBindTexture(GL_TEXTURE_2D, cur_maps.reflect);
-
-        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-        glTextureParameteri(cur_maps.reflect, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_LINEAR);
-        glTextureParameteri(cur_maps.reflect, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTextureParameteri(cur_maps.reflect, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTextureParameteri(cur_maps.reflect, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, curtex.textW, curtex.textH, 0, GL_RED, GL_UNSIGNED_BYTE, curtex.img);
-        glGenerateMipmap(GL_TEXTURE_2D);
-        glBindTexture(GL_TEXTURE_2D, 0);
-
-        curtex = *matter.m->LoadNorm();
-
-        glGenTextures(1, &cur_maps.norm);
-        glBindTexture(GL_TEXTURE_2D, cur_maps.norm);
-
-        glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
-        glTextureParameteri(cur_maps.norm, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_LINEAR);
-        glTextureParameteri(cur_maps.norm, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTextureParameteri(cur_maps.norm, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTextureParameteri(cur_maps.norm, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16, curtex.textW, curtex.textH, 0, GL_RGB, GL_UNSIGNED_SHORT, curtex.img16);
-        glGenerateMipmap(GL_TEXTURE_2D);
-        glBindTexture(GL_TEXTURE_2D, 0);
-
-        curtex = *matter.m->LoadHeight();
-
-        glGenTextures(1, &cur_maps.bump);
-        glBindTexture(GL_TEXTURE_2D, cur_maps.bump);
-
-        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-        glTextureParameteri(cur_maps.bump, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_LINEAR);
-        glTextureParameteri(cur_maps.bump, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTextureParameteri(cur_maps.bump, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTextureParameteri(cur_maps.bump, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_R16, curtex.textW, curtex.textH, 0, GL_RED, GL_UNSIGNED_SHORT, curtex.img16);
-        glGenerateMipmap(GL_TEXTURE_2D);
-        glBindTexture(GL_TEXTURE_2D, 0);
-
-        objtextures.push_back(cur_maps);
-
-    }
 }
 
 
@@ -2533,4 +2924,4 @@ void renderSphere()
     glBindVertexArray(sphereVAO);
     glDrawElements(GL_TRIANGLE_STRIP, indexCount, GL_UNSIGNED_INT, 0);
     glBindVertexArray(0);
-}
\ No newline at end of file
+}
@@ -1,4 +1,6 @@
 #include "includes/loadmtlfile.h"
+#include "includes/texturecache.h"
+#include "includes/threadpool.h"
 #include <string.h>
 
 #define OBJDELIMS		" \t"
@@ -6,12 +8,10 @@
 
 char* ReadRestOfLine(FILE*);
 
+// queue an image to be decoded (see DecodeTexture()); it goes into textures when StorePendingTextures() is called
+
 void Material::ReadImageTexture(char* img, int typ, int nchan)
 {
-    // Find the beginning of the heap of textures and set the offset
-    std::vector<Texture>::iterator cursor = textures->begin();
-    cursor += typ;
-
 	char* tokptr = NULL;
 	char* front = strtok_s(img, (char*)"\\\\", &tokptr);
 	char* filename = strtok_s(NULL, WINEOL, &tokptr);
@@ -20,17 +20,69 @@ void Material::ReadImageTexture(char* img, int typ, int nchan)
 	texture_dir.append(front);
 	texture_dir.append(filename);
 
-    // Create and load the texture image
-    Texture cur_texture = {};
-	// Set STBI to flip images for texture loading
-	stbi_set_flip_vertically_on_load(1);
-	if ((typ != texture_typ::normal) && (typ != texture_typ::bump))
+	bool wide = (typ == texture_typ::normal) || (typ == texture_typ::bump);
+	TextureJob job = { texture_dir, typ, nchan, wide, typ == texture_typ::normal, { } };
+	pending.push_back(job);
+}
+
+std::vector<TextureJob>* Material::GetPendingTextures()
+{
+	return &pending;
+}
+
+// put the decoded images in textures, in the order the .mtl file named them
+
+void Material::StorePendingTextures()
+{
+	for (TextureJob& job : pending)
+	{
+		// Find the beginning of the heap of textures and set the offset
+		std::vector<Texture>::iterator cursor = textures->begin();
+		cursor += job.typ;
+
+		textures->insert(cursor, job.result);
+	}
+
+	pending.clear();
+}
+
+// decode one queued image (this runs on the thread pool, so it must only touch its own job)
+// stbi_set_flip_vertically_on_load() is set once by the caller beforehand
+// if compress is set, a valid <image>.bcn is read instead, or else one is made from the decoded image
+// (stbi's width lands in textH and its height in textW -- that's how the textures have always been read)
+
+static void DecodeTexture(TextureJob* job, bool compress)
+{
+	// Create and load the texture image
+	Texture cur_texture = {};
+
+	GLenum format = CompressedFormatFor(job->nchan, job->normalMap);
+	if (compress)
+	{
+		CompressedImage* bc = new CompressedImage;
+		if (ReadTextureCache(job->path.c_str(), format, bc) == 0)
+		{
+#ifdef _DEBUG
+			fprintf(stderr, "Image Texture %s loaded from its cache.\n", job->path.c_str());
+#endif // _DEBUG
+
+			cur_texture.textW = (int)bc->levels[0].height;
+			cur_texture.textH = (int)bc->levels[0].width;
+			cur_texture.nrComp = job->nchan;
+			cur_texture.bc = bc;
+			job->result = cur_texture;
+			return;
+		}
+		delete bc;
+	}
+
+	if (!job->wide)
 	{
-		unsigned char* tmp = stbi_load((char*)texture_dir.c_str(), &cur_texture.textH, &cur_texture.textW, &cur_texture.nrComp, nchan);
+		unsigned char* tmp = stbi_load((char*)job->path.c_str(), &cur_texture.textH, &cur_texture.textW, &cur_texture.nrComp, job->nchan);
 		if (tmp != NULL)
 		{
 #ifdef _DEBUG
-			fprintf(stderr, "Image Texture %s loaded.\n", texture_dir.c_str());
+			fprintf(stderr, "Image Texture %s loaded.\n", job->path.c_str());
 #endif // _DEBUG
 
 			cur_texture.img = tmp;
@@ -38,18 +90,37 @@ void Material::ReadImageTexture(char* img, int typ, int nchan)
 	}
 	else
 	{
-		unsigned short* tmp = stbi_load_16((char*)texture_dir.c_str(), &cur_texture.textH, &cur_texture.textW, &cur_texture.nrComp, nchan);
+		unsigned short* tmp = stbi_load_16((char*)job->path.c_str(), &cur_texture.textH, &cur_texture.textW, &cur_texture.nrComp, job->nchan);
 		if (tmp != NULL)
 		{
 #ifdef _DEBUG
-			fprintf(stderr, "Image Texture %s loaded.\n", texture_dir.c_str());
+			fprintf(stderr, "Image Texture %s loaded.\n", job->path.c_str());
 #endif // _DEBUG
 
 			cur_texture.img16 = tmp;
 		}
 	}
 
-    textures->insert(cursor, cur_texture);
+	if (compress && (cur_texture.img != NULL || cur_texture.img16 != NULL))
+	{
+		const void* pixels = job->wide ? (const void*)cur_texture.img16 : (const void*)cur_texture.img;
+		cur_texture.bc = CompressImage(pixels, cur_texture.textH, cur_texture.textW, job->nchan, job->wide, format);
+		if (cur_texture.bc != NULL)
+			WriteTextureCache(job->path.c_str(), cur_texture.bc);
+	}
+
+	job->result = cur_texture;
+}
+
+void FreeTextureImages(Texture* t)
+{
+	stbi_image_free(t->img);
+	stbi_image_free(t->img16);
+	delete t->bc;
+
+	t->img = NULL;
+	t->img16 = NULL;
+	t->bc = NULL;
 }
 
 Texture* Material::LoadNorm()
@@ -298,9 +369,36 @@ int MaterialSet::LoadMtlFile(char* file)
 
 	fclose(fp);
 
+	// decode every image the file named, all at once, then hand them to their materials:
+
+	std::vector<TextureJob*> jobs;
+	for (struct mat& matter : obj_mats)
+	{
+		for (TextureJob& job : *matter.m->GetPendingTextures())
+			jobs.push_back(&job);
+	}
+
+	// Set STBI to flip images for texture loading
+	stbi_set_flip_vertically_on_load(1);
+	bool compress = compressTextures;
+	ThreadPool::Shared()->ParallelFor((int)jobs.size(), [&jobs, compress](int i)
+	{
+		DecodeTexture(jobs[i], compress);
+	});
+
+	for (struct mat& matter : obj_mats)
+		matter.m->StorePendingTextures();
+
     return 0;
 }
 
+// block-compress the material maps, through their .bcn caches (set before the .mtl file is read)
+
+void MaterialSet::CompressTextures(bool tf)
+{
+	compressTextures = tf;
+}
+
 void MaterialSet::Reset()
 {
 
@@ -1,4 +1,9 @@
 #include "includes/loadobjfile.h"
+#include "includes/mappedfile.h"
+#include "includes/meshcache.h"
+#include "includes/meshoptimize.h"
+#include "includes/threadpool.h"
+#include <chrono>
 
 // delimiters for parsing the obj file:
 
@@ -36,10 +41,25 @@ void	ReadObjVTN(char*, int*, int*, int*);
 float	Unit(float[3]);
 float	Unit(float[3], float[3]);
 
+static void	LoadObjMtllib(MaterialSet*, const char*, std::vector<std::string>*);
+static VertexBufferObject*	NewObjObject();
+static void	EmitObjFace(VertexBufferObject*, struct face*, int,
+			std::vector<struct Vertex>&, std::vector<struct Normal>&, std::vector<struct TextureCoord>&);
+static int	LoadObjFileMapped(char*, std::vector<VertexBufferObject*>*, MaterialSet*, std::vector<std::string>*);
+static int	LoadObjFileParallel(char*, std::vector<VertexBufferObject*>*, MaterialSet*, std::vector<std::string>*);
+
+
+// if mtllibs isn't NULL, the names on the file's mtllib lines are added to it (so the mesh cache can replay them):
 
 int
-LoadObjFile(char* name, std::vector<VertexBufferObject*> *object, MaterialSet *matlib)
+LoadObjFile(char* name, std::vector<VertexBufferObject*> *object, MaterialSet *matlib, int mode, std::vector<std::string> *mtllibs)
 {
+	if (mode == OBJ_LOAD_MAPPED)
+		return LoadObjFileMapped(name, object, matlib, mtllibs);
+
+	if (mode == OBJ_LOAD_PARALLEL)
+		return LoadObjFileParallel(name, object, matlib, mtllibs);
+
 	char* cmd;		// the command string
 	char* str;		// argument string
 
@@ -111,22 +131,8 @@ LoadObjFile(char* name, std::vector<VertexBufferObject*> *object, MaterialSet *m
 
 		if (strcmp(cmd, "mtllib") == 0)
 		{
-			std::string dir ("assets\\");
 			str = strtok_s(NULL, (char*)"\n", &tokptr);
-			dir.append(str);
-
-			if (matlib->LoadMtlFile((char *)dir.c_str()) == 0)
-			{
-#ifdef _DEBUG
-				fprintf(stderr, "Texture file loaded: %s\n", (char*)dir.c_str());
-#endif
-			}
-			else
-			{
-#ifdef _DEBUG
-				fprintf(stderr, "Texture file failed to load: %s\n", (char*)dir.c_str());
-#endif
-			}
+			LoadObjMtllib(matlib, str, mtllibs);
 
 			continue;
 
@@ -142,12 +148,7 @@ LoadObjFile(char* name, std::vector<VertexBufferObject*> *object, MaterialSet *m
 				cur_object_g = NULL;
 			}
 
-			cur_object_g = new VertexBufferObject();
-
-			cur_object_g->CollapseCommonVertices(false);
-			cur_object_g->glBegin(GL_TRIANGLES);
-
-			cur_object_g->SetVerbose(false);
+			cur_object_g = NewObjObject();
 
 		}
 
@@ -298,116 +299,1133 @@ LoadObjFile(char* name, std::vector<VertexBufferObject*> *object, MaterialSet *m
 				continue;
 
 
-			// list the vertices:
+			EmitObjFace(cur_object_g, vertices, numVertices, Vertices, Normals, TextureCoords);
+			continue;
+		}
+
+
+		if (strcmp(cmd, "s") == 0)
+		{
+			continue;
+		}
+
+	}
+
+	// the object still open at the end of the file is as real as the others:
+
+	if (cur_object_g != NULL)
+		object->push_back(cur_object_g);
+
+	//glEnd();
+	fclose(fp);
+
+#ifdef _DEBUG
+
+	fprintf(stderr, "Obj file range: [%8.3f,%8.3f,%8.3f] -> [%8.3f,%8.3f,%8.3f]\n",
+		xmin, ymin, zmin, xmax, ymax, zmax);
+	fprintf(stderr, "Obj file center = (%8.3f,%8.3f,%8.3f)\n",
+		(xmin + xmax) / 2., (ymin + ymax) / 2., (zmin + zmax) / 2.);
+	fprintf(stderr, "Obj file  span = (%8.3f,%8.3f,%8.3f)\n",
+		xmax - xmin, ymax - ymin, zmax - zmin);
+
+#endif // DEBUG
+
+	return 0;
+}
+
+
+
+// load the material library named on an "mtllib" line (and note its name, if mtllibs isn't NULL):
+
+static void
+LoadObjMtllib(MaterialSet* matlib, const char* str, std::vector<std::string>* mtllibs)
+{
+	if (str != NULL && mtllibs != NULL)
+		mtllibs->push_back(str);
+
+	if (matlib == NULL || str == NULL)
+		return;
+
+	std::string dir("assets\\");
+	dir.append(str);
+
+	if (matlib->LoadMtlFile((char*)dir.c_str()) == 0)
+	{
+#ifdef _DEBUG
+		fprintf(stderr, "Texture file loaded: %s\n", (char*)dir.c_str());
+#endif
+	}
+	else
+	{
+#ifdef _DEBUG
+		fprintf(stderr, "Texture file failed to load: %s\n", (char*)dir.c_str());
+#endif
+	}
+}
+
+
+// start a new VBO for an "o" line:
+
+static VertexBufferObject*
+NewObjObject()
+{
+	VertexBufferObject* obj = new VertexBufferObject();
+
+	obj->CollapseCommonVertices(false);
+	obj->WeldVertices(true);
+	obj->glBegin(GL_TRIANGLES);
+
+	obj->SetVerbose(false);
+
+	return obj;
+}
+
+
+// triangulate one polygon as a fan and list its vertices into the VBO:
+
+static void
+EmitObjFace(VertexBufferObject* obj, struct face* vertices, int numVertices,
+	std::vector<struct Vertex>& Vertices, std::vector<struct Normal>& Normals, std::vector<struct TextureCoord>& TextureCoords)
+{
+	int numTriangles = numVertices - 2;
+
+	for (int it = 0; it < numTriangles; it++)
+	{
+		int vv[3] = { };
+		vv[0] = 0;
+		vv[1] = it + 1;
+		vv[2] = it + 2;
+
+
+		// Calculate Tangent/Binormals
+		struct Vertex tangent = { };
+		struct Vertex bitangent = { };
+
+		if (vertices[vv[0]].t != 0)
+		{
+			struct Vertex* v0 = &Vertices[vertices[vv[0]].v - 1];
+			struct Vertex* v1 = &Vertices[vertices[vv[1]].v - 1];
+			struct Vertex* v2 = &Vertices[vertices[vv[2]].v - 1];
+
+			struct TextureCoord* tp0 = &TextureCoords[vertices[vv[0]].t - 1];
+			struct TextureCoord* tp1 = &TextureCoords[vertices[vv[1]].t - 1];
+			struct TextureCoord* tp2 = &TextureCoords[vertices[vv[2]].t - 1];
+
+			struct Vertex deltaPos1 = { v1->x - v0->x, v1->y - v0->y, v1->z - v0->z };
+			struct Vertex deltaPos2 = { v2->x - v0->x, v2->y - v0->y, v2->z - v0->z };
+
+			struct TextureCoord uv1 = { tp1->s - tp0->s, tp1->t - tp0->t };
+			struct TextureCoord uv2 = { tp2->s - tp0->s, tp2->t - tp0->t };
+
+			float r = 1.f / (uv1.s * uv2.t - uv1.t * uv2.s);
+
+			tangent = { (deltaPos1.x * uv2.t - deltaPos2.x * uv1.t) * r,
+						(deltaPos1.y * uv2.t - deltaPos2.y * uv1.t) * r,
+						(deltaPos1.z * uv2.t - deltaPos2.z * uv1.t) * r
+					  };
+
+			bitangent = { (deltaPos1.x * uv2.s - deltaPos2.x * uv1.s) * r,
+						  (deltaPos1.y * uv2.s - deltaPos2.y * uv1.s) * r,
+						  (deltaPos1.z * uv2.s - deltaPos2.z * uv1.s) * r
+					    };
+
+		}
+
+		// get the planar normal, in case vertex normals are not defined:
+
+		/*struct Vertex* v0 = &Vertices[vertices[vv[0]].v - 1];
+		struct Vertex* v1 = &Vertices[vertices[vv[1]].v - 1];
+		struct Vertex* v2 = &Vertices[vertices[vv[2]].v - 1];
+
+		float v01[3], v02[3], norm[3];
+		v01[0] = v1->x - v0->x;
+		v01[1] = v1->y - v0->y;
+		v01[2] = v1->z - v0->z;
+		v02[0] = v2->x - v0->x;
+		v02[1] = v2->y - v0->y;
+		v02[2] = v2->z - v0->z;
+		Cross(v01, v02, norm);
+		Unit(norm, norm);
+		glNormal3fv(norm);*/
 
-			int numTriangles = numVertices - 2;
+		for (int vtx = 0; vtx < 3; vtx++)
+		{
+
+			if (vertices[vv[vtx]].n != 0)
+			{
+				struct Normal* np = &Normals[vertices[vv[vtx]].n - 1];
+				obj->glNormal3f(np->nx, np->ny, np->nz);
+			}
 
-			for (int it = 0; it < numTriangles; it++)
+			if (vertices[vv[vtx]].t != 0)
 			{
-				int vv[3] = { };
-				vv[0] = 0;
-				vv[1] = it + 1;
-				vv[2] = it + 2;
+				struct TextureCoord* tp = &TextureCoords[vertices[vv[vtx]].t - 1];
+				obj->glTexCoord2f(tp->s, tp->t);
+			}
 
+			struct Vertex* vp = &Vertices[vertices[vv[vtx]].v - 1];
+			obj->AddTangent(tangent.x, tangent.y, tangent.z);
+			obj->AddBitangent(bitangent.x, bitangent.y, bitangent.z);
+			obj->glVertex3f(vp->x, vp->y, vp->z);
+		}
+	}
+}
 
-				// Calculate Tangent/Binormals
-				struct Vertex tangent = { };
-				struct Vertex bitangent = { };
 
-				if (vertices[vv[0]].t != 0)
-				{
-					struct Vertex* v0 = &Vertices[vertices[vv[0]].v - 1];
-					struct Vertex* v1 = &Vertices[vertices[vv[1]].v - 1];
-					struct Vertex* v2 = &Vertices[vertices[vv[2]].v - 1];
+// hand-written scanners for the mapped loader
+// (they read straight out of the mapped file and never allocate):
 
-					struct TextureCoord* tp0 = &TextureCoords[vertices[vv[0]].t - 1];
-					struct TextureCoord* tp1 = &TextureCoords[vertices[vv[1]].t - 1];
-					struct TextureCoord* tp2 = &TextureCoords[vertices[vv[2]].t - 1];
+static inline bool
+IsObjBlank(char c)
+{
+	return c == ' ' || c == '\t';
+}
 
-					struct Vertex deltaPos1 = { v1->x - v0->x, v1->y - v0->y, v1->z - v0->z };
-					struct Vertex deltaPos2 = { v2->x - v0->x, v2->y - v0->y, v2->z - v0->z };
 
-					struct TextureCoord uv1 = { tp1->s - tp0->s, tp1->t - tp0->t };
-					struct TextureCoord uv2 = { tp2->s - tp0->s, tp2->t - tp0->t };
+static inline const char*
+SkipObjBlanks(const char* p, const char* end)
+{
+	while (p < end && IsObjBlank(*p))
+		p++;
+	return p;
+}
 
-					float r = 1.f / (uv1.s * uv2.t - uv1.t * uv2.s);
 
-					tangent = { (deltaPos1.x * uv2.t - deltaPos2.x * uv1.t) * r,
-								(deltaPos1.y * uv2.t - deltaPos2.y * uv1.t) * r,
-								(deltaPos1.z * uv2.t - deltaPos2.z * uv1.t) * r
-							  };
+static inline const char*
+SkipObjToken(const char* p, const char* end)
+{
+	while (p < end && !IsObjBlank(*p))
+		p++;
+	return p;
+}
 
-					bitangent = { (deltaPos1.x * uv2.s - deltaPos2.x * uv1.s) * r,
-								  (deltaPos1.y * uv2.s - deltaPos2.y * uv1.s) * r,
-								  (deltaPos1.z * uv2.s - deltaPos2.z * uv1.s) * r
-							    };
 
-				}
+// exact powers of ten -- every one of these is representable in a double,
+// so mantissa / Pow10[k] rounds the same way atof( ) does:
 
-				// get the planar normal, in case vertex normals are not defined:
+static const double Pow10[] =
+{
+	1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
 
-				/*struct Vertex* v0 = &Vertices[vertices[vv[0]].v - 1];
-				struct Vertex* v1 = &Vertices[vertices[vv[1]].v - 1];
-				struct Vertex* v2 = &Vertices[vertices[vv[2]].v - 1];
 
-				float v01[3], v02[3], norm[3];
-				v01[0] = v1->x - v0->x;
-				v01[1] = v1->y - v0->y;
-				v01[2] = v1->z - v0->z;
-				v02[0] = v2->x - v0->x;
-				v02[1] = v2->y - v0->y;
-				v02[2] = v2->z - v0->z;
-				Cross(v01, v02, norm);
-				Unit(norm, norm);
-				glNormal3fv(norm);*/
+static const char*
+ScanObjFloat(const char* p, const char* end, float* f)
+{
+	p = SkipObjBlanks(p, end);
 
-				for (int vtx = 0; vtx < 3; vtx++)
-				{
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+	{
+		negative = (*p == '-');
+		p++;
+	}
 
-					if (vertices[vv[vtx]].n != 0)
-					{
-						struct Normal* np = &Normals[vertices[vv[vtx]].n - 1];
-						cur_object_g->glNormal3f(np->nx, np->ny, np->nz);
-					}
-
-					if (vertices[vv[vtx]].t != 0)
-					{
-						struct TextureCoord* tp = &TextureCoords[vertices[vv[vtx]].t - 1];
-						cur_object_g->glTexCoord2f(tp->s, tp->t);
-					}
-
-					struct Vertex* vp = &Vertices[vertices[vv[vtx]].v - 1];
-					cur_object_g->AddTangent(tangent.x, tangent.y, tangent.z);
-					cur_object_g->AddBitangent(bitangent.x, bitangent.y, bitangent.z);
-					cur_object_g->glVertex3f(vp->x, vp->y, vp->z);
-				}
+	unsigned long long mantissa = 0;
+	int digits = 0;
+	int exponent = 0;
+	bool any = false;
+
+	while (p < end && (unsigned)(*p - '0') < 10)
+	{
+		if (digits < 19)
+		{
+			mantissa = mantissa * 10 + (*p - '0');
+			if (mantissa != 0)
+				digits++;
+		}
+		else
+			exponent++;
+		any = true;
+		p++;
+	}
+
+	if (p < end && *p == '.')
+	{
+		p++;
+		while (p < end && (unsigned)(*p - '0') < 10)
+		{
+			if (digits < 19)
+			{
+				mantissa = mantissa * 10 + (*p - '0');
+				if (mantissa != 0)
+					digits++;
+				exponent--;
 			}
-			continue;
+			any = true;
+			p++;
+		}
+	}
+
+	if (any && p < end && (*p == 'e' || *p == 'E'))
+	{
+		const char* q = p + 1;
+		bool negexp = false;
+		if (q < end && (*q == '-' || *q == '+'))
+		{
+			negexp = (*q == '-');
+			q++;
+		}
+		if (q < end && (unsigned)(*q - '0') < 10)
+		{
+			int e = 0;
+			while (q < end && (unsigned)(*q - '0') < 10)
+			{
+				if (e < 10000)
+					e = e * 10 + (*q - '0');
+				q++;
+			}
+			exponent += negexp ? -e : e;
+			p = q;
 		}
+	}
 
+	if (!any)
+	{
+		// not a number (atof( ) would give 0.), so just step over it:
 
-		if (strcmp(cmd, "s") == 0)
+		*f = 0.f;
+		return SkipObjToken(p, end);
+	}
+
+	double value = (double)mantissa;
+	if (exponent < 0)
+	{
+		if (exponent >= -22)
+			value /= Pow10[-exponent];
+		else
+			value *= pow(10., (double)exponent);
+	}
+	else if (exponent > 0)
+	{
+		if (exponent <= 22)
+			value *= Pow10[exponent];
+		else
+			value *= pow(10., (double)exponent);
+	}
+
+	*f = (float)(negative ? -value : value);
+	return p;
+}
+
+
+static inline const char*
+ScanObjInt(const char* p, const char* end, int* i)
+{
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+	{
+		negative = (*p == '-');
+		p++;
+	}
+
+	int value = 0;
+	while (p < end && (unsigned)(*p - '0') < 10)
+	{
+		value = value * 10 + (*p - '0');
+		p++;
+	}
+
+	*i = negative ? -value : value;
+	return p;
+}
+
+
+// same rules as ReadObjVTN( ): one of v, v//n, v/t, v/t/n
+
+static const char*
+ScanObjVTN(const char* p, const char* end, int* v, int* t, int* n)
+{
+	*v = *t = *n = 0;
+
+	p = ScanObjInt(p, end, v);
+	if (p < end && *p == '/')
+	{
+		p++;
+		if (p < end && *p == '/')		// v//n
 		{
-			continue;
+			p = ScanObjInt(p + 1, end, n);
+		}
+		else
+		{
+			p = ScanObjInt(p, end, t);
+			if (p < end && *p == '/')	// v/t/n
+				p = ScanObjInt(p + 1, end, n);
 		}
+	}
+
+	return SkipObjToken(p, end);
+}
+
+
+// the rest of an "mtllib" or "usemtl" line, as a null-terminated string:
+
+static std::string
+ObjRestOfLine(const char* p, const char* end)
+{
+	if (p < end)
+		p++;		// step over the one delimiter after the command, as strtok_s( ) does
+
+	return std::string(p, end - p);
+}
+
+
+// map the whole file and parse it in one pass
+// this produces exactly the same VBOs as the getc/strtok_s path:
+
+static int
+LoadObjFileMapped(char* name, std::vector<VertexBufferObject*>* object, MaterialSet* matlib, std::vector<std::string>* mtllibs)
+{
+	VertexBufferObject* cur_object_g = NULL;
 
+	MappedFile file;
+	if (!file.Open(name))
+	{
+		fprintf(stderr, "Cannot open .obj file '%s'\n", name);
+		return 1;
 	}
 
-	//glEnd();
-	fclose(fp);
+	const char* cp = file.Data();
+	const char* eof = cp + file.Size();
 
-#ifdef _DEBUG
+	// a cheap guess at how big the lists will get, so they are not
+	// re-grown over and over on large files:
 
-	fprintf(stderr, "Obj file range: [%8.3f,%8.3f,%8.3f] -> [%8.3f,%8.3f,%8.3f]\n",
-		xmin, ymin, zmin, xmax, ymax, zmax);
-	fprintf(stderr, "Obj file center = (%8.3f,%8.3f,%8.3f)\n",
-		(xmin + xmax) / 2., (ymin + ymax) / 2., (zmin + zmax) / 2.);
-	fprintf(stderr, "Obj file  span = (%8.3f,%8.3f,%8.3f)\n",
-		xmax - xmin, ymax - ymin, zmax - zmin);
+	size_t guess = file.Size() / 96;
 
-#endif // DEBUG
+	std::vector <struct Vertex> Vertices;
+	std::vector <struct Normal> Normals;
+	std::vector <struct TextureCoord> TextureCoords;
+	Vertices.reserve(guess);
+	Normals.reserve(guess);
+	TextureCoords.reserve(guess);
 
-	return 0;
+	float xmin = 1.e+37f;
+	float ymin = 1.e+37f;
+	float zmin = 1.e+37f;
+	float xmax = -xmin;
+	float ymax = -ymin;
+	float zmax = -zmin;
+
+	while (cp < eof)
+	{
+		const char* line = cp;
+		const char* eol = (const char*)memchr(cp, '\n', eof - cp);
+		if (eol == NULL)
+			eol = eof;
+		cp = (eol < eof) ? eol + 1 : eof;
+
+		// the file is not opened in text mode, so drop any '\r':
+
+		if (eol > line && eol[-1] == '\r')
+			eol--;
+
+		if (line == eol)
+			continue;
+
+		// skip comments and things we don't feel like handling today:
+
+		if (line[0] == '#' || line[0] == 'g' || line[0] == 's')
+			continue;
+
+		const char* cmd = SkipObjBlanks(line, eol);
+		const char* p = SkipObjToken(cmd, eol);
+		size_t cmdlen = p - cmd;
+
+		if (cmdlen == 0)
+			continue;
+
+		if (cmd[0] == 'v' && cmdlen == 1)
+		{
+			struct Vertex sv = { };
+			p = ScanObjFloat(p, eol, &sv.x);
+			p = ScanObjFloat(p, eol, &sv.y);
+			p = ScanObjFloat(p, eol, &sv.z);
+
+			Vertices.push_back(sv);
+
+			if (sv.x < xmin)	xmin = sv.x;
+			if (sv.x > xmax)	xmax = sv.x;
+			if (sv.y < ymin)	ymin = sv.y;
+			if (sv.y > ymax)	ymax = sv.y;
+			if (sv.z < zmin)	zmin = sv.z;
+			if (sv.z > zmax)	zmax = sv.z;
+
+			continue;
+		}
+
+		if (cmd[0] == 'v' && cmdlen == 2 && cmd[1] == 'n')
+		{
+			struct Normal sn = { };
+			p = ScanObjFloat(p, eol, &sn.nx);
+			p = ScanObjFloat(p, eol, &sn.ny);
+			p = ScanObjFloat(p, eol, &sn.nz);
+
+			Normals.push_back(sn);
+
+			continue;
+		}
+
+		if (cmd[0] == 'v' && cmdlen == 2 && cmd[1] == 't')
+		{
+			struct TextureCoord st = { };
+			p = ScanObjFloat(p, eol, &st.s);
+			if (SkipObjBlanks(p, eol) < eol)
+				p = ScanObjFloat(p, eol, &st.t);
+			if (SkipObjBlanks(p, eol) < eol)
+				p = ScanObjFloat(p, eol, &st.p);
+
+			TextureCoords.push_back(st);
+
+			continue;
+		}
+
+		if (cmd[0] == 'f' && cmdlen == 1)
+		{
+			struct face vertices[10] = { };
+
+			int sizev = (int)Vertices.size();
+			int sizen = (int)Normals.size();
+			int sizet = (int)TextureCoords.size();
+
+			int numVertices = 0;
+			bool valid = true;
+			int vtx = 0;
+			while ((p = SkipObjBlanks(p, eol)) < eol)
+			{
+				int v, n, t;
+				p = ScanObjVTN(p, eol, &v, &t, &n);
+
+				// if v, n, or t are negative, they are wrt the end of their respective list:
+
+				if (v < 0)
+					v += (sizev + 1);
+
+				if (n < 0)
+					n += (sizen + 1);
+
+				if (t < 0)
+					t += (sizet + 1);
+
+
+				// be sure we are not out-of-bounds (<vector> will abort):
+
+				if (t > sizet)
+				{
+					if (t != 0)
+						fprintf(stderr, "Read texture coord %d, but only have %d so far\n", t, sizet);
+					t = 0;
+				}
+
+				if (n > sizen)
+				{
+					if (n != 0)
+						fprintf(stderr, "Read normal %d, but only have %d so far\n", n, sizen);
+					n = 0;
+				}
+
+				if (v > sizev)
+				{
+					if (v != 0)
+						fprintf(stderr, "Read vertex coord %d, but only have %d so far\n", v, sizev);
+					v = 0;
+					valid = false;
+				}
+
+				vertices[vtx].v = v;
+				vertices[vtx].n = n;
+				vertices[vtx].t = t;
+				vtx++;
+
+				if (vtx >= 10)
+					break;
+
+				numVertices++;
+			}
+
+			if (!valid || numVertices < 3 || cur_object_g == NULL)
+				continue;
+
+			EmitObjFace(cur_object_g, vertices, numVertices, Vertices, Normals, TextureCoords);
+			continue;
+		}
+
+		if (cmd[0] == 'o' && cmdlen == 1)
+		{
+			if (cur_object_g != NULL)
+				object->push_back(cur_object_g);
+
+			cur_object_g = NewObjObject();
+			continue;
+		}
+
+		if (cmdlen == 6 && strncmp(cmd, "usemtl", 6) == 0)
+		{
+			if (cur_object_g != NULL)
+				cur_object_g->SetMaterial((char*)ObjRestOfLine(p, eol).c_str());
+			continue;
+		}
+
+		if (cmdlen == 6 && strncmp(cmd, "mtllib", 6) == 0)
+		{
+			LoadObjMtllib(matlib, ObjRestOfLine(p, eol).c_str(), mtllibs);
+			continue;
+		}
+	}
+
+	if (cur_object_g != NULL)
+		object->push_back(cur_object_g);
+
+#ifdef _DEBUG
+
+	fprintf(stderr, "Obj file range: [%8.3f,%8.3f,%8.3f] -> [%8.3f,%8.3f,%8.3f]\n",
+		xmin, ymin, zmin, xmax, ymax, zmax);
+	fprintf(stderr, "Obj file center = (%8.3f,%8.3f,%8.3f)\n",
+		(xmin + xmax) / 2., (ymin + ymax) / 2., (zmin + zmax) / 2.);
+	fprintf(stderr, "Obj file  span = (%8.3f,%8.3f,%8.3f)\n",
+		xmax - xmin, ymax - ymin, zmax - zmin);
+
+#endif // DEBUG
+
+	return 0;
+}
+
+// the parallel loader splits the file into chunks at newline boundaries
+// each chunk is scanned on its own thread into chunk-local lists, with the face
+// indices kept exactly as written so they can be resolved once the chunks are
+// stitched back together in file order
+
+struct ObjFaceRec
+{
+	int first;			// index into the chunk's corner list
+	int numStored;			// corners actually read (at most 10)
+	int numVertices;		// corners the serial loader would list
+	int sizev, sizen, sizet;	// chunk-local list sizes when the face was read
+};
+
+
+enum ObjEventType
+{
+	OBJ_EVENT_OBJECT,
+	OBJ_EVENT_USEMTL,
+	OBJ_EVENT_MTLLIB
+};
+
+
+struct ObjEvent
+{
+	int type;
+	int face;			// number of faces in the chunk before this line
+	std::string name;
+};
+
+
+struct ObjChunk
+{
+	const char* begin;
+	const char* end;
+
+	std::vector <struct Vertex> Vertices;
+	std::vector <struct Normal> Normals;
+	std::vector <struct TextureCoord> TextureCoords;
+	std::vector <struct face> corners;
+	std::vector <struct ObjFaceRec> faces;
+	std::vector <struct ObjEvent> events;
+
+	int baseV, baseN, baseT;	// global list sizes before this chunk
+	float xmin, ymin, zmin, xmax, ymax, zmax;
+};
+
+
+// faces from one chunk that belong to one object:
+
+struct ObjSegment
+{
+	int chunk;
+	int first, last;
+};
+
+
+static void
+ParseObjChunk(struct ObjChunk* chunk)
+{
+	const char* cp = chunk->begin;
+	const char* eof = chunk->end;
+
+	size_t guess = (eof - cp) / 96;
+	chunk->Vertices.reserve(guess);
+	chunk->Normals.reserve(guess);
+	chunk->TextureCoords.reserve(guess);
+
+	chunk->xmin = chunk->ymin = chunk->zmin = 1.e+37f;
+	chunk->xmax = chunk->ymax = chunk->zmax = -1.e+37f;
+
+	while (cp < eof)
+	{
+		const char* line = cp;
+		const char* eol = (const char*)memchr(cp, '\n', eof - cp);
+		if (eol == NULL)
+			eol = eof;
+		cp = (eol < eof) ? eol + 1 : eof;
+
+		if (eol > line && eol[-1] == '\r')
+			eol--;
+
+		if (line == eol)
+			continue;
+
+		if (line[0] == '#' || line[0] == 'g' || line[0] == 's')
+			continue;
+
+		const char* cmd = SkipObjBlanks(line, eol);
+		const char* p = SkipObjToken(cmd, eol);
+		size_t cmdlen = p - cmd;
+
+		if (cmdlen == 0)
+			continue;
+
+		if (cmd[0] == 'v' && cmdlen == 1)
+		{
+			struct Vertex sv = { };
+			p = ScanObjFloat(p, eol, &sv.x);
+			p = ScanObjFloat(p, eol, &sv.y);
+			p = ScanObjFloat(p, eol, &sv.z);
+
+			chunk->Vertices.push_back(sv);
+
+			if (sv.x < chunk->xmin)	chunk->xmin = sv.x;
+			if (sv.x > chunk->xmax)	chunk->xmax = sv.x;
+			if (sv.y < chunk->ymin)	chunk->ymin = sv.y;
+			if (sv.y > chunk->ymax)	chunk->ymax = sv.y;
+			if (sv.z < chunk->zmin)	chunk->zmin = sv.z;
+			if (sv.z > chunk->zmax)	chunk->zmax = sv.z;
+
+			continue;
+		}
+
+		if (cmd[0] == 'v' && cmdlen == 2 && cmd[1] == 'n')
+		{
+			struct Normal sn = { };
+			p = ScanObjFloat(p, eol, &sn.nx);
+			p = ScanObjFloat(p, eol, &sn.ny);
+			p = ScanObjFloat(p, eol, &sn.nz);
+
+			chunk->Normals.push_back(sn);
+
+			continue;
+		}
+
+		if (cmd[0] == 'v' && cmdlen == 2 && cmd[1] == 't')
+		{
+			struct TextureCoord st = { };
+			p = ScanObjFloat(p, eol, &st.s);
+			if (SkipObjBlanks(p, eol) < eol)
+				p = ScanObjFloat(p, eol, &st.t);
+			if (SkipObjBlanks(p, eol) < eol)
+				p = ScanObjFloat(p, eol, &st.p);
+
+			chunk->TextureCoords.push_back(st);
+
+			continue;
+		}
+
+		if (cmd[0] == 'f' && cmdlen == 1)
+		{
+			struct ObjFaceRec rec = { };
+			rec.first = (int)chunk->corners.size();
+			rec.sizev = (int)chunk->Vertices.size();
+			rec.sizen = (int)chunk->Normals.size();
+			rec.sizet = (int)chunk->TextureCoords.size();
+
+			while ((p = SkipObjBlanks(p, eol)) < eol)
+			{
+				struct face corner;
+				p = ScanObjVTN(p, eol, &corner.v, &corner.t, &corner.n);
+				chunk->corners.push_back(corner);
+				rec.numStored++;
+
+				if (rec.numStored >= 10)
+					break;
+
+				rec.numVertices++;
+			}
+
+			chunk->faces.push_back(rec);
+			continue;
+		}
+
+		if (cmd[0] == 'o' && cmdlen == 1)
+		{
+			struct ObjEvent ev = { OBJ_EVENT_OBJECT, (int)chunk->faces.size() };
+			chunk->events.push_back(ev);
+			continue;
+		}
+
+		if (cmdlen == 6 && strncmp(cmd, "usemtl", 6) == 0)
+		{
+			struct ObjEvent ev = { OBJ_EVENT_USEMTL, (int)chunk->faces.size(), ObjRestOfLine(p, eol) };
+			chunk->events.push_back(ev);
+			continue;
+		}
+
+		if (cmdlen == 6 && strncmp(cmd, "mtllib", 6) == 0)
+		{
+			struct ObjEvent ev = { OBJ_EVENT_MTLLIB, (int)chunk->faces.size(), ObjRestOfLine(p, eol) };
+			chunk->events.push_back(ev);
+			continue;
+		}
+	}
+}
+
+
+// resolve one face's indices against the global lists (the same rules, and
+// the same messages, as the serial loaders) and list it into the VBO:
+
+static void
+EmitObjChunkFace(VertexBufferObject* obj, struct ObjChunk* chunk, struct ObjFaceRec* rec,
+	std::vector<struct Vertex>& Vertices, std::vector<struct Normal>& Normals, std::vector<struct TextureCoord>& TextureCoords)
+{
+	struct face vertices[10] = { };
+
+	int sizev = chunk->baseV + rec->sizev;
+	int sizen = chunk->baseN + rec->sizen;
+	int sizet = chunk->baseT + rec->sizet;
+
+	bool valid = true;
+	for (int vtx = 0; vtx < rec->numStored; vtx++)
+	{
+		struct face* corner = &chunk->corners[rec->first + vtx];
+		int v = corner->v;
+		int n = corner->n;
+		int t = corner->t;
+
+		if (v < 0)
+			v += (sizev + 1);
+
+		if (n < 0)
+			n += (sizen + 1);
+
+		if (t < 0)
+			t += (sizet + 1);
+
+		if (t > sizet)
+		{
+			if (t != 0)
+				fprintf(stderr, "Read texture coord %d, but only have %d so far\n", t, sizet);
+			t = 0;
+		}
+
+		if (n > sizen)
+		{
+			if (n != 0)
+				fprintf(stderr, "Read normal %d, but only have %d so far\n", n, sizen);
+			n = 0;
+		}
+
+		if (v > sizev)
+		{
+			if (v != 0)
+				fprintf(stderr, "Read vertex coord %d, but only have %d so far\n", v, sizev);
+			v = 0;
+			valid = false;
+		}
+
+		vertices[vtx].v = v;
+		vertices[vtx].n = n;
+		vertices[vtx].t = t;
+	}
+
+	if (!valid || rec->numVertices < 3)
+		return;
+
+	EmitObjFace(obj, vertices, rec->numVertices, Vertices, Normals, TextureCoords);
+}
+
+
+static int
+LoadObjFileParallel(char* name, std::vector<VertexBufferObject*>* object, MaterialSet* matlib, std::vector<std::string>* mtllibs)
+{
+	ThreadPool* pool = ThreadPool::Shared();
+
+	// with only one core, the bookkeeping costs more than it buys:
+
+	if (pool->NumThreads() < 2)
+		return LoadObjFileMapped(name, object, matlib, mtllibs);
+
+	MappedFile file;
+	if (!file.Open(name))
+	{
+		fprintf(stderr, "Cannot open .obj file '%s'\n", name);
+		return 1;
+	}
+
+	const char* data = file.Data();
+	const char* eof = data + file.Size();
+
+
+	// cut the file into a few chunks per thread, but don't bother with tiny ones:
+
+	const size_t MINCHUNK = 1 << 20;
+
+	size_t numChunks = (size_t)pool->NumThreads() * 4;
+	if (numChunks > file.Size() / MINCHUNK)
+		numChunks = file.Size() / MINCHUNK;
+	if (numChunks < 1)
+		numChunks = 1;
+
+	std::vector<struct ObjChunk> chunks(numChunks);
+	const char* cp = data;
+	for (size_t i = 0; i < numChunks; i++)
+	{
+		const char* cut = (i == numChunks - 1) ? eof : data + file.Size() * (i + 1) / numChunks;
+		if (cut < cp)
+			cut = cp;
+		const char* nl = (const char*)memchr(cut, '\n', eof - cut);
+		cut = (nl == NULL) ? eof : nl + 1;
+
+		chunks[i].begin = cp;
+		chunks[i].end = cut;
+		cp = cut;
+	}
+
+
+	// scan every chunk:
+
+	pool->ParallelFor((int)numChunks, [&chunks](int i)
+	{
+		ParseObjChunk(&chunks[i]);
+	});
+
+
+	// stitch the lists back together in file order:
+
+	int numV = 0, numN = 0, numT = 0;
+	for (struct ObjChunk& chunk : chunks)
+	{
+		chunk.baseV = numV;
+		chunk.baseN = numN;
+		chunk.baseT = numT;
+		numV += (int)chunk.Vertices.size();
+		numN += (int)chunk.Normals.size();
+		numT += (int)chunk.TextureCoords.size();
+	}
+
+	std::vector <struct Vertex> Vertices(numV);
+	std::vector <struct Normal> Normals(numN);
+	std::vector <struct TextureCoord> TextureCoords(numT);
+
+	pool->ParallelFor((int)numChunks, [&](int i)
+	{
+		struct ObjChunk& chunk = chunks[i];
+		std::copy(chunk.Vertices.begin(), chunk.Vertices.end(), Vertices.begin() + chunk.baseV);
+		std::copy(chunk.Normals.begin(), chunk.Normals.end(), Normals.begin() + chunk.baseN);
+		std::copy(chunk.TextureCoords.begin(), chunk.TextureCoords.end(), TextureCoords.begin() + chunk.baseT);
+	});
+
+
+	// replay the o/usemtl/mtllib lines in order on this thread (making a VBO
+	// touches GL state), noting which run of faces ends up in which object:
+
+	std::vector<VertexBufferObject*> objs;
+	std::vector< std::vector<struct ObjSegment> > segments;
+	VertexBufferObject* cur_object_g = NULL;
+
+	for (int c = 0; c < (int)numChunks; c++)
+	{
+		struct ObjChunk& chunk = chunks[c];
+		int first = 0;
+
+		for (struct ObjEvent& ev : chunk.events)
+		{
+			if (ev.type == OBJ_EVENT_MTLLIB)
+			{
+				LoadObjMtllib(matlib, ev.name.c_str(), mtllibs);
+				continue;
+			}
+
+			if (cur_object_g != NULL && ev.face > first)
+			{
+				struct ObjSegment seg = { c, first, ev.face };
+				segments.back().push_back(seg);
+			}
+			first = ev.face;
+
+			if (ev.type == OBJ_EVENT_OBJECT)
+			{
+				if (cur_object_g != NULL)
+					object->push_back(cur_object_g);
+
+				cur_object_g = NewObjObject();
+				objs.push_back(cur_object_g);
+				segments.push_back(std::vector<struct ObjSegment>());
+			}
+			else if (ev.type == OBJ_EVENT_USEMTL)
+			{
+				if (cur_object_g != NULL)
+					cur_object_g->SetMaterial((char*)ev.name.c_str());
+			}
+		}
+
+		if (cur_object_g != NULL && (int)chunk.faces.size() > first)
+		{
+			struct ObjSegment seg = { c, first, (int)chunk.faces.size() };
+			segments.back().push_back(seg);
+		}
+	}
+
+	if (cur_object_g != NULL)
+		object->push_back(cur_object_g);
+
+
+	// each object fills its own VBO, so the objects can be listed concurrently:
+
+	pool->ParallelFor((int)objs.size(), [&](int o)
+	{
+		for (struct ObjSegment& seg : segments[o])
+		{
+			struct ObjChunk& chunk = chunks[seg.chunk];
+			for (int f = seg.first; f < seg.last; f++)
+				EmitObjChunkFace(objs[o], &chunk, &chunk.faces[f], Vertices, Normals, TextureCoords);
+		}
+	});
+
+#ifdef _DEBUG
+
+	float xmin = 1.e+37f;
+	float ymin = 1.e+37f;
+	float zmin = 1.e+37f;
+	float xmax = -xmin;
+	float ymax = -ymin;
+	float zmax = -zmin;
+	for (struct ObjChunk& chunk : chunks)
+	{
+		if (chunk.xmin < xmin)	xmin = chunk.xmin;
+		if (chunk.xmax > xmax)	xmax = chunk.xmax;
+		if (chunk.ymin < ymin)	ymin = chunk.ymin;
+		if (chunk.ymax > ymax)	ymax = chunk.ymax;
+		if (chunk.zmin < zmin)	zmin = chunk.zmin;
+		if (chunk.zmax > zmax)	zmax = chunk.zmax;
+	}
+
+	fprintf(stderr, "Obj file range: [%8.3f,%8.3f,%8.3f] -> [%8.3f,%8.3f,%8.3f]\n",
+		xmin, ymin, zmin, xmax, ymax, zmax);
+	fprintf(stderr, "Obj file center = (%8.3f,%8.3f,%8.3f)\n",
+		(xmin + xmax) / 2., (ymin + ymax) / 2., (zmin + zmax) / 2.);
+	fprintf(stderr, "Obj file  span = (%8.3f,%8.3f,%8.3f)\n",
+		xmax - xmin, ymax - ymin, zmax - zmin);
+	fprintf(stderr, "Obj file parsed in %d chunks on %d threads\n", (int)numChunks, pool->NumThreads());
+
+#endif // DEBUG
+
+	return 0;
+}
+
+
+// load the .obj file from its binary cache (name.meshcache) if that is still current,
+// otherwise parse it with the given mode (doing whatever ObjLoadOptions ask for)
+// and write a fresh cache for next time
+// given an arena, the objects are sub-allocated out of it rather than getting their own buffers:
+
+int
+LoadObjFileCached(char* name, std::vector<VertexBufferObject*>* object, MaterialSet* matlib, int mode, int options, GeometryArena* arena)
+{
+	unsigned int cacheOptions = (options & OBJ_OPTIMIZE) ? MESH_CACHE_OPTIMIZED : 0;
+
+	int packing = VBO_PACK_NONE;
+	if (options & OBJ_PACK_NORMALS)
+		packing |= VBO_PACK_NORMALS;
+	if (options & OBJ_PACK_POSITIONS)
+		packing |= VBO_PACK_POSITIONS;
+
+	std::string cacheName(name);
+	cacheName.append(".meshcache");
+
+	std::vector<std::string> mtllibs;
+	size_t first = object->size();
+
+	if (ReadMeshCache(cacheName.c_str(), name, cacheOptions, packing, arena, object, &mtllibs) == 0)
+	{
+		for (std::string& lib : mtllibs)
+			LoadObjMtllib(matlib, lib.c_str(), NULL);
+
+		return 0;
+	}
+
+	int status = LoadObjFile(name, object, matlib, mode, &mtllibs);
+	if (status == 0)
+	{
+		std::vector<VertexBufferObject*> loaded(object->begin() + first, object->end());
+
+		if (options & OBJ_OPTIMIZE)
+		{
+#ifdef _DEBUG
+			OptimizeMeshes(&loaded, true);
+#else
+			OptimizeMeshes(&loaded, false);
+#endif
+		}
+
+		// the cache keeps the full-precision points, the packing happens on upload:
+
+		WriteMeshCache(cacheName.c_str(), name, cacheOptions, &loaded, mtllibs);
+
+		for (VertexBufferObject* obj : loaded)
+		{
+			obj->PackVertices(packing);
+			obj->SetArena(arena);
+		}
+	}
+
+	return status;
+}
+
+
+// time each load mode on the same file and report the throughput
+// (the mtllib is skipped so only the .obj parsing gets measured):
+
+void
+BenchObjFile(char* name, int passes)
+{
+	const char* modeNames[] = { "stream", "mapped", "parallel" };
+	const int numModes = sizeof(modeNames) / sizeof(modeNames[0]);
+
+	double megabytes;
+	{
+		MappedFile file;
+		if (!file.Open(name))
+		{
+			fprintf(stderr, "Cannot open .obj file '%s'\n", name);
+			return;
+		}
+		megabytes = (double)file.Size() / (1024. * 1024.);
+	}
+
+	if (passes < 1)
+		passes = 1;
+
+	for (int mode = 0; mode < numModes; mode++)
+	{
+		double best = 1.e+37;
+		for (int pass = 0; pass < passes; pass++)
+		{
+			std::vector<VertexBufferObject*> objects;
+
+			std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+			LoadObjFile(name, &objects, NULL, mode);
+			std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+
+			double seconds = std::chrono::duration<double>(t1 - t0).count();
+			if (seconds < best)
+				best = seconds;
+
+			for (VertexBufferObject* obj : objects)
+				delete obj;
+		}
+
+		fprintf(stderr, "LoadObjFile %-8s: %8.3f s  %8.2f MB/s  (%.1f MB, best of %d)\n",
+			modeNames[mode], best, megabytes / best, megabytes, passes);
+	}
 }
 
 
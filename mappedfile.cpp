@@ -0,0 +1,172 @@
+#include "includes/mappedfile.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+
+// an empty file cannot be mapped, so hand back a valid zero-length buffer instead:
+
+static const char EmptyFile[1] = { '\0' };
+
+
+bool
+MappedFile::Open( const char *name )
+{
+	Close( );
+
+#ifdef WIN32
+	file = CreateFileA( name, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+				FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL );
+	if( file == INVALID_HANDLE_VALUE )
+		return false;
+
+	LARGE_INTEGER length;
+	if( ! GetFileSizeEx( file, &length ) )
+	{
+		Close( );
+		return false;
+	}
+	size = (size_t)length.QuadPart;
+
+	if( size == 0 )
+	{
+		data = EmptyFile;
+		return true;
+	}
+
+	mapping = CreateFileMappingA( file, NULL, PAGE_READONLY, 0, 0, NULL );
+	if( mapping == NULL )
+	{
+		Close( );
+		return false;
+	}
+
+	data = (const char *) MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+	if( data == NULL )
+	{
+		Close( );
+		return false;
+	}
+#else
+	fd = open( name, O_RDONLY );
+	if( fd < 0 )
+		return false;
+
+	struct stat st;
+	if( fstat( fd, &st ) != 0 )
+	{
+		Close( );
+		return false;
+	}
+	size = (size_t)st.st_size;
+
+	if( size == 0 )
+	{
+		data = EmptyFile;
+		return true;
+	}
+
+	void *view = mmap( NULL, size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	if( view == MAP_FAILED )
+	{
+		Close( );
+		return false;
+	}
+	madvise( view, size, MADV_SEQUENTIAL );
+	data = (const char *) view;
+#endif
+
+	return true;
+}
+
+
+void
+MappedFile::Close( )
+{
+#ifdef WIN32
+	if( data != NULL  &&  data != EmptyFile )
+		UnmapViewOfFile( data );
+	if( mapping != NULL )
+		CloseHandle( mapping );
+	if( file != INVALID_HANDLE_VALUE )
+		CloseHandle( file );
+	mapping = NULL;
+	file = INVALID_HANDLE_VALUE;
+#else
+	if( data != NULL  &&  data != EmptyFile )
+		munmap( (void *)data, size );
+	if( fd >= 0 )
+		close( fd );
+	fd = -1;
+#endif
+
+	data = NULL;
+	size = 0;
+}
+
+
+const char *
+MappedFile::Data( )
+{
+	return data;
+}
+
+
+size_t
+MappedFile::Size( )
+{
+	return size;
+}
+
+
+bool
+GetFileStamp( const char *name, unsigned long long *size, long long *mtime )
+{
+#ifdef WIN32
+	struct _stat64 st;
+	if( _stat64( name, &st ) != 0 )
+		return false;
+#else
+	struct stat st;
+	if( stat( name, &st ) != 0 )
+		return false;
+#endif
+
+	*size = (unsigned long long)st.st_size;
+	*mtime = (long long)st.st_mtime;
+	return true;
+}
+
+
+// 64-bit FNV-1a, for keying caches on contents rather than dates
+// (pass the last hash back in to hash several things as one):
+
+unsigned long long
+HashBytes( const void *bytes, size_t n, unsigned long long hash )
+{
+	const unsigned char *p = (const unsigned char *)bytes;
+	for( size_t i = 0; i < n; i++ )
+	{
+		hash ^= p[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+
+bool
+HashFile( const char *name, unsigned long long *hash )
+{
+	MappedFile file;
+	if( ! file.Open( name ) )
+		return false;
+
+	*hash = HashBytes( file.Data( ), file.Size( ), *hash );
+	return true;
+}
@@ -0,0 +1,487 @@
+#include "includes/materialtable.h"
+#include "includes/indirectbatch.h"
+#include "includes/mipchain.h"
+#include "includes/texturecache.h"
+#include "includes/threadpool.h"
+
+
+// how each kind of map is stored (the same formats the separate textures used to have):
+
+struct MapFormat
+{
+	GLenum	internalFormat;
+	GLenum	format;
+	GLenum	type;
+	int	components;
+	int	bytes;			// per component
+	const void *	empty;		// what a layer without an image is cleared to (NULL is black)
+};
+
+// a normal map without an image is flat (+z), so it shades the same as the surface's own normal:
+
+static const GLushort FlatNormal[3] = { 32768, 32768, 65535 };
+
+static const struct MapFormat MapFormats[NUM_MATERIAL_MAPS] =
+{
+	{ GL_RGB8,  GL_RGB, GL_UNSIGNED_BYTE,  3, 1, NULL },		// diffuse
+	{ GL_R8,    GL_RED, GL_UNSIGNED_BYTE,  1, 1, NULL },		// roughness
+	{ GL_R8,    GL_RED, GL_UNSIGNED_BYTE,  1, 1, NULL },		// metallic
+	{ GL_RGB16, GL_RGB, GL_UNSIGNED_SHORT, 3, 2, FlatNormal },	// normal
+	{ GL_R16,   GL_RED, GL_UNSIGNED_SHORT, 1, 2, NULL },		// height
+};
+
+
+static struct Texture *
+GetMap( Material *m, int map )
+{
+	switch( map )
+	{
+		case MAP_DIFFUSE:	return m->LoadKd( );
+		case MAP_ROUGH:		return m->LoadNs( );
+		case MAP_METAL:		return m->LoadRefl( );
+		case MAP_NORMAL:	return m->LoadNorm( );
+		default:		return m->LoadHeight( );
+	}
+}
+
+
+// bilinearly resample an image to the array's size:
+
+template <typename T>
+static void
+Resample( const T *src, int sw, int sh, int comps, T *dst, int dw, int dh )
+{
+	for( int y = 0; y < dh; y++ )
+	{
+		float fy = ( (float)y + 0.5f ) * (float)sh / (float)dh - 0.5f;
+		if( fy < 0.f )
+			fy = 0.f;
+		int y0 = (int)fy;
+		int y1 = ( y0 + 1 < sh ) ? y0 + 1 : y0;
+		float ty = fy - (float)y0;
+
+		for( int x = 0; x < dw; x++ )
+		{
+			float fx = ( (float)x + 0.5f ) * (float)sw / (float)dw - 0.5f;
+			if( fx < 0.f )
+				fx = 0.f;
+			int x0 = (int)fx;
+			int x1 = ( x0 + 1 < sw ) ? x0 + 1 : x0;
+			float tx = fx - (float)x0;
+
+			for( int c = 0; c < comps; c++ )
+			{
+				float a = (float)src[ ( y0 * sw + x0 ) * comps + c ];
+				float b = (float)src[ ( y0 * sw + x1 ) * comps + c ];
+				float d = (float)src[ ( y1 * sw + x0 ) * comps + c ];
+				float e = (float)src[ ( y1 * sw + x1 ) * comps + c ];
+				float top = a + tx * ( b - a );
+				float bot = d + tx * ( e - d );
+				dst[ ( y * dw + x ) * comps + c ] = (T)( top + ty * ( bot - top ) + 0.5f );
+			}
+		}
+	}
+}
+
+
+// a map that was only read from its block-compressed cache, decoded to the map's format:
+// (channels the block format doesn't keep, like a BC5 normal's z, are filled with ones)
+
+static const void *
+Decompress( struct Texture *t, const struct MapFormat &f, std::vector<unsigned char> &texels )
+{
+	const struct CompressedImage *bc = t->bc;
+	int comps = ( bc->format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT ) ? 3 : ( bc->format == GL_COMPRESSED_RG_RGTC2 ) ? 2 : 1;
+	size_t count = (size_t)bc->levels[0].width * bc->levels[0].height;
+
+	std::vector<unsigned char> decoded( count * comps );
+	DecompressLevel( bc, 0, &decoded[0], comps );
+
+	texels.resize( count * f.components * f.bytes );
+	for( size_t i = 0; i < count; i++ )
+	{
+		for( int k = 0; k < f.components; k++ )
+		{
+			unsigned char v = ( k < comps ) ? decoded[ i * comps + k ] : 255;
+			if( f.bytes == 2 )
+				( (unsigned short *)&texels[0] )[ i * f.components + k ] = (unsigned short)( v * 257 );
+			else
+				texels[ i * f.components + k ] = v;
+		}
+	}
+
+	return &texels[0];
+}
+
+
+// one material's map, resampled to the array's size if it has to be, and its mip chain
+// the diffuse maps are filtered in linear light, and the normal maps with a box, which can't overshoot
+// this runs on the thread pool, so it only reads the material set
+// returns NULL if the material has no image:
+
+static struct MipChain *
+BuildLayer( MaterialSet *set, int map, int layer, int width, int height, int levels )
+{
+	const struct MapFormat &f = MapFormats[map];
+	struct Texture *t = GetMap( set->obj_mats[layer].m, map );
+	const void *pixels = ( f.bytes == 2 ) ? (const void *)t->img16 : (const void *)t->img;
+
+	std::vector<unsigned char> decompressed;
+	if( pixels == NULL  &&  t->bc != NULL )
+		pixels = Decompress( t, f, decompressed );
+	if( pixels == NULL )
+		return NULL;
+
+	std::vector<unsigned char> resized;
+	if( t->textW != width  ||  t->textH != height )
+	{
+		resized.resize( (size_t)width * height * f.components * f.bytes );
+		if( f.bytes == 2 )
+			Resample( (const unsigned short *)pixels, t->textW, t->textH, f.components, (unsigned short *)&resized[0], width, height );
+		else
+			Resample( (const unsigned char *)pixels, t->textW, t->textH, f.components, &resized[0], width, height );
+		pixels = &resized[0];
+
+#ifdef _DEBUG
+		fprintf( stderr, "Material '%s' map %d resampled from %dx%d to %dx%d\n",
+			set->obj_mats[layer].n.c_str( ), map, t->textW, t->textH, width, height );
+#endif
+	}
+
+	int filter = ( map == MAP_NORMAL ) ? MIP_BOX : MIP_KAISER;
+	return BuildMipChain( pixels, width, height, f.components, f.type, map == MAP_DIFFUSE, filter, levels );
+}
+
+
+// if every material has this map block-compressed, all the same size and format,
+// make the array in that format straight from the compressed mip chains
+// returns false if they don't, so the array has to be made uncompressed:
+
+bool
+MaterialTable::MakeCompressedArray( int map, MaterialSet *set )
+{
+	int numMaterials = (int)set->obj_mats.size( );
+	const struct CompressedImage *first = NULL;
+
+	for( struct mat &matter : set->obj_mats )
+	{
+		const struct CompressedImage *bc = GetMap( matter.m, map )->bc;
+		if( bc == NULL )
+			return false;
+
+		if( first == NULL )
+			first = bc;
+		else if( bc->format != first->format  ||  bc->levels.size( ) != first->levels.size( )  ||
+			 bc->levels[0].width != first->levels[0].width  ||  bc->levels[0].height != first->levels[0].height )
+			return false;
+	}
+
+	if( first == NULL )
+		return false;
+
+	int levels = (int)first->levels.size( );
+	int width = (int)first->levels[0].width;
+	int height = (int)first->levels[0].height;
+
+	glCreateTextures( GL_TEXTURE_2D_ARRAY, 1, &arrays[map] );
+	GLuint tex = arrays[map];
+	glTextureStorage3D( tex, levels, first->format, width, height, numMaterials + 1 );
+	glTextureParameteri( tex, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_LINEAR );
+	glTextureParameteri( tex, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+	glTextureParameteri( tex, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+	glTextureParameteri( tex, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+
+	// all-zero blocks decode to black, for the spare layer (BC5 normals get x = y = 0.5 instead, which is flat)
+	// streamed, each layer is a job that queues its levels on the upload ring
+	// (and frees its material's images, the first one included, so its chain is copied out now):
+
+	std::vector<struct TextureCacheLevel> chain = first->levels;
+	GLenum format = first->format;
+
+	for( int layer = 0; layer <= numMaterials; layer++ )
+	{
+		struct Texture *t = ( layer < numMaterials ) ? GetMap( set->obj_mats[layer].m, map ) : NULL;
+		const struct CompressedImage *bc = ( t != NULL ) ? t->bc : NULL;
+		TextureUploader *up = uploader;
+
+		auto fill = [=]( )
+		{
+			std::vector<unsigned char> black( ( bc == NULL ) ? (size_t)chain[0].bytes : 0, 0 );
+			if( format == GL_COMPRESSED_RG_RGTC2 )
+			{
+				for( size_t b = 0; b < black.size( ); b += 16 )
+					black[b] = black[b + 1] = black[b + 8] = black[b + 9] = 128;	// both endpoints, all indices 0
+			}
+			for( int l = 0; l < levels; l++ )
+			{
+				const struct TextureCacheLevel &lev = chain[l];
+				const unsigned char *blocks = ( bc != NULL ) ? &bc->blocks[ (size_t)bc->levels[l].offset ] : &black[0];
+				if( up != NULL )
+					up->UploadCompressed( tex, l, layer, lev.width, lev.height, format, blocks );
+				else
+					glCompressedTextureSubImage3D( tex, l, 0, 0, layer, lev.width, lev.height, 1, format, (GLsizei)lev.bytes, blocks );
+			}
+			if( t != NULL )
+				FreeTextureImages( t );		// both kinds of upload have copied the blocks by now
+		};
+
+		if( up != NULL )
+			Stream( fill );
+		else
+			fill( );
+	}
+
+#ifdef _DEBUG
+	fprintf( stderr, "Material map %d: %d layers block-compressed, %dx%d, %d levels\n", map, numMaterials + 1, width, height, levels );
+#endif
+
+	return true;
+}
+
+
+// make one array texture, with a layer for each material plus the black one, and fill it:
+
+void
+MaterialTable::MakeArray( int map, MaterialSet *set )
+{
+	if( MakeCompressedArray( map, set ) )
+		return;
+
+	const struct MapFormat &f = MapFormats[map];
+	int numMaterials = (int)set->obj_mats.size( );
+
+
+	// the biggest map of this kind sets the size:
+	// (width and height are taken the same way the separate textures took them)
+
+	int width = 1;
+	int height = 1;
+	for( struct mat &matter : set->obj_mats )
+	{
+		struct Texture *t = GetMap( matter.m, map );
+		if( t->textW > width )
+			width = t->textW;
+		if( t->textH > height )
+			height = t->textH;
+	}
+
+	int levels = NumMipLevels( width, height );
+
+	glCreateTextures( GL_TEXTURE_2D_ARRAY, 1, &arrays[map] );
+	GLuint tex = arrays[map];
+	glTextureStorage3D( tex, levels, f.internalFormat, width, height, numMaterials + 1 );
+	glTextureParameteri( tex, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_LINEAR );
+	glTextureParameteri( tex, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+	glTextureParameteri( tex, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+	glTextureParameteri( tex, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+
+
+	// each layer's mip chain is made on the thread pool, in place of glGenerateTextureMipmap( )
+	// streamed, every layer starts out black (as an unbound texture used to read) or flat, and the
+	// spare layer and any material without an image just stay that way:
+
+	if( uploader != NULL )
+	{
+		for( int l = 0; l < levels; l++ )
+			glClearTexImage( tex, l, f.format, f.type, f.empty );
+
+		TextureUploader *up = uploader;
+		for( int layer = 0; layer < numMaterials; layer++ )
+		{
+			Stream( [=]( )
+			{
+				struct MipChain *chain = BuildLayer( set, map, layer, width, height, levels );
+				FreeTextureImages( GetMap( set->obj_mats[layer].m, map ) );
+				if( chain == NULL )
+					return;
+
+				for( int l = 0; l < levels; l++ )
+				{
+					const struct MipLevel &lev = chain->levels[l];
+					up->Upload( tex, l, layer, lev.width, lev.height, f.format, f.type, f.components * f.bytes,
+						&chain->texels[ (size_t)lev.offset ] );
+				}
+				delete chain;
+			} );
+		}
+		return;
+	}
+
+	std::vector <struct MipChain *> chains( numMaterials, (struct MipChain *)NULL );
+	ThreadPool::Shared( )->ParallelFor( numMaterials, [&]( int layer )
+	{
+		chains[layer] = BuildLayer( set, map, layer, width, height, levels );
+		FreeTextureImages( GetMap( set->obj_mats[layer].m, map ) );
+	} );
+
+	glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+
+	for( int layer = 0; layer <= numMaterials; layer++ )
+	{
+		struct MipChain *chain = ( layer < numMaterials ) ? chains[layer] : NULL;
+		for( int l = 0; l < levels; l++ )
+		{
+			int lw = ( width >> l ) > 0 ? ( width >> l ) : 1;
+			int lh = ( height >> l ) > 0 ? ( height >> l ) : 1;
+
+			// no image (or the spare layer): black, as an unbound texture used to read, or flat
+
+			if( chain == NULL )
+				glClearTexSubImage( tex, l, 0, 0, layer, lw, lh, 1, f.format, f.type, f.empty );
+			else
+				glTextureSubImage3D( tex, l, 0, 0, layer, lw, lh, 1, f.format, f.type, &chain->texels[ (size_t)chain->levels[l].offset ] );
+		}
+		delete chain;
+	}
+
+	glPixelStorei( GL_UNPACK_ALIGNMENT, 4 );
+}
+
+
+// bind the five arrays to their units, for the rest of the pass:
+
+void
+MaterialTable::Bind( )
+{
+	glBindTextures( MATERIAL_TEXTURE_UNIT, NUM_MATERIAL_MAPS, arrays );
+}
+
+
+// make the arrays from the materials' images, once, after they have all been read
+// with an uploader, the arrays are made right away but the images are streamed into them over the next frames
+// each material's images are freed as soon as their layer has been handed to the graphics card
+// returns 0 on success, 1 if there are no materials:
+
+int
+MaterialTable::Build( MaterialSet *set, TextureUploader *_uploader )
+{
+	Finish( );
+	uploader = _uploader;
+
+	names.clear( );
+	present.clear( );
+	for( struct mat &matter : set->obj_mats )
+	{
+		names.push_back( matter.n );
+
+		unsigned int maps = 0;
+		for( int map = 0; map < NUM_MATERIAL_MAPS; map++ )
+		{
+			struct Texture *t = GetMap( matter.m, map );
+			if( t->img != NULL  ||  t->img16 != NULL  ||  t->bc != NULL )
+				maps |= 1u << map;
+		}
+		present.push_back( maps );
+	}
+
+	if( names.size( ) == 0 )
+		return 1;
+
+	glDeleteTextures( NUM_MATERIAL_MAPS, arrays );
+	for( int map = 0; map < NUM_MATERIAL_MAPS; map++ )
+		MakeArray( map, set );
+
+	int numLayers = NumLayers( );
+	std::vector<struct DrawInfo> identity( numLayers );
+	for( int i = 0; i < numLayers; i++ )
+	{
+		identity[i].material = i;
+		identity[i].decodeBitangent = 0;	// a single draw says so in the decode scale's w
+	}
+
+	if( ibuffer != 0 )
+		glDeleteBuffers( 1, &ibuffer );
+	glCreateBuffers( 1, &ibuffer );
+	glNamedBufferStorage( ibuffer, numLayers * sizeof(struct DrawInfo), &identity[0], 0 );
+
+#ifdef _DEBUG
+	fprintf( stderr, "Material table: %d materials\n", (int)names.size( ) );
+#endif
+
+	return 0;
+}
+
+
+// on the GL thread: wait until every streamed image is in its array
+
+void
+MaterialTable::Finish( )
+{
+	if( uploader == NULL )
+		return;
+
+	while( loading > 0  ||  uploader->Busy( ) )
+	{
+		uploader->Pump( true );
+		std::this_thread::yield( );
+	}
+}
+
+
+// the layer for a material name (the black layer if there is no such material):
+
+int
+MaterialTable::Find( const std::string& name )
+{
+	for( int i = 0; i < (int)names.size( ); i++ )
+	{
+		if( names[i] == name )
+			return i;
+	}
+
+	return (int)names.size( );
+}
+
+
+// does this layer's material have an image for this map, or is it left black (or flat)?
+// (so a shader can skip a map that has nothing in it for the whole material)
+
+bool
+MaterialTable::HasMap( int layer, int map )
+{
+	if( layer < 0  ||  layer >= (int)present.size( ) )
+		return false;
+
+	return ( present[layer] & ( 1u << map ) ) != 0;
+}
+
+
+int
+MaterialTable::NumLayers( )
+{
+	return (int)names.size( ) + 1;
+}
+
+
+// a job on the thread pool that streams a layer in, counted so Finish( ) knows when they are all done:
+
+void
+MaterialTable::Stream( std::function<void()> job )
+{
+	loading++;
+	std::atomic<int> *count = &loading;
+	ThreadPool::Shared( )->Submit( [job, count]( )
+	{
+		job( );
+		( *count )--;
+	} );
+}
+
+
+// pick the layer for the next plain VertexBufferObject::Draw( ):
+// objshader.vert looks its material up as drawMaterial[aDrawFirst + gl_DrawIDARB], and gl_DrawIDARB
+// is 0 outside a multi-draw, so with the identity buffer bound the layer can go straight in aDrawFirst
+
+void
+MaterialTable::Select( int layer )
+{
+	glBindBufferBase( GL_SHADER_STORAGE_BUFFER, DRAW_MATERIAL_BINDING, ibuffer );
+	glVertexAttribI1i( DRAW_FIRST_ATTRIB, layer );
+}
+
+
+void
+MaterialTable::Unbind( )
+{
+	glBindTextures( MATERIAL_TEXTURE_UNIT, NUM_MATERIAL_MAPS, NULL );
+}
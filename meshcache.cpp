@@ -0,0 +1,306 @@
+#include "includes/meshcache.h"
+#include "includes/mappedfile.h"
+
+#include <string.h>
+
+
+static const char*
+CacheString(const char* strings, const struct MeshCacheString& s)
+{
+	return strings + s.offset;
+}
+
+
+// map the cache file and make a VertexBufferObject (uploaded with the given VboPacking,
+// into the arena if there is one) for each object in it
+// the points and elements go from the mapping straight into glBufferData( ), so nothing
+// is copied on the cpu side, and the mapping is let go once the last object is uploaded
+// returns 0 on success, 1 if the cache is missing, stale, or damaged:
+
+int
+ReadMeshCache(const char* cacheName, const char* sourceName, unsigned int options, int packing, GeometryArena* arena, std::vector<VertexBufferObject*>* object, std::vector<std::string>* mtllibs)
+{
+	unsigned long long sourceSize;
+	long long sourceTime;
+	if (!GetFileStamp(sourceName, &sourceSize, &sourceTime))
+		return 1;
+
+	MappedFile file;
+	if (!file.Open(cacheName))
+		return 1;
+
+	const char* data = file.Data();
+	size_t size = file.Size();
+
+	if (size < sizeof(struct MeshCacheHeader))
+		return 1;
+
+	struct MeshCacheHeader header;
+	memcpy(&header, data, sizeof(header));
+
+	if (memcmp(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+		header.version != MESH_CACHE_VERSION ||
+		header.pointSize != sizeof(struct Point))
+	{
+		fprintf(stderr, "Mesh cache '%s' is from a different version -- rebuilding it\n", cacheName);
+		return 1;
+	}
+
+	if (header.sourceSize != sourceSize || header.sourceTime != sourceTime || header.options != options)
+	{
+#ifdef _DEBUG
+		fprintf(stderr, "Mesh cache '%s' is out of date -- rebuilding it\n", cacheName);
+#endif
+		return 1;
+	}
+
+
+	// be sure every table and array actually lies inside the file before touching any of them:
+
+	unsigned long long tables = sizeof(struct MeshCacheHeader)
+		+ (unsigned long long)header.numMtllibs * sizeof(struct MeshCacheString)
+		+ (unsigned long long)header.numObjects * sizeof(struct MeshCacheObject);
+
+	if (tables + header.stringBytes > size)
+	{
+		fprintf(stderr, "Mesh cache '%s' is truncated\n", cacheName);
+		return 1;
+	}
+
+	const struct MeshCacheString* libs = (const struct MeshCacheString*)(data + sizeof(struct MeshCacheHeader));
+	const struct MeshCacheObject* objs = (const struct MeshCacheObject*)(libs + header.numMtllibs);
+	const char* strings = data + tables;
+
+	bool valid = true;
+	for (unsigned int i = 0; i < header.numMtllibs; i++)
+	{
+		if ((unsigned long long)libs[i].offset + libs[i].length > header.stringBytes)
+			valid = false;
+	}
+
+	for (unsigned int i = 0; i < header.numObjects; i++)
+	{
+		const struct MeshCacheObject& obj = objs[i];
+		if ((unsigned long long)obj.material.offset + obj.material.length > header.stringBytes)
+			valid = false;
+		if (obj.pointOffset % sizeof(float) != 0 || obj.elementOffset % sizeof(GLuint) != 0)
+			valid = false;
+		if (obj.pointOffset + (unsigned long long)obj.numPoints * sizeof(struct Point) > size)
+			valid = false;
+		if (obj.elementOffset + (unsigned long long)obj.numElements * sizeof(GLuint) > size)
+			valid = false;
+
+		// every index has to be one of this object's points (or a restart), or the draws
+		// would fetch past it, into the arena's other meshes:
+
+		if (valid)
+		{
+			const GLuint* elements = (const GLuint*)(data + obj.elementOffset);
+			for (unsigned int e = 0; e < obj.numElements; e++)
+			{
+				if (elements[e] != VertexBufferObject::RESTART_INDEX && elements[e] >= obj.numPoints)
+				{
+					valid = false;
+					break;
+				}
+			}
+		}
+	}
+
+	if (!valid)
+	{
+		fprintf(stderr, "Mesh cache '%s' is damaged -- rebuilding it\n", cacheName);
+		return 1;
+	}
+
+
+	for (unsigned int i = 0; i < header.numMtllibs; i++)
+	{
+		struct MeshCacheString lib = libs[i];
+		mtllibs->push_back(std::string(CacheString(strings, lib), lib.length));
+	}
+
+	float xmin = 1.e+37f;
+	float ymin = 1.e+37f;
+	float zmin = 1.e+37f;
+	float xmax = -xmin;
+	float ymax = -ymin;
+	float zmax = -zmin;
+
+	for (unsigned int i = 0; i < header.numObjects; i++)
+	{
+		struct MeshCacheObject obj = objs[i];
+
+		VertexBufferObject* vbo = new VertexBufferObject();
+		vbo->SetVerbose(false);
+		vbo->PackVertices(packing);
+		vbo->SetArena(arena);
+		vbo->UseBuffers((GLenum)obj.topology, (int)obj.attributes,
+			(const struct Point*)(data + obj.pointOffset), (int)obj.numPoints,
+			(const GLuint*)(data + obj.elementOffset), (int)obj.numElements);
+
+		std::string material(CacheString(strings, obj.material), obj.material.length);
+		if (material.length() > 0)
+			vbo->SetMaterial((char*)material.c_str());
+
+		object->push_back(vbo);
+
+		if (obj.numPoints > 0)
+		{
+			if (obj.bounds[0] < xmin)	xmin = obj.bounds[0];
+			if (obj.bounds[1] < ymin)	ymin = obj.bounds[1];
+			if (obj.bounds[2] < zmin)	zmin = obj.bounds[2];
+			if (obj.bounds[3] > xmax)	xmax = obj.bounds[3];
+			if (obj.bounds[4] > ymax)	ymax = obj.bounds[4];
+			if (obj.bounds[5] > zmax)	zmax = obj.bounds[5];
+		}
+	}
+
+#ifdef _DEBUG
+
+	fprintf(stderr, "Mesh cache '%s': %u objects, %.1f MB\n", cacheName, header.numObjects, (double)size / (1024. * 1024.));
+	fprintf(stderr, "Obj file range: [%8.3f,%8.3f,%8.3f] -> [%8.3f,%8.3f,%8.3f]\n",
+		xmin, ymin, zmin, xmax, ymax, zmax);
+
+#endif // DEBUG
+
+	return 0;
+}
+
+
+// write what LoadObjFile( ) produced, plus the mtllibs it read, to the cache file
+// this has to happen before the objects are drawn, while their points are still on the cpu side
+// returns 0 on success, 1 on failure (the half-written file is removed):
+
+int
+WriteMeshCache(const char* cacheName, const char* sourceName, unsigned int options, std::vector<VertexBufferObject*>* object, std::vector<std::string>& mtllibs)
+{
+	struct MeshCacheHeader header = { };
+	memcpy(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic));
+	header.version = MESH_CACHE_VERSION;
+	header.pointSize = sizeof(struct Point);
+	header.options = options;
+	if (!GetFileStamp(sourceName, &header.sourceSize, &header.sourceTime))
+		return 1;
+
+	header.numMtllibs = (unsigned int)mtllibs.size();
+	header.numObjects = (unsigned int)object->size();
+
+
+	// the string table:
+
+	std::string strings;
+	std::vector<struct MeshCacheString> libs(header.numMtllibs);
+	for (unsigned int i = 0; i < header.numMtllibs; i++)
+	{
+		libs[i].offset = (unsigned int)strings.length();
+		libs[i].length = (unsigned int)mtllibs[i].length();
+		strings.append(mtllibs[i]);
+	}
+
+	std::vector<struct MeshCacheObject> objs(header.numObjects);
+	for (unsigned int i = 0; i < header.numObjects; i++)
+	{
+		std::string material = (*object)[i]->GetMaterial();
+		objs[i].material.offset = (unsigned int)strings.length();
+		objs[i].material.length = (unsigned int)material.length();
+		strings.append(material);
+	}
+
+	header.stringBytes = strings.length();
+
+
+	// where each object's arrays will land:
+
+	unsigned long long offset = sizeof(struct MeshCacheHeader)
+		+ header.numMtllibs * sizeof(struct MeshCacheString)
+		+ header.numObjects * sizeof(struct MeshCacheObject)
+		+ header.stringBytes;
+	unsigned long long pointStart = (offset + 15) & ~15ULL;
+
+	offset = pointStart;
+	for (unsigned int i = 0; i < header.numObjects; i++)
+	{
+		VertexBufferObject* vbo = (*object)[i];
+		const std::vector<struct Point>& points = vbo->GetPoints();
+
+		objs[i].topology = vbo->GetTopology();
+		objs[i].attributes = vbo->GetAttributes();
+		objs[i].numPoints = (unsigned int)points.size();
+		objs[i].pointOffset = offset;
+		offset += points.size() * sizeof(struct Point);
+
+		float* b = objs[i].bounds;
+		b[0] = b[1] = b[2] = 1.e+37f;
+		b[3] = b[4] = b[5] = -1.e+37f;
+		for (const struct Point& p : points)
+		{
+			if (p.x < b[0])	b[0] = p.x;
+			if (p.y < b[1])	b[1] = p.y;
+			if (p.z < b[2])	b[2] = p.z;
+			if (p.x > b[3])	b[3] = p.x;
+			if (p.y > b[4])	b[4] = p.y;
+			if (p.z > b[5])	b[5] = p.z;
+		}
+	}
+
+	for (unsigned int i = 0; i < header.numObjects; i++)
+	{
+		objs[i].numElements = (unsigned int)(*object)[i]->GetElements().size();
+		objs[i].elementOffset = offset;
+		offset += objs[i].numElements * sizeof(GLuint);
+	}
+
+
+	FILE* fp;
+	if (fopen_s(&fp, cacheName, "wb") != 0)
+	{
+		fprintf(stderr, "Cannot write mesh cache '%s'\n", cacheName);
+		return 1;
+	}
+
+	bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+	if (header.numMtllibs > 0)
+		ok = ok && fwrite(&libs[0], sizeof(struct MeshCacheString), libs.size(), fp) == libs.size();
+	if (header.numObjects > 0)
+		ok = ok && fwrite(&objs[0], sizeof(struct MeshCacheObject), objs.size(), fp) == objs.size();
+	if (header.stringBytes > 0)
+		ok = ok && fwrite(strings.data(), 1, strings.length(), fp) == strings.length();
+
+	const char zeros[16] = { };
+	unsigned long long pad = pointStart - (sizeof(struct MeshCacheHeader)
+		+ header.numMtllibs * sizeof(struct MeshCacheString)
+		+ header.numObjects * sizeof(struct MeshCacheObject)
+		+ header.stringBytes);
+	if (pad > 0)
+		ok = ok && fwrite(zeros, 1, (size_t)pad, fp) == pad;
+
+	for (VertexBufferObject* vbo : *object)
+	{
+		const std::vector<struct Point>& points = vbo->GetPoints();
+		if (points.size() > 0)
+			ok = ok && fwrite(&points[0], sizeof(struct Point), points.size(), fp) == points.size();
+	}
+
+	for (VertexBufferObject* vbo : *object)
+	{
+		const std::vector<GLuint>& elements = vbo->GetElements();
+		if (elements.size() > 0)
+			ok = ok && fwrite(&elements[0], sizeof(GLuint), elements.size(), fp) == elements.size();
+	}
+
+	ok = (fclose(fp) == 0) && ok;
+
+	if (!ok)
+	{
+		fprintf(stderr, "Cannot write mesh cache '%s'\n", cacheName);
+		remove(cacheName);
+		return 1;
+	}
+
+#ifdef _DEBUG
+	fprintf(stderr, "Wrote mesh cache '%s': %u objects, %.1f MB\n", cacheName, header.numObjects, (double)offset / (1024. * 1024.));
+#endif
+
+	return 0;
+}
@@ -0,0 +1,330 @@
+#include "includes/meshoptimize.h"
+#include "includes/loadobjfile.h"
+#include "includes/threadpool.h"
+
+#include <algorithm>
+
+
+// simulate a FIFO post-transform cache over the element list:
+
+struct VertexCacheStats
+AnalyzeVertexCache(const std::vector<GLuint>& elements, int numPoints, int cacheSize)
+{
+	struct VertexCacheStats stats = { 0.f, 0.f };
+
+	int numTriangles = (int)elements.size() / 3;
+	if (numTriangles == 0 || numPoints == 0)
+		return stats;
+
+	std::vector<int> enteredAt(numPoints, -cacheSize - 1);	// when each vertex last went into the cache
+	std::vector<bool> used(numPoints, false);
+	int misses = 0;
+	int unique = 0;
+
+	for (int i = 0; i < 3 * numTriangles; i++)
+	{
+		GLuint v = elements[i];
+		if (v >= (GLuint)numPoints)
+			continue;
+
+		if (!used[v])
+		{
+			used[v] = true;
+			unique++;
+		}
+
+		// FIFO: a hit doesn't refresh the entry, and an entry falls out cacheSize misses later
+
+		if (misses - enteredAt[v] > cacheSize)
+		{
+			enteredAt[v] = misses;
+			misses++;
+		}
+	}
+
+	stats.acmr = (float)misses / (float)numTriangles;
+	stats.atvr = (float)misses / (float)unique;
+	return stats;
+}
+
+
+// the Tipsify pass, which also hands back where each dead-end restart happened
+// (those runs are the clusters the overdraw pass sorts):
+
+static void
+Tipsify(const std::vector<GLuint>& elements, int numPoints, int cacheSize,
+	std::vector<GLuint>& out, std::vector<int>& clusters)
+{
+	int numTriangles = (int)elements.size() / 3;
+
+
+	// vertex -> triangle adjacency, as offsets into one list:
+
+	std::vector<int> live(numPoints, 0);
+	for (int i = 0; i < 3 * numTriangles; i++)
+		live[elements[i]]++;
+
+	std::vector<int> first(numPoints + 1, 0);
+	for (int v = 0; v < numPoints; v++)
+		first[v + 1] = first[v] + live[v];
+
+	std::vector<int> adjacency(3 * numTriangles);
+	std::vector<int> fill(first.begin(), first.end() - 1);
+	for (int t = 0; t < numTriangles; t++)
+	{
+		for (int c = 0; c < 3; c++)
+			adjacency[fill[elements[3 * t + c]]++] = t;
+	}
+
+	std::vector<int> cacheTime(numPoints, 0);
+	std::vector<bool> emitted(numTriangles, false);
+	std::vector<GLuint> deadEnd;
+	std::vector<GLuint> candidates;
+
+	out.clear();
+	out.reserve(3 * numTriangles);
+	clusters.clear();
+	clusters.push_back(0);
+
+	int fanning = 0;
+	int timeStamp = cacheSize + 1;
+	int cursor = 1;
+
+	while (fanning >= 0)
+	{
+		candidates.clear();
+
+		for (int a = first[fanning]; a < first[fanning + 1]; a++)
+		{
+			int t = adjacency[a];
+			if (emitted[t])
+				continue;
+
+			for (int c = 0; c < 3; c++)
+			{
+				GLuint v = elements[3 * t + c];
+				out.push_back(v);
+				deadEnd.push_back(v);
+				candidates.push_back(v);
+				live[v]--;
+				if (timeStamp - cacheTime[v] > cacheSize)
+				{
+					cacheTime[v] = timeStamp;
+					timeStamp++;
+				}
+			}
+			emitted[t] = true;
+		}
+
+
+		// next fanning vertex: the candidate that will still be in the cache once all
+		// its remaining triangles are emitted, and that went in the earliest
+
+		int best = -1;
+		int bestPriority = -1;
+		for (GLuint v : candidates)
+		{
+			if (live[v] <= 0)
+				continue;
+
+			int priority = 0;
+			if (timeStamp - cacheTime[v] + 2 * live[v] <= cacheSize)
+				priority = timeStamp - cacheTime[v];
+
+			if (priority > bestPriority)
+			{
+				bestPriority = priority;
+				best = (int)v;
+			}
+		}
+
+		if (best >= 0)
+		{
+			fanning = best;
+			continue;
+		}
+
+
+		// dead end: back up through recently emitted vertices, then fall back to the next unfinished one
+
+		while (!deadEnd.empty())
+		{
+			GLuint v = deadEnd.back();
+			deadEnd.pop_back();
+			if (live[v] > 0)
+			{
+				best = (int)v;
+				break;
+			}
+		}
+
+		while (best < 0 && cursor < numPoints)
+		{
+			if (live[cursor] > 0)
+				best = cursor;
+			cursor++;
+		}
+
+		if (best >= 0 && (int)out.size() > clusters.back())
+			clusters.push_back((int)out.size());
+
+		fanning = best;
+	}
+
+	if (clusters.back() == (int)out.size())
+		clusters.pop_back();
+}
+
+
+// reorder the triangles in place, keeping the exact same set of them:
+
+void
+OptimizeTriangleOrder(std::vector<GLuint>& elements, const std::vector<struct Point>& points, int cacheSize)
+{
+	int numPoints = (int)points.size();
+	int numTriangles = (int)elements.size() / 3;
+	if (numTriangles < 2 || 3 * numTriangles != (int)elements.size())
+		return;
+
+	for (GLuint v : elements)
+	{
+		if (v >= (GLuint)numPoints)
+			return;		// restart indices or garbage -- leave it alone
+	}
+
+	std::vector<GLuint> ordered;
+	std::vector<int> clusters;
+	Tipsify(elements, numPoints, cacheSize, ordered, clusters);
+
+
+	// sort the clusters so the ones facing away from the mesh's middle come first --
+	// from any viewpoint they are the likeliest to cover what is behind them:
+
+	float center[3] = { 0.f, 0.f, 0.f };
+	for (const struct Point& p : points)
+	{
+		center[0] += p.x;
+		center[1] += p.y;
+		center[2] += p.z;
+	}
+	center[0] /= (float)numPoints;
+	center[1] /= (float)numPoints;
+	center[2] /= (float)numPoints;
+
+	int numClusters = (int)clusters.size();
+	std::vector<float> facing(numClusters);
+	std::vector<int> order(numClusters);
+
+	for (int c = 0; c < numClusters; c++)
+	{
+		int begin = clusters[c];
+		int end = (c + 1 < numClusters) ? clusters[c + 1] : (int)ordered.size();
+
+		float normal[3] = { 0.f, 0.f, 0.f };		// area-weighted
+		float middle[3] = { 0.f, 0.f, 0.f };
+		float area = 0.f;
+
+		for (int i = begin; i < end; i += 3)
+		{
+			const struct Point* p0 = &points[ordered[i]];
+			const struct Point* p1 = &points[ordered[i + 1]];
+			const struct Point* p2 = &points[ordered[i + 2]];
+
+			float e1[3] = { p1->x - p0->x, p1->y - p0->y, p1->z - p0->z };
+			float e2[3] = { p2->x - p0->x, p2->y - p0->y, p2->z - p0->z };
+			float n[3];
+			Cross(e1, e2, n);
+			float a = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+
+			normal[0] += n[0];
+			normal[1] += n[1];
+			normal[2] += n[2];
+
+			middle[0] += a * (p0->x + p1->x + p2->x) / 3.f;
+			middle[1] += a * (p0->y + p1->y + p2->y) / 3.f;
+			middle[2] += a * (p0->z + p1->z + p2->z) / 3.f;
+			area += a;
+		}
+
+		facing[c] = 0.f;
+		if (area > 0.f)
+		{
+			float d[3] = { middle[0] / area - center[0], middle[1] / area - center[1], middle[2] / area - center[2] };
+			Unit(normal, normal);
+			facing[c] = d[0] * normal[0] + d[1] * normal[1] + d[2] * normal[2];
+		}
+		order[c] = c;
+	}
+
+	std::stable_sort(order.begin(), order.end(), [&facing](int c0, int c1)
+	{
+		return facing[c0] > facing[c1];
+	});
+
+	elements.clear();
+	for (int c : order)
+	{
+		int begin = clusters[c];
+		int end = (c + 1 < numClusters) ? clusters[c + 1] : (int)ordered.size();
+		elements.insert(elements.end(), ordered.begin() + begin, ordered.begin() + end);
+	}
+}
+
+
+// renumber the points in the order the elements first use them, so the vertex fetches
+// walk forward through memory (points nothing uses are dropped):
+
+void
+OptimizeVertexFetch(std::vector<struct Point>& points, std::vector<GLuint>& elements)
+{
+	const GLuint UNUSED = ~0;
+	int numPoints = (int)points.size();
+
+	std::vector<GLuint> remap(numPoints, UNUSED);
+	std::vector<struct Point> fetched;
+	fetched.reserve(numPoints);
+
+	for (GLuint& v : elements)
+	{
+		if (v >= (GLuint)numPoints)
+			continue;
+
+		if (remap[v] == UNUSED)
+		{
+			remap[v] = (GLuint)fetched.size();
+			fetched.push_back(points[v]);
+		}
+		v = remap[v];
+	}
+
+	points.swap(fetched);
+}
+
+
+// optimize every object on the shared thread pool, then (if asked) list what it did:
+
+void
+OptimizeMeshes(std::vector<VertexBufferObject*>* object, bool report)
+{
+	int numObjects = (int)object->size();
+	std::vector<struct VertexCacheStats> before(numObjects);
+	std::vector<struct VertexCacheStats> after(numObjects);
+	std::vector<char> done(numObjects);
+
+	ThreadPool::Shared()->ParallelFor(numObjects, [&](int i)
+	{
+		done[i] = (*object)[i]->Optimize(MESH_CACHE_SIZE, &before[i], &after[i]);
+	});
+
+	if (!report)
+		return;
+
+	for (int i = 0; i < numObjects; i++)
+	{
+		if (!done[i])
+			continue;
+
+		fprintf(stderr, "Mesh %3d %-24s ACMR %5.3f -> %5.3f   ATVR %5.3f -> %5.3f\n", i,
+			(*object)[i]->GetMaterial().c_str(), before[i].acmr, after[i].acmr, before[i].atvr, after[i].atvr);
+	}
+}
@@ -0,0 +1,553 @@
+#include "includes/mipchain.h"
+#include "includes/hdrimage.h"
+#include "includes/mappedfile.h"
+#include "includes/threadpool.h"
+
+#include <math.h>
+#include <string.h>
+#include <functional>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE__)
+#include <xmmintrin.h>
+#define MIP_SSE
+#endif
+
+
+#define ROWS_PER_JOB	16		// output rows filtered by each thread pool job
+#define KAISER_LOBES	3.f		// half-width of the Kaiser filter, in new texels
+#define KAISER_ALPHA	4.f
+
+
+int
+NumMipLevels(int width, int height)
+{
+	int biggest = (width > height) ? width : height;
+	return 1 + (int)floor(log2((double)biggest));
+}
+
+
+// ---------------------------------------------------------------------------------------------
+// sRGB <-> linear, for 8-bit colour maps
+
+struct SrgbTables
+{
+	float	toLinear[256];
+	float	threshold[255];		// the linear value halfway (in sRGB) between code i and i+1
+
+	SrgbTables()
+	{
+		for (int i = 0; i < 256; i++)
+			toLinear[i] = Decode((float)i / 255.f);
+		for (int i = 0; i < 255; i++)
+			threshold[i] = Decode(((float)i + 0.5f) / 255.f);
+	};
+
+	static float Decode(float s)
+	{
+		return (s <= 0.04045f) ? s / 12.92f : powf((s + 0.055f) / 1.055f, 2.4f);
+	};
+};
+
+
+static const struct SrgbTables&
+Srgb()
+{
+	static const struct SrgbTables tables;
+	return tables;
+}
+
+
+// the nearest sRGB code to a linear value (a binary search of the thresholds, so it rounds exactly):
+
+static unsigned char
+EncodeSrgb(const struct SrgbTables& t, float v)
+{
+	int lo = 0;
+	int hi = 255;
+	while (lo < hi)
+	{
+		int mid = (lo + hi) / 2;
+		if (v < t.threshold[mid])
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	return (unsigned char)lo;
+}
+
+
+// bytes in one texel (a shared-exponent texel is always rgb, packed in one int):
+
+static size_t
+TexelBytes(GLenum type, int comps)
+{
+	if (type == GL_UNSIGNED_INT_5_9_9_9_REV)
+		return 4;
+	return comps * ((type == GL_FLOAT) ? 4 : (type == GL_UNSIGNED_SHORT || type == GL_HALF_FLOAT) ? 2 : 1);
+}
+
+
+// an image as floats (0. - 1. for the integer types), linear if it is sRGB:
+
+static void
+ToFloat(const void* pixels, size_t count, int comps, GLenum type, bool srgb, float* out)
+{
+	if (type == GL_UNSIGNED_INT_5_9_9_9_REV)
+	{
+		for (size_t i = 0; i < count; i++)
+			Rgb9e5ToFloat(((const unsigned int*)pixels)[i], out + i * 3);
+		return;
+	}
+
+	const struct SrgbTables& t = Srgb();
+	for (size_t i = 0; i < count * comps; i++)
+	{
+		if (type == GL_FLOAT)
+			out[i] = ((const float*)pixels)[i];
+		else if (type == GL_HALF_FLOAT)
+			out[i] = HalfToFloat(((const unsigned short*)pixels)[i]);
+		else if (type == GL_UNSIGNED_SHORT)
+			out[i] = (float)((const unsigned short*)pixels)[i] / 65535.f;
+		else if (srgb && (int)(i % comps) < 3)
+			out[i] = t.toLinear[((const unsigned char*)pixels)[i]];
+		else
+			out[i] = (float)((const unsigned char*)pixels)[i] / 255.f;
+	}
+}
+
+
+// and back, clamped, since the Kaiser filter can overshoot
+// (the float types are only kept from going negative -- they are radiance, which can't be):
+
+static void
+FromFloat(const float* in, size_t count, int comps, GLenum type, bool srgb, void* pixels)
+{
+	if (type == GL_UNSIGNED_INT_5_9_9_9_REV)
+	{
+		for (size_t i = 0; i < count; i++)
+			((unsigned int*)pixels)[i] = FloatToRgb9e5(in + i * 3);
+		return;
+	}
+
+	const struct SrgbTables& t = Srgb();
+	for (size_t i = 0; i < count * comps; i++)
+	{
+		float v = (in[i] > 0.f) ? in[i] : 0.f;
+		if (type == GL_FLOAT)
+		{
+			((float*)pixels)[i] = v;
+			continue;
+		}
+		if (type == GL_HALF_FLOAT)
+		{
+			((unsigned short*)pixels)[i] = FloatToHalf(v);
+			continue;
+		}
+
+		if (v > 1.f)
+			v = 1.f;
+		if (type == GL_UNSIGNED_SHORT)
+			((unsigned short*)pixels)[i] = (unsigned short)(v * 65535.f + 0.5f);
+		else if (srgb && (int)(i % comps) < 3)
+			((unsigned char*)pixels)[i] = EncodeSrgb(t, v);
+		else
+			((unsigned char*)pixels)[i] = (unsigned char)(v * 255.f + 0.5f);
+	}
+}
+
+
+// ---------------------------------------------------------------------------------------------
+// the filter, separated into a list of taps for each new texel along one axis
+// (every new texel gets the same number of taps; unused ones have weight 0.)
+
+struct Taps
+{
+	int			numTaps;
+	std::vector <int>	index;			// [ out * numTaps + k ], clamped to the edge
+	std::vector <float>	weight;
+};
+
+
+static float
+BesselI0(float x)
+{
+	float sum = 1.f;
+	float term = 1.f;
+	for (int k = 1; k < 20; k++)
+	{
+		term *= (x / (2.f * k)) * (x / (2.f * k));
+		sum += term;
+	}
+	return sum;
+}
+
+
+static float
+Kaiser(float x)
+{
+	if (fabsf(x) >= KAISER_LOBES)
+		return 0.f;
+
+	float sinc = (x == 0.f) ? 1.f : sinf((float)M_PI * x) / ((float)M_PI * x);
+	float r = x / KAISER_LOBES;
+	return sinc * BesselI0(KAISER_ALPHA * sqrtf(1.f - r * r)) / BesselI0(KAISER_ALPHA);
+}
+
+
+static void
+MakeTaps(int in, int out, int filter, struct Taps* taps)
+{
+	float scale = (float)in / (float)out;
+	float radius = (filter == MIP_KAISER) ? KAISER_LOBES * scale : 0.5f * scale;
+	if (in == out)
+		radius = 0.5f;
+
+	taps->numTaps = (int)ceilf(2.f * radius) + 1;
+	taps->index.assign((size_t)out * taps->numTaps, 0);
+	taps->weight.assign((size_t)out * taps->numTaps, 0.f);
+
+	for (int o = 0; o < out; o++)
+	{
+		float center = ((float)o + 0.5f) * scale;		// texel i covers [ i, i+1 )
+		int first = (int)floorf(center - radius);
+		float total = 0.f;
+
+		for (int k = 0; k < taps->numTaps; k++)
+		{
+			int i = first + k;
+			float w;
+			if (filter == MIP_KAISER && in != out)
+			{
+				w = Kaiser(((float)i + 0.5f - center) / scale);
+			}
+			else
+			{
+				float lo = (float)i > center - radius ? (float)i : center - radius;
+				float hi = (float)(i + 1) < center + radius ? (float)(i + 1) : center + radius;
+				w = (hi > lo) ? hi - lo : 0.f;
+			}
+
+			if (i < 0)		i = 0;
+			if (i >= in)		i = in - 1;
+			taps->index[o * taps->numTaps + k] = i;
+			taps->weight[o * taps->numTaps + k] = w;
+			total += w;
+		}
+
+		for (int k = 0; k < taps->numTaps; k++)
+			taps->weight[o * taps->numTaps + k] /= total;
+	}
+}
+
+
+// out[ ] += w * in[ ], across a whole row:
+
+static void
+AccumulateRow(float* out, const float* in, float w, int n)
+{
+	int i = 0;
+#ifdef MIP_SSE
+	__m128 ww = _mm_set1_ps(w);
+	for (; i + 4 <= n; i += 4)
+		_mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), _mm_mul_ps(_mm_loadu_ps(in + i), ww)));
+#endif
+	for (; i < n; i++)
+		out[i] += w * in[i];
+}
+
+
+// where the filter gets the level above's rows, as floats
+// (a pointer into the level, or the row converted into the scratch row it is given):
+
+typedef std::function<const float*(int, float*)>	RowSource;
+
+
+// filter one level down to the next: down the columns into a row, then along the row
+// bands of rows are done in parallel, each with its own scratch rows:
+
+static void
+FilterLevel(const RowSource& in, int width, int height, int comps, int filter, float* out, int ow, int oh)
+{
+	struct Taps across, down;
+	MakeTaps(width, ow, filter, &across);
+	MakeTaps(height, oh, filter, &down);
+
+	int rowFloats = width * comps;
+	int numJobs = (oh + ROWS_PER_JOB - 1) / ROWS_PER_JOB;
+
+	ThreadPool::Shared()->ParallelFor(numJobs, [&](int job)
+	{
+		std::vector<float> row(rowFloats);
+		std::vector<float> scratch(rowFloats);
+		int last = (job + 1) * ROWS_PER_JOB < oh ? (job + 1) * ROWS_PER_JOB : oh;
+
+		for (int y = job * ROWS_PER_JOB; y < last; y++)
+		{
+			memset(&row[0], 0, rowFloats * sizeof(float));
+			for (int k = 0; k < down.numTaps; k++)
+			{
+				float w = down.weight[y * down.numTaps + k];
+				if (w != 0.f)
+					AccumulateRow(&row[0], in(down.index[y * down.numTaps + k], &scratch[0]), w, rowFloats);
+			}
+
+			float* dst = out + (size_t)y * ow * comps;
+			for (int x = 0; x < ow; x++)
+			{
+				const int* index = &across.index[x * across.numTaps];
+				const float* weight = &across.weight[x * across.numTaps];
+				for (int c = 0; c < comps; c++)
+				{
+					float sum = 0.f;
+					for (int k = 0; k < across.numTaps; k++)
+						sum += weight[k] * row[index[k] * comps + c];
+					dst[x * comps + c] = sum;
+				}
+			}
+		}
+	});
+}
+
+
+// ---------------------------------------------------------------------------------------------
+
+// make an image's mip chain, numLevels deep (0 means all the way to 1x1)
+// level 0 is the image itself; the rest are stored in the same type:
+
+struct MipChain*
+BuildMipChain(const void* pixels, int width, int height, int comps, GLenum type, bool srgb, int filter, int numLevels)
+{
+	if (pixels == NULL || width <= 0 || height <= 0 || comps < 1 || comps > 4)
+		return NULL;
+	if (type == GL_UNSIGNED_INT_5_9_9_9_REV && comps != 3)
+		return NULL;
+
+	int most = NumMipLevels(width, height);
+	if (numLevels <= 0 || numLevels > most)
+		numLevels = most;
+
+	struct MipChain* chain = new struct MipChain;
+	chain->type = type;
+	chain->components = comps;
+	chain->srgb = srgb && type == GL_UNSIGNED_BYTE;
+	chain->filter = filter;
+
+	size_t texelBytes = TexelBytes(type, comps);
+	size_t total = 0;
+	int w = width;
+	int h = height;
+	for (int l = 0; l < numLevels; l++)
+	{
+		struct MipLevel lev;
+		lev.width = w;
+		lev.height = h;
+		lev.offset = total;
+		lev.bytes = (unsigned long long)w * h * texelBytes;
+		chain->levels.push_back(lev);
+		total += (size_t)lev.bytes;
+
+		w = (w > 1) ? w / 2 : 1;
+		h = (h > 1) ? h / 2 : 1;
+	}
+
+	chain->texels.resize(total);
+	memcpy(&chain->texels[0], pixels, (size_t)chain->levels[0].bytes);
+
+	// level 0 is converted a row at a time as the filter reads it (or read in place, if it is floats),
+	// so there is never a float copy of the whole image -- the biggest thing a chain would otherwise need;
+	// every level after that is small enough to keep in floats for the next:
+
+	const unsigned char* image = (const unsigned char*)pixels;
+	size_t imageRowBytes = (size_t)width * texelBytes;
+	bool srgbImage = chain->srgb;
+	RowSource fromImage = [&](int y, float* scratch) -> const float*
+	{
+		const unsigned char* row = image + (size_t)y * imageRowBytes;
+		if (type == GL_FLOAT)
+			return (const float*)row;
+		ToFloat(row, (size_t)width, comps, type, srgbImage, scratch);
+		return scratch;
+	};
+
+	std::vector<float> level;
+	std::vector<float> next;
+	size_t levelRowFloats = 0;
+	RowSource fromLevel = [&](int y, float*) -> const float*
+	{
+		return &level[(size_t)y * levelRowFloats];
+	};
+
+	for (int l = 1; l < numLevels; l++)
+	{
+		const struct MipLevel& above = chain->levels[l - 1];
+		const struct MipLevel& lev = chain->levels[l];
+
+		levelRowFloats = (size_t)above.width * comps;
+		next.resize((size_t)lev.width * lev.height * comps);
+		FilterLevel((l == 1) ? fromImage : fromLevel, above.width, above.height, comps, filter, &next[0], lev.width, lev.height);
+		FromFloat(&next[0], (size_t)lev.width * lev.height, comps, type, chain->srgb, &chain->texels[(size_t)lev.offset]);
+		level.swap(next);
+	}
+
+	return chain;
+}
+
+
+// one level of a chain as floats (as the filter sees it: 0. - 1. for the integer types, linear if sRGB):
+
+void
+MipLevelFloats(const struct MipChain* chain, int l, std::vector<float>& out)
+{
+	const struct MipLevel& lev = chain->levels[l];
+	size_t count = (size_t)lev.width * lev.height;
+	out.resize(count * chain->components);
+	ToFloat(&chain->texels[(size_t)lev.offset], count, chain->components, chain->type, chain->srgb, &out[0]);
+}
+
+
+// a 2D texture with immutable storage for the whole chain, every level filled:
+
+GLuint
+CreateMipTexture(const struct MipChain* chain, GLenum internalFormat)
+{
+	static const GLenum formats[4] = { GL_RED, GL_RG, GL_RGB, GL_RGBA };
+	GLenum format = formats[chain->components - 1];
+	int numLevels = (int)chain->levels.size();
+
+	GLuint tex;
+	glCreateTextures(GL_TEXTURE_2D, 1, &tex);
+	glTextureStorage2D(tex, numLevels, internalFormat, chain->levels[0].width, chain->levels[0].height);
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (int l = 0; l < numLevels; l++)
+	{
+		const struct MipLevel& lev = chain->levels[l];
+		glTextureSubImage2D(tex, l, 0, 0, lev.width, lev.height, format, chain->type, &chain->texels[(size_t)lev.offset]);
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+	glTextureParameteri(tex, GL_TEXTURE_MIN_FILTER, (numLevels > 1) ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+	glTextureParameteri(tex, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+	return tex;
+}
+
+
+// read <source>.mip, if it was made from this version of the source, the same way
+// returns 0 on success, 1 if the file is missing, stale, or damaged:
+
+int
+ReadMipChain(const char* sourceName, GLenum type, bool srgb, int filter, struct MipChain* chain)
+{
+	unsigned long long sourceSize;
+	long long sourceTime;
+	if (!GetFileStamp(sourceName, &sourceSize, &sourceTime))
+		return 1;
+
+	std::string chainName(sourceName);
+	chainName.append(MIP_CHAIN_SUFFIX);
+
+	MappedFile file;
+	if (!file.Open(chainName.c_str()))
+		return 1;
+
+	const char* data = file.Data();
+	size_t size = file.Size();
+
+	if (size < sizeof(struct MipChainHeader))
+		return 1;
+
+	struct MipChainHeader header;
+	memcpy(&header, data, sizeof(header));
+
+	if (memcmp(header.magic, MIP_CHAIN_MAGIC, sizeof(header.magic)) != 0 ||
+		header.version != MIP_CHAIN_VERSION ||
+		header.type != type || header.srgb != (unsigned int)(srgb && type == GL_UNSIGNED_BYTE) || header.filter != (unsigned int)filter ||
+		header.sourceSize != sourceSize || header.sourceTime != sourceTime)
+	{
+#ifdef _DEBUG
+		fprintf(stderr, "Mip chain '%s' is out of date -- rebuilding it\n", chainName.c_str());
+#endif
+		return 1;
+	}
+
+	unsigned long long start = sizeof(struct MipChainHeader) + (unsigned long long)header.numLevels * sizeof(struct MipLevel);
+	if (header.numLevels == 0 || header.components < 1 || header.components > 4 || start > size)
+		return 1;
+	if (type == GL_UNSIGNED_INT_5_9_9_9_REV && header.components != 3)
+		return 1;
+
+	std::vector<struct MipLevel> levels(header.numLevels);
+	memcpy(&levels[0], data + sizeof(struct MipChainHeader), header.numLevels * sizeof(struct MipLevel));
+
+	unsigned long long total = 0;
+	for (const struct MipLevel& lev : levels)
+	{
+		if (lev.bytes != (unsigned long long)lev.width * lev.height * TexelBytes(type, (int)header.components) || lev.offset != total)
+		{
+			fprintf(stderr, "Mip chain '%s' is damaged -- rebuilding it\n", chainName.c_str());
+			return 1;
+		}
+		total += lev.bytes;
+	}
+
+	if (start + total > size)
+	{
+		fprintf(stderr, "Mip chain '%s' is truncated\n", chainName.c_str());
+		return 1;
+	}
+
+	chain->type = type;
+	chain->components = (int)header.components;
+	chain->srgb = header.srgb != 0;
+	chain->filter = filter;
+	chain->levels.swap(levels);
+	chain->texels.assign(data + start, data + start + total);
+	return 0;
+}
+
+
+// write <source>.mip
+// returns 0 on success, 1 on failure (the half-written file is removed):
+
+int
+WriteMipChain(const char* sourceName, const struct MipChain* chain)
+{
+	struct MipChainHeader header = { };
+	memcpy(header.magic, MIP_CHAIN_MAGIC, sizeof(header.magic));
+	header.version = MIP_CHAIN_VERSION;
+	header.type = chain->type;
+	header.components = chain->components;
+	header.srgb = chain->srgb ? 1 : 0;
+	header.filter = chain->filter;
+	header.numLevels = (unsigned int)chain->levels.size();
+	if (!GetFileStamp(sourceName, &header.sourceSize, &header.sourceTime))
+		return 1;
+
+	std::string chainName(sourceName);
+	chainName.append(MIP_CHAIN_SUFFIX);
+
+	FILE* fp;
+	if (fopen_s(&fp, chainName.c_str(), "wb") != 0)
+	{
+		fprintf(stderr, "Cannot write mip chain '%s'\n", chainName.c_str());
+		return 1;
+	}
+
+	bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+	if (header.numLevels > 0)
+		ok = ok && fwrite(&chain->levels[0], sizeof(struct MipLevel), header.numLevels, fp) == header.numLevels;
+	if (chain->texels.size() > 0)
+		ok = ok && fwrite(&chain->texels[0], 1, chain->texels.size(), fp) == chain->texels.size();
+
+	ok = (fclose(fp) == 0) && ok;
+
+	if (!ok)
+	{
+		fprintf(stderr, "Cannot write mip chain '%s'\n", chainName.c_str());
+		remove(chainName.c_str());
+		return 1;
+	}
+
+	return 0;
+}
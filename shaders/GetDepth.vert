@@ -1,14 +1,14 @@
 #version 450
 layout (location = 0) in vec3 aPos;
+layout (location = 5) in vec4 aDecodeScale;	// packed positions, see objshader.vert
+layout (location = 6) in vec3 aDecodeBias;
 
-uniform mat4 uLightSpaceMatrix;
 uniform mat4 uModel;
 
-layout (location = 0) out float vDepth;
+// the light transforms happen in GetDepth.geom, once per light layer
 
 void
 main()
 {
-    gl_Position = uLightSpaceMatrix * uModel * vec4(aPos, 1.);
-    vDepth = gl_Position.z;
+    gl_Position = uModel * vec4(aPos * aDecodeScale.xyz + aDecodeBias, 1.);
 }
\ No newline at end of file
@@ -1,8 +1,8 @@
 #version 450
 layout (location = 0) in vec3 aPos;
 
-uniform mat4 uProj;
-uniform mat4 uView;
+// uProj and uView:
+#include "frameuniforms.glsl"
 
 layout (location = 0) out vec3 vPos;
 
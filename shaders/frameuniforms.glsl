@@ -0,0 +1,22 @@
+// the uniform blocks written once a frame and shared by every program that draws the scene,
+// #included by the shaders that read them (the bindings must match includes/frameuniforms.h)
+
+#define MAX_LIGHTS 4
+
+layout (std140, binding = 1) uniform FrameUniforms
+{
+    mat4 uProj;
+    mat4 uView;
+    vec3 uCamPos;
+};
+
+layout (std140, binding = 2) uniform LightUniforms
+{
+    vec3 lightPositions[MAX_LIGHTS];
+    vec3 lightColors[MAX_LIGHTS];
+};
+
+layout (std140, binding = 3) uniform ShadowUniforms
+{
+    mat4 uLightSpaceMatrix[MAX_LIGHTS];
+};
@@ -0,0 +1,65 @@
+// the lighting functions objshader.frag uses for each light, #included by it
+// (see GLSLProgram's ReadShaderSource( ) )
+
+// Taken from https://github.com/glslify/glsl-diffuse-oren-nayar/blob/master/index.glsl
+vec3 orennayar(float LdotV, float NdotL, float NdotV, float roughness, vec3 albedo)
+{
+    float s = LdotV - NdotL * NdotV;
+    float t = mix(1.0, max(NdotL, NdotV), step(0.0, s));
+
+    float sigma2 = roughness*roughness;
+    float A = 1.0 + sigma2 * (albedo.r / (sigma2 + 0.13) + 0.5 / (sigma2 + 0.33));
+    A /= 3.;
+    float Ag = 1.0 + sigma2 * (albedo.g / (sigma2 + 0.13) + 0.5 / (sigma2 + 0.33));
+    A += Ag / 3.;
+    float Ab = 1.0 + sigma2 * (albedo.b / (sigma2 + 0.13) + 0.5 / (sigma2 + 0.33));
+    A += Ab / 3.;
+    float B = 0.45 * sigma2 / (sigma2 + 0.09);
+
+    return albedo * max(0.0, NdotL) * (A + B * s / t) / PI;
+} 
+// ----------------------------------------------------------------------------
+float DistributionGGX(vec3 N, vec3 H, float roughness)
+{
+    float a = roughness*roughness;
+    float a2 = a*a;
+    float NdotH = max(dot(N, H), 0.0);
+    float NdotH2 = NdotH*NdotH;
+
+    float nom   = a2;
+    float denom = (NdotH2 * (a2 - 1.0) + 1.0);
+    denom = PI * denom * denom;
+
+    return nom / denom;
+}
+// ----------------------------------------------------------------------------
+float GeometrySchlickGGX(float NdotV, float roughness)
+{
+    float r = (roughness + 1.0);
+    float k = (r*r) * 0.125;
+
+    float nom   = 1;
+    float denom = NdotV * (1.0 - k) + k;
+
+    return nom / denom;
+}
+// ----------------------------------------------------------------------------
+float GeometrySmith(vec3 N, vec3 V, vec3 L, float roughness)
+{
+    float NdotV = max(dot(N, V), 0.0);
+    float NdotL = max(dot(N, L), 0.0);
+    float ggx2 = GeometrySchlickGGX(NdotV, roughness);
+    float ggx1 = GeometrySchlickGGX(NdotL, roughness);
+
+    return ggx1 * ggx2;
+}
+// ----------------------------------------------------------------------------
+vec3 fresnelSchlick(float cosTheta, vec3 F0)
+{
+    return F0 + (1.0 - F0) * pow(clamp(1.0 - min(cosTheta, 1.0), 0.0, 1.0), 5.0);
+}
+// ----------------------------------------------------------------------------
+vec3 fresnelSchlickRoughness(float cosTheta, vec3 F0, float roughness)
+{
+    return F0 + (max(vec3(1.0 - roughness), F0) - F0) * pow(clamp(1.0 - min(cosTheta, 1.0), 0.0, 1.0), 5.0);
+}
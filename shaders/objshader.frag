@@ -1,5 +1,21 @@
 #version 450
 
+// the features this permutation has (GLSLProgram::SetDefines( ) puts them in):
+//	PARALLAX	the material has a height map, so refine the texture coordinates against it
+//	NORMAL_MAP	the material has a normal map (otherwise the surface's own normal is used)
+//	SHADOWS		look each light up in the shadow maps
+//	NUM_LIGHTS	how many lights there are
+//	SH_IRRADIANCE	the diffuse lighting is 9 SH coefficients instead of the iemMap cube
+//			(this one is the program's choice, not the material's, so it is given to the uber shader too)
+// with none of the others, this is the uber shader that does everything
+
+#ifndef NUM_LIGHTS
+#define PARALLAX
+#define NORMAL_MAP
+#define SHADOWS
+#define NUM_LIGHTS 4
+#endif
+
 layout (location = 0) out vec4 FragColor;
 layout (location = 1) in vec4 vPos;
 layout (location = 2) in vec4 vPosVS;
@@ -8,6 +24,7 @@ layout (location = 4) in vec2 vTexCoords;
 layout (location = 5) in vec4 vFragPosLightSpace[4];
 layout (location = 9) in mat3 vpTBN;
 layout (location = 12) in mat3 vpTBNinv;
+layout (location = 15) flat in int vMaterial;	// MaterialTable layer
 
 // material parameters
 uniform float ao;
@@ -15,29 +32,36 @@ uniform float uExpose;
 uniform float uTexScale;
 
 // Environment textures
+#ifndef SH_IRRADIANCE
 layout (binding = 1) uniform samplerCube iemMap;
+#endif
 layout (binding = 2) uniform samplerCube prefilMap;
 layout (binding = 3) uniform sampler2D brdfLUT;
 layout (binding = 4) uniform sampler2DArray shadowMap;
 
-// PBR textures
-layout (binding = 5) uniform sampler2D diffusetex;
-layout (binding = 6) uniform sampler2D roughtex;
-layout (binding = 7) uniform sampler2D metallictex;
-layout (binding = 8) uniform sampler2D normtex;
-layout (binding = 9) uniform sampler2D heighttex;
+// PBR textures: one layer per material (see MaterialTable)
+layout (binding = 5) uniform sampler2DArray diffusetex;
+layout (binding = 6) uniform sampler2DArray roughtex;
+layout (binding = 7) uniform sampler2DArray metallictex;
+layout (binding = 8) uniform sampler2DArray normtex;
+layout (binding = 9) uniform sampler2DArray heighttex;
 
-// Camera View
-uniform vec3 uCamPos;
+#ifdef SH_IRRADIANCE
+// the irradiance as 9 SH coefficients (see shirradiance.h), read instead of iemMap:
+layout (std140, binding = 0) uniform IrradianceSH
+{
+    vec4 uSH[9];
+};
+#endif
 
-// lights
-uniform vec3 lightPositions[4];
-uniform vec3 lightColors[4];
+// the camera (uCamPos) and the lights (lightPositions[ ], lightColors[ ], the first NUM_LIGHTS of them):
+#include "frameuniforms.glsl"
 
 const float PI = 3.14159265359;
 const float A = 6.2;
 const float heightScale = 0.01;
 
+#ifdef PARALLAX
 vec3 ContactRefineParallax(vec2 uv)
 {
     const int refinementSteps = 64;
@@ -49,13 +73,13 @@ vec3 ContactRefineParallax(vec2 uv)
     vec2 currentTexCoords = uv;
     float layerD = 1. / float(maxSteps);
     float currentLayerD = 0.0;
-    float currentHeight = texture(heighttex, currentTexCoords).r;
+    float currentHeight = texture(heighttex, vec3(currentTexCoords, vMaterial)).r;
     vec2 deltaUV = viewDir.xy * (heightScale * currentHeight);
 
     for (int i = 0; i < maxSteps; i++) {
         currentTexCoords -= deltaUV;
         currentLayerD += layerD;
-        currentHeight = texture(heighttex, currentTexCoords).r;
+        currentHeight = texture(heighttex, vec3(currentTexCoords, vMaterial)).r;
 
         if (currentHeight < currentLayerD) { // Check if ray is below surface
             break;
@@ -71,7 +95,7 @@ vec3 ContactRefineParallax(vec2 uv)
 
     for (int i = 0; i < refinementSteps; i++) {
         vec2 mid = (low + high) * 0.5;
-        midHeight = texture(heighttex, mid).r;
+        midHeight = texture(heighttex, vec3(mid, vMaterial)).r;
 
         if (midHeight < refineD) {
             high = mid;
@@ -82,21 +106,28 @@ vec3 ContactRefineParallax(vec2 uv)
 
     return vec3(uv, midHeight);
 }
+#endif
 
+#ifdef NORMAL_MAP
 vec3 getNormalFromMap(vec2 uv)
 {
-    vec3 tanNorm = texture(normtex, uv).rgb;
+    vec3 tanNorm = texture(normtex, vec3(uv, vMaterial)).rgb;
+    tanNorm.g = 1. - tanNorm.g;
     vec3 tangentNormal = tanNorm * 2.0 - 1.0;
-    tangentNormal.g = 1. - tangentNormal.g;
+    // a BC5 normal map only keeps x and y, so z is always rebuilt from them
+    tangentNormal.z = sqrt(max(0.0, 1.0 - dot(tangentNormal.xy, tangentNormal.xy)));
 
-    return normalize(tangentNormal);
+    // into the same space as vNormal, so a flat map (the layer of a material without one) gives vNormal:
+    return normalize(vpTBN * tangentNormal);
 }
+#endif
 // ----------------------------------------------------------------------------
 // Piecewise linear interpolation
 float linstep(const float low, const float high, const float value) {
     return clamp((value - low) / (high - low), 0.0, 1.0);
 }
 
+#ifdef SHADOWS
 // ----------------------------------------------------------------------------
 // Variance shadow mapping
 float ComputeShadow(const vec3 uvh, const int lightlayer) {
@@ -120,6 +151,7 @@ float ComputeShadow(const vec3 uvh, const int lightlayer) {
 
    return min(max(p, pMax), 1.0);
 }
+#endif
 
 vec3 tonemapFilmic(vec3 x)
 {
@@ -132,68 +164,23 @@ vec3 tonemapFilmic(vec3 x)
     return pow(result, vec3(2.2));
 }
 
-// Taken from https://github.com/glslify/glsl-diffuse-oren-nayar/blob/master/index.glsl
-vec3 orennayar(float LdotV, float NdotL, float NdotV, float roughness, vec3 albedo)
-{
-    float s = LdotV - NdotL * NdotV;
-    float t = mix(1.0, max(NdotL, NdotV), step(0.0, s));
-
-    float sigma2 = roughness*roughness;
-    float A = 1.0 + sigma2 * (albedo.r / (sigma2 + 0.13) + 0.5 / (sigma2 + 0.33));
-    A /= 3.;
-    float Ag = 1.0 + sigma2 * (albedo.g / (sigma2 + 0.13) + 0.5 / (sigma2 + 0.33));
-    A += Ag / 3.;
-    float Ab = 1.0 + sigma2 * (albedo.b / (sigma2 + 0.13) + 0.5 / (sigma2 + 0.33));
-    A += Ab / 3.;
-    float B = 0.45 * sigma2 / (sigma2 + 0.09);
-
-    return albedo * max(0.0, NdotL) * (A + B * s / t) / PI;
-} 
-// ----------------------------------------------------------------------------
-float DistributionGGX(vec3 N, vec3 H, float roughness)
-{
-    float a = roughness*roughness;
-    float a2 = a*a;
-    float NdotH = max(dot(N, H), 0.0);
-    float NdotH2 = NdotH*NdotH;
-
-    float nom   = a2;
-    float denom = (NdotH2 * (a2 - 1.0) + 1.0);
-    denom = PI * denom * denom;
-
-    return nom / denom;
-}
-// ----------------------------------------------------------------------------
-float GeometrySchlickGGX(float NdotV, float roughness)
-{
-    float r = (roughness + 1.0);
-    float k = (r*r) * 0.125;
-
-    float nom   = 1;
-    float denom = NdotV * (1.0 - k) + k;
-
-    return nom / denom;
-}
-// ----------------------------------------------------------------------------
-float GeometrySmith(vec3 N, vec3 V, vec3 L, float roughness)
-{
-    float NdotV = max(dot(N, V), 0.0);
-    float NdotL = max(dot(N, L), 0.0);
-    float ggx2 = GeometrySchlickGGX(NdotV, roughness);
-    float ggx1 = GeometrySchlickGGX(NdotL, roughness);
-
-    return ggx1 * ggx2;
-}
+#include "objbrdf.glsl"
+#ifdef SH_IRRADIANCE
 // ----------------------------------------------------------------------------
-vec3 fresnelSchlick(float cosTheta, vec3 F0)
+vec3 IrradianceFromSH(vec3 n)
 {
-    return F0 + (1.0 - F0) * pow(clamp(1.0 - min(cosTheta, 1.0), 0.0, 1.0), 5.0);
-}
-// ----------------------------------------------------------------------------
-vec3 fresnelSchlickRoughness(float cosTheta, vec3 F0, float roughness)
-{
-    return F0 + (max(vec3(1.0 - roughness), F0) - F0) * pow(clamp(1.0 - min(cosTheta, 1.0), 0.0, 1.0), 5.0);
+    vec3 e = uSH[0].rgb * 0.282095;
+    e += uSH[1].rgb * 0.488603 * n.y;
+    e += uSH[2].rgb * 0.488603 * n.z;
+    e += uSH[3].rgb * 0.488603 * n.x;
+    e += uSH[4].rgb * 1.092548 * n.x * n.y;
+    e += uSH[5].rgb * 1.092548 * n.y * n.z;
+    e += uSH[6].rgb * 0.315392 * (3.0 * n.z * n.z - 1.0);
+    e += uSH[7].rgb * 1.092548 * n.x * n.z;
+    e += uSH[8].rgb * 0.546274 * (n.x * n.x - n.y * n.y);
+    return max(e, vec3(0.0));
 }
+#endif
 // ----------------------------------------------------------------------------
 void main()
 {
@@ -202,15 +189,23 @@ void main()
     uv += -0.0;
     vec3 V = normalize(uCamPos-vPos.xyz);
 
+#ifdef PARALLAX
     vec3 uvh = ContactRefineParallax(uv);
     uv = uvh.xy;
+#else
+    vec3 uvh = vec3(uv, 0.0);
+#endif
 
+#ifdef NORMAL_MAP
     vec3 N = getNormalFromMap(uv);
+#else
+    vec3 N = normalize(vNormal);
+#endif
     vec3 R = reflect(-V, N);
 
-    vec3 tdiffuse   = pow(texture(diffusetex, uv).rgb, vec3(uExpose));
-    float tmetal    = texture(metallictex, uv).r;
-    float trough    = texture(roughtex, uv).r + uvh.z;
+    vec3 tdiffuse   = pow(texture(diffusetex, vec3(uv, vMaterial)).rgb, vec3(uExpose));
+    float tmetal    = texture(metallictex, vec3(uv, vMaterial)).r;
+    float trough    = texture(roughtex, vec3(uv, vMaterial)).r + uvh.z;
     
     //if (uv.x < 0. || uv.x > 1. || uv.y < 0. || uv.y > 1.) discard;
 
@@ -228,7 +223,11 @@ void main()
     vec3 kD = 1.0 - kS;
     kD *= 1.0 - tmetal;
 
+#ifdef SH_IRRADIANCE
+    vec3 irradiance = IrradianceFromSH(N);
+#else
     vec3 irradiance = texture(iemMap, N).rgb;
+#endif
     vec3 diffuse    = irradiance * tdiffuse;
 
     // sample both the pre-filter map and the BRDF lut and combine them together as per the Split-Sum approximation to get the IBL specular part.
@@ -241,7 +240,7 @@ void main()
 
     // reflectance equation
     vec3 Lo = vec3(0.0);
-    for(int i = 0; i < 4; ++i)
+    for(int i = 0; i < NUM_LIGHTS; ++i)
     {
         // calculate per-light radiance
         vec3 L = normalize(lightPositions[i] - vPos.xyz);
@@ -249,11 +248,15 @@ void main()
         float distance = length(lightPositions[i] - vPos.xyz);
         float attenuation = 1.0 / (distance * distance);
         vec3 radiance = lightColors[i] * attenuation;
-        vec3 lightDir = vpTBN * L;
 
         // Shadows: 0.0 < shadow < 1.0, where shadow is a light allowance factor
+#ifdef SHADOWS
+        vec3 lightDir = vpTBN * L;
         float dc = max(0.0, dot(-lightDir, N));
         float shadow = dc > 0.0 ? ComputeShadow(lightDir, i) : 1.0;
+#else
+        float shadow = 1.0;
+#endif
 
         // Cook-Torrance BRDF
         float NDF = DistributionGGX(N, H, trough);
@@ -1,10 +1,33 @@
 #version 450
+#extension GL_ARB_shader_draw_parameters : enable
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
-layout (location = 3) in vec3 aTangent;
+layout (location = 3) in vec4 aTangent;
 layout (location = 4) in vec3 aBitangent;
 
+// set by VertexBufferObject::Draw( ) for packed vertices:
+// xyz = position scale, w = 1. when the bitangent must be rebuilt from the tangent's sign
+// (IndirectBatch leaves w at 0. and says so per draw in drawMaterial[ ] instead)
+layout (location = 5) in vec4 aDecodeScale;
+layout (location = 6) in vec3 aDecodeBias;
+
+// set by IndirectBatch: the first command of this glMultiDrawElementsIndirect( ),
+// so the material (MaterialTable layer) of this draw is drawMaterial[aDrawFirst + gl_DrawIDARB]
+// (MaterialTable::Select( ) sets it for a single draw)
+layout (location = 7) in int aDrawFirst;
+
+struct DrawInfo
+{
+    int material;
+    int decodeBitangent;
+};
+
+layout (std430, binding = 0) readonly buffer DrawMaterials
+{
+    DrawInfo drawMaterial[];
+};
+
 layout (location = 1) out vec4 vPos;
 layout (location = 2) out vec4 vPosVS;
 layout (location = 3) out vec3 vNormal;
@@ -12,22 +35,32 @@ layout (location = 4) out vec2 vTexCoords;
 layout (location = 5) out vec4 vFragPosLightSpace[4];
 layout (location = 9) out mat3 vpTBN;
 layout (location = 12) out mat3 vpTBNinv;
+layout (location = 15) flat out int vMaterial;
+
+// uProj, uView and uLightSpaceMatrix[ ]:
+#include "frameuniforms.glsl"
 
-uniform mat4 uProj;
-uniform mat4 uView;
 uniform mat4 uModel;
 uniform mat3 uModelMatrix;
-uniform mat4 uLightSpaceMatrix[4];
 
 void main()
 {
     vTexCoords = aTexCoords;
-    vec4 pos = vec4(aPos, 1.0);
+#ifdef GL_ARB_shader_draw_parameters
+    DrawInfo draw = drawMaterial[aDrawFirst + gl_DrawIDARB];
+#else
+    DrawInfo draw = drawMaterial[aDrawFirst];
+#endif
+    vMaterial = draw.material;
+    vec4 pos = vec4(aPos * aDecodeScale.xyz + aDecodeBias, 1.0);
     vPos = vec4(uModel * pos);
     vPosVS = vec4(uView * pos);
     vNormal = normalize(uModelMatrix * aNormal);
-    vec3 T = normalize(uModelMatrix * aTangent);
-    vec3 B = normalize(uModelMatrix * aBitangent);
+    vec3 bitangent = aBitangent;
+    if (aDecodeScale.w > 0.5 || draw.decodeBitangent != 0)
+        bitangent = cross(aNormal, aTangent.xyz) * aTangent.w;
+    vec3 T = normalize(uModelMatrix * aTangent.xyz);
+    vec3 B = normalize(uModelMatrix * bitangent);
     vpTBN = mat3(T, B, vNormal);
     vpTBNinv = transpose(vpTBN);
     for (int i = 0; i < 4; i++)
@@ -0,0 +1,62 @@
+#version 450
+layout (local_size_x = 8, local_size_y = 8, local_size_z = 1) in;
+
+// one mip of the prefiltered cube per dispatch, the six faces in z
+// the GGX samples for this mip's roughness are precomputed (MakePrefilterSamples( )):
+// the light direction around a +z normal, and the environment mip to read it from
+
+layout (binding = 0) uniform samplerCube uenvMap;
+layout (binding = 0, rgba16f) writeonly uniform imageCube uPrefilter;
+
+layout (std430, binding = 0) readonly buffer PrefilterSamples
+{
+    vec4 uSamples[];        // xyz = L in tangent space, w = source mip level
+};
+
+uniform int uFirstSample;
+uniform int uSampleCount;
+
+// ----------------------------------------------------------------------------
+// the direction through the middle of a texel of a cube face (in the order and orientation GL_TEXTURE_CUBE_MAP has them)
+vec3 CubeDirection(ivec3 texel, float size)
+{
+    vec2 st = 2.0 * (vec2(texel.xy) + 0.5) / size - 1.0;
+    switch (texel.z)
+    {
+        case 0:  return vec3( 1.0,  -st.y, -st.x);
+        case 1:  return vec3(-1.0,  -st.y,  st.x);
+        case 2:  return vec3( st.x,  1.0,   st.y);
+        case 3:  return vec3( st.x, -1.0,  -st.y);
+        case 4:  return vec3( st.x, -st.y,  1.0);
+        default: return vec3(-st.x, -st.y, -1.0);
+    }
+}
+// ----------------------------------------------------------------------------
+void main()
+{
+    ivec3 texel = ivec3(gl_GlobalInvocationID);
+    int size = imageSize(uPrefilter).x;
+    if (texel.x >= size || texel.y >= size)
+        return;
+
+    vec3 N = normalize(CubeDirection(texel, float(size)));
+
+    // the same tangent frame prefilter.frag builds for its half vectors
+    vec3 up        = abs(N.z) < 0.999 ? vec3(0.0, 0.0, 1.0) : vec3(1.0, 0.0, 0.0);
+    vec3 tangent   = normalize(cross(up, N));
+    vec3 bitangent = cross(N, tangent);
+
+    vec3 prefilteredColor = vec3(0.0);
+    float totalWeight = 0.0;
+
+    for (int i = uFirstSample; i < uFirstSample + uSampleCount; ++i)
+    {
+        vec4 s = uSamples[i];
+        vec3 L = tangent * s.x + bitangent * s.y + N * s.z;
+
+        prefilteredColor += textureLod(uenvMap, L, s.w).rgb * s.z;
+        totalWeight      += s.z;
+    }
+
+    imageStore(uPrefilter, texel, vec4(prefilteredColor / totalWeight, 1.0));
+}
@@ -0,0 +1,175 @@
+#include "includes/shirradiance.h"
+#include "includes/mappedfile.h"
+#include "includes/threadpool.h"
+
+#include <string.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE__)
+#include <xmmintrin.h>
+#define SH_SSE
+#endif
+
+
+#define ROWS_PER_JOB	8
+
+
+// the real SH basis up to l = 2, for a unit direction:
+
+static void
+Basis(float x, float y, float z, float Y[SH_COEFFICIENTS])
+{
+	Y[0] = 0.282095f;
+	Y[1] = 0.488603f * y;
+	Y[2] = 0.488603f * z;
+	Y[3] = 0.488603f * x;
+	Y[4] = 1.092548f * x * y;
+	Y[5] = 1.092548f * y * z;
+	Y[6] = 0.315392f * (3.f * z * z - 1.f);
+	Y[7] = 1.092548f * x * z;
+	Y[8] = 0.546274f * (x * x - y * y);
+}
+
+
+// project an equirectangular image (rgb floats, laid out the way env.frag samples it:
+// u = atan(z, x) / 2pi + .5, v = asin(y) / pi + .5, row 0 at v = 0) onto the basis,
+// each texel weighted by its solid angle, a band of rows per thread pool job
+// then convolve with the cosine lobe (pi, 2pi/3, pi/4 for l = 0, 1, 2) and divide by pi:
+
+void
+ProjectIrradianceSH(const float* rgb, int width, int height, struct IrradianceSH* out)
+{
+	std::vector<float> cosPhi(width), sinPhi(width);
+	for (int i = 0; i < width; i++)
+	{
+		float phi = (((float)i + 0.5f) / (float)width - 0.5f) * 2.f * (float)M_PI;
+		cosPhi[i] = cosf(phi);
+		sinPhi[i] = sinf(phi);
+	}
+
+	int numJobs = (height + ROWS_PER_JOB - 1) / ROWS_PER_JOB;
+	std::vector<double> partial((size_t)numJobs * SH_COEFFICIENTS * 3, 0.);
+
+	ThreadPool::Shared()->ParallelFor(numJobs, [&](int job)
+	{
+		int last = (job + 1) * ROWS_PER_JOB < height ? (job + 1) * ROWS_PER_JOB : height;
+		double* sum = &partial[(size_t)job * SH_COEFFICIENTS * 3];
+
+		for (int j = job * ROWS_PER_JOB; j < last; j++)
+		{
+			float lat = (((float)j + 0.5f) / (float)height - 0.5f) * (float)M_PI;
+			float y = sinf(lat);
+			float r = cosf(lat);
+			float dw = (2.f * (float)M_PI / (float)width) * ((float)M_PI / (float)height) * r;
+			const float* row = rgb + (size_t)j * width * 3;
+
+			// a row's sums stay in floats (it is only a few thousand texels), then go into doubles:
+
+			float Y[SH_COEFFICIENTS];
+#ifdef SH_SSE
+			__m128 acc[SH_COEFFICIENTS];
+			for (int k = 0; k < SH_COEFFICIENTS; k++)
+				acc[k] = _mm_setzero_ps();
+
+			for (int i = 0; i < width; i++)
+			{
+				Basis(cosPhi[i] * r, y, sinPhi[i] * r, Y);
+				__m128 c = _mm_mul_ps(_mm_setr_ps(row[3 * i], row[3 * i + 1], row[3 * i + 2], 0.f), _mm_set1_ps(dw));
+				for (int k = 0; k < SH_COEFFICIENTS; k++)
+					acc[k] = _mm_add_ps(acc[k], _mm_mul_ps(c, _mm_set1_ps(Y[k])));
+			}
+
+			for (int k = 0; k < SH_COEFFICIENTS; k++)
+			{
+				float v[4];
+				_mm_storeu_ps(v, acc[k]);
+				for (int c = 0; c < 3; c++)
+					sum[3 * k + c] += v[c];
+			}
+#else
+			float acc[SH_COEFFICIENTS * 3] = { };
+			for (int i = 0; i < width; i++)
+			{
+				Basis(cosPhi[i] * r, y, sinPhi[i] * r, Y);
+				for (int k = 0; k < SH_COEFFICIENTS; k++)
+				{
+					for (int c = 0; c < 3; c++)
+						acc[3 * k + c] += row[3 * i + c] * dw * Y[k];
+				}
+			}
+
+			for (int k = 0; k < SH_COEFFICIENTS * 3; k++)
+				sum[k] += acc[k];
+#endif
+		}
+	});
+
+	static const float lobe[SH_COEFFICIENTS] = { 1.f, 2.f / 3.f, 2.f / 3.f, 2.f / 3.f, .25f, .25f, .25f, .25f, .25f };
+
+	for (int k = 0; k < SH_COEFFICIENTS; k++)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			double total = 0.;
+			for (int job = 0; job < numJobs; job++)
+				total += partial[((size_t)job * SH_COEFFICIENTS + k) * 3 + c];
+			out->sh[k][c] = (float)total * lobe[k];
+		}
+		out->sh[k][3] = 0.f;
+	}
+}
+
+
+// read the coefficients, if the file has this key
+// returns 0 on success, 1 if it is missing, stale, or the wrong size:
+
+int
+ReadIrradianceSH(const char* name, const std::string& key, struct IrradianceSH* sh)
+{
+	if (key.empty())
+		return 1;
+
+	MappedFile file;
+	if (!file.Open(name))
+		return 1;
+
+	if (file.Size() != key.size() + 1 + sizeof(struct IrradianceSH) || memcmp(file.Data(), key.c_str(), key.size() + 1) != 0)
+	{
+#ifdef _DEBUG
+		fprintf(stderr, "Irradiance cache '%s' is out of date -- making it again\n", name);
+#endif
+		return 1;
+	}
+
+	memcpy(sh, file.Data() + key.size() + 1, sizeof(struct IrradianceSH));
+	return 0;
+}
+
+
+// returns 0 on success, 1 on failure (the half-written file is removed):
+
+int
+WriteIrradianceSH(const char* name, const std::string& key, const struct IrradianceSH* sh)
+{
+	if (key.empty())
+		return 1;
+
+	FILE* fp;
+	if (fopen_s(&fp, name, "wb") != 0)
+	{
+		fprintf(stderr, "Cannot write irradiance cache '%s'\n", name);
+		return 1;
+	}
+
+	bool ok = fwrite(key.c_str(), 1, key.size() + 1, fp) == key.size() + 1;
+	ok = ok && fwrite(sh, sizeof(struct IrradianceSH), 1, fp) == 1;
+	ok = (fclose(fp) == 0) && ok;
+
+	if (!ok)
+	{
+		fprintf(stderr, "Cannot write irradiance cache '%s'\n", name);
+		remove(name);
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,549 @@
+#include "includes/texturecache.h"
+#include "includes/mappedfile.h"
+#include "includes/mipchain.h"
+#include "includes/threadpool.h"
+
+#include <math.h>
+#include <string.h>
+
+
+// which block format a map with this many channels goes in:
+
+GLenum
+CompressedFormatFor(int channels, bool normalMap)
+{
+	if (normalMap)
+		return GL_COMPRESSED_RG_RGTC2;
+	if (channels == 1)
+		return GL_COMPRESSED_RED_RGTC1;
+	return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+}
+
+
+static int
+BlockBytes(GLenum format)
+{
+	return (format == GL_COMPRESSED_RG_RGTC2) ? 16 : 8;
+}
+
+
+// ---------------------------------------------------------------------------------------------
+// BC4: two 8-bit endpoints and a 3-bit index per texel
+
+static void
+EncodeBC4Block(const unsigned char v[16], unsigned char* out)
+{
+	unsigned char lo = 255;
+	unsigned char hi = 0;
+	for (int i = 0; i < 16; i++)
+	{
+		if (v[i] < lo)	lo = v[i];
+		if (v[i] > hi)	hi = v[i];
+	}
+
+	out[0] = hi;
+	out[1] = lo;
+
+	unsigned long long bits = 0;
+	if (hi > lo)
+	{
+		// a0 > a1: 8 values, a0, a1, then six steps from a0 to a1
+
+		int palette[8];
+		palette[0] = hi;
+		palette[1] = lo;
+		for (int p = 2; p < 8; p++)
+			palette[p] = ((8 - p) * hi + (p - 1) * lo) / 7;
+
+		for (int i = 0; i < 16; i++)
+		{
+			int best = 0;
+			int bestError = 1 << 30;
+			for (int p = 0; p < 8; p++)
+			{
+				int e = abs((int)v[i] - palette[p]);
+				if (e < bestError)
+				{
+					bestError = e;
+					best = p;
+				}
+			}
+			bits |= (unsigned long long)best << (3 * i);
+		}
+	}
+
+	for (int b = 0; b < 6; b++)
+		out[2 + b] = (unsigned char)(bits >> (8 * b));
+}
+
+
+static void
+DecodeBC4Block(const unsigned char* in, unsigned char v[16])
+{
+	int a0 = in[0];
+	int a1 = in[1];
+
+	int palette[8];
+	palette[0] = a0;
+	palette[1] = a1;
+	if (a0 > a1)
+	{
+		for (int p = 2; p < 8; p++)
+			palette[p] = ((8 - p) * a0 + (p - 1) * a1) / 7;
+	}
+	else
+	{
+		for (int p = 2; p < 6; p++)
+			palette[p] = ((6 - p) * a0 + (p - 1) * a1) / 5;
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+
+	unsigned long long bits = 0;
+	for (int b = 0; b < 6; b++)
+		bits |= (unsigned long long)in[2 + b] << (8 * b);
+
+	for (int i = 0; i < 16; i++)
+		v[i] = (unsigned char)palette[(bits >> (3 * i)) & 7];
+}
+
+
+// ---------------------------------------------------------------------------------------------
+// BC1: two 5:6:5 endpoints and a 2-bit index per texel
+// the endpoints are fit along the block's principal axis, pulled in a little from its extremes
+
+static unsigned short
+To565(const float c[3])
+{
+	int r = (int)(c[0] * 31.f / 255.f + 0.5f);
+	int g = (int)(c[1] * 63.f / 255.f + 0.5f);
+	int b = (int)(c[2] * 31.f / 255.f + 0.5f);
+	r = (r < 0) ? 0 : (r > 31) ? 31 : r;
+	g = (g < 0) ? 0 : (g > 63) ? 63 : g;
+	b = (b < 0) ? 0 : (b > 31) ? 31 : b;
+	return (unsigned short)((r << 11) | (g << 5) | b);
+}
+
+
+static void
+From565(unsigned short c, int rgb[3])
+{
+	int r = (c >> 11) & 31;
+	int g = (c >> 5) & 63;
+	int b = c & 31;
+	rgb[0] = (r << 3) | (r >> 2);
+	rgb[1] = (g << 2) | (g >> 4);
+	rgb[2] = (b << 3) | (b >> 2);
+}
+
+
+static void
+BC1Palette(unsigned short c0, unsigned short c1, int palette[4][3])
+{
+	From565(c0, palette[0]);
+	From565(c1, palette[1]);
+	for (int k = 0; k < 3; k++)
+	{
+		if (c0 > c1)
+		{
+			palette[2][k] = (2 * palette[0][k] + palette[1][k]) / 3;
+			palette[3][k] = (palette[0][k] + 2 * palette[1][k]) / 3;
+		}
+		else
+		{
+			palette[2][k] = (palette[0][k] + palette[1][k]) / 2;
+			palette[3][k] = 0;
+		}
+	}
+}
+
+
+static void
+EncodeBC1Block(const unsigned char rgb[16][3], unsigned char* out)
+{
+	float mean[3] = { 0.f, 0.f, 0.f };
+	for (int i = 0; i < 16; i++)
+	{
+		for (int k = 0; k < 3; k++)
+			mean[k] += (float)rgb[i][k] / 16.f;
+	}
+
+	float cov[6] = { 0.f, 0.f, 0.f, 0.f, 0.f, 0.f };		// rr rg rb gg gb bb
+	for (int i = 0; i < 16; i++)
+	{
+		float d[3] = { rgb[i][0] - mean[0], rgb[i][1] - mean[1], rgb[i][2] - mean[2] };
+		cov[0] += d[0] * d[0];
+		cov[1] += d[0] * d[1];
+		cov[2] += d[0] * d[2];
+		cov[3] += d[1] * d[1];
+		cov[4] += d[1] * d[2];
+		cov[5] += d[2] * d[2];
+	}
+
+	// the principal axis, by power iteration:
+
+	float axis[3] = { 1.f, 1.f, 1.f };
+	for (int it = 0; it < 8; it++)
+	{
+		float a[3];
+		a[0] = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+		a[1] = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+		a[2] = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+		float len = sqrtf(a[0] * a[0] + a[1] * a[1] + a[2] * a[2]);
+		if (len < 1.e-6f)
+			break;
+		axis[0] = a[0] / len;
+		axis[1] = a[1] / len;
+		axis[2] = a[2] / len;
+	}
+
+	float tmin = 1.e+30f;
+	float tmax = -1.e+30f;
+	for (int i = 0; i < 16; i++)
+	{
+		float t = (rgb[i][0] - mean[0]) * axis[0] + (rgb[i][1] - mean[1]) * axis[1] + (rgb[i][2] - mean[2]) * axis[2];
+		if (t < tmin)	tmin = t;
+		if (t > tmax)	tmax = t;
+	}
+
+	float inset = (tmax - tmin) / 16.f;
+	tmin += inset;
+	tmax -= inset;
+
+	float e0[3], e1[3];
+	for (int k = 0; k < 3; k++)
+	{
+		e0[k] = mean[k] + axis[k] * tmax;
+		e1[k] = mean[k] + axis[k] * tmin;
+	}
+
+	unsigned short c0 = To565(e0);
+	unsigned short c1 = To565(e1);
+	if (c0 < c1)
+	{
+		unsigned short t = c0;
+		c0 = c1;
+		c1 = t;
+	}
+
+	unsigned int bits = 0;
+	if (c0 > c1)		// (if they are equal, index 0 everywhere is exactly c0)
+	{
+		int palette[4][3];
+		BC1Palette(c0, c1, palette);
+
+		for (int i = 0; i < 16; i++)
+		{
+			int best = 0;
+			int bestError = 1 << 30;
+			for (int p = 0; p < 4; p++)
+			{
+				int dr = (int)rgb[i][0] - palette[p][0];
+				int dg = (int)rgb[i][1] - palette[p][1];
+				int db = (int)rgb[i][2] - palette[p][2];
+				int e = dr * dr + dg * dg + db * db;
+				if (e < bestError)
+				{
+					bestError = e;
+					best = p;
+				}
+			}
+			bits |= (unsigned int)best << (2 * i);
+		}
+	}
+
+	out[0] = (unsigned char)(c0 & 0xff);
+	out[1] = (unsigned char)(c0 >> 8);
+	out[2] = (unsigned char)(c1 & 0xff);
+	out[3] = (unsigned char)(c1 >> 8);
+	for (int b = 0; b < 4; b++)
+		out[4 + b] = (unsigned char)(bits >> (8 * b));
+}
+
+
+static void
+DecodeBC1Block(const unsigned char* in, unsigned char rgb[16][3])
+{
+	unsigned short c0 = (unsigned short)(in[0] | (in[1] << 8));
+	unsigned short c1 = (unsigned short)(in[2] | (in[3] << 8));
+	unsigned int bits = in[4] | (in[5] << 8) | (in[6] << 16) | ((unsigned int)in[7] << 24);
+
+	int palette[4][3];
+	BC1Palette(c0, c1, palette);
+
+	for (int i = 0; i < 16; i++)
+	{
+		int p = (bits >> (2 * i)) & 3;
+		for (int k = 0; k < 3; k++)
+			rgb[i][k] = (unsigned char)palette[p][k];
+	}
+}
+
+
+// ---------------------------------------------------------------------------------------------
+
+
+// one level's blocks from 8-bit texels (the edge texels repeat to fill partial blocks):
+
+static void
+CompressLevel(const unsigned char* texels, int width, int height, int comps, GLenum format, unsigned char* out)
+{
+	int bw = (width + 3) / 4;
+	int bh = (height + 3) / 4;
+	int bytes = BlockBytes(format);
+
+	for (int by = 0; by < bh; by++)
+	{
+		for (int bx = 0; bx < bw; bx++)
+		{
+			unsigned char block[16][4];
+			for (int i = 0; i < 16; i++)
+			{
+				int x = 4 * bx + (i & 3);
+				int y = 4 * by + (i >> 2);
+				if (x >= width)		x = width - 1;
+				if (y >= height)	y = height - 1;
+				for (int k = 0; k < comps; k++)
+					block[i][k] = texels[(y * width + x) * comps + k];
+			}
+
+			unsigned char* dst = out + (by * bw + bx) * bytes;
+			if (format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT)
+			{
+				unsigned char rgb[16][3];
+				for (int i = 0; i < 16; i++)
+					memcpy(rgb[i], block[i], 3);
+				EncodeBC1Block(rgb, dst);
+			}
+			else
+			{
+				for (int k = 0; k < comps; k++)
+				{
+					unsigned char v[16];
+					for (int i = 0; i < 16; i++)
+						v[i] = block[i][k];
+					EncodeBC4Block(v, dst + 8 * k);
+				}
+			}
+		}
+	}
+}
+
+
+// compress an image (8 or 16 bits a channel, channels interleaved) and its whole mip chain
+// only the channels the format holds are kept: rgb for BC1, r for BC4, r and g for BC5:
+
+struct CompressedImage*
+CompressImage(const void* pixels, int width, int height, int channels, bool wide, GLenum format)
+{
+	int comps = (format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT) ? 3 : (format == GL_COMPRESSED_RG_RGTC2) ? 2 : 1;
+	if (channels < comps)
+		return NULL;
+
+	std::vector<unsigned char> level((size_t)width * height * comps);
+	for (size_t i = 0; i < (size_t)width * height; i++)
+	{
+		for (int k = 0; k < comps; k++)
+		{
+			if (wide)
+				level[i * comps + k] = (unsigned char)((((const unsigned short*)pixels)[i * channels + k] * 255 + 32767) / 65535);
+			else
+				level[i * comps + k] = ((const unsigned char*)pixels)[i * channels + k];
+		}
+	}
+
+	// the chain is filtered on the CPU, so the colour maps' mips can be made in linear light:
+
+	struct MipChain* chain = BuildMipChain(&level[0], width, height, comps, GL_UNSIGNED_BYTE,
+		format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT, MIP_KAISER);
+
+	struct CompressedImage* image = new struct CompressedImage;
+	image->format = format;
+
+	int numLevels = (int)chain->levels.size();
+	for (int l = 0; l < numLevels; l++)
+	{
+		struct TextureCacheLevel lev;
+		lev.width = chain->levels[l].width;
+		lev.height = chain->levels[l].height;
+		lev.offset = (l == 0) ? 0 : image->levels[l - 1].offset + image->levels[l - 1].bytes;
+		lev.bytes = (unsigned long long)((lev.width + 3) / 4) * ((lev.height + 3) / 4) * BlockBytes(format);
+		image->levels.push_back(lev);
+	}
+	image->blocks.resize((size_t)(image->levels.back().offset + image->levels.back().bytes));
+
+	// every level is ready now, so they can all be compressed at once:
+
+	ThreadPool::Shared()->ParallelFor(numLevels, [&](int l)
+	{
+		const struct TextureCacheLevel& lev = image->levels[l];
+		CompressLevel(&chain->texels[(size_t)chain->levels[l].offset], lev.width, lev.height, comps, format,
+			&image->blocks[(size_t)lev.offset]);
+	});
+
+	delete chain;
+	return image;
+}
+
+
+// decode one level back to 8-bit texels, comps channels each (3 for BC1, 1 for BC4, 2 for BC5):
+
+void
+DecompressLevel(const struct CompressedImage* image, int l, unsigned char* texels, int comps)
+{
+	const struct TextureCacheLevel& lev = image->levels[l];
+	int width = (int)lev.width;
+	int height = (int)lev.height;
+	int bw = (width + 3) / 4;
+	int bh = (height + 3) / 4;
+	int bytes = BlockBytes(image->format);
+	const unsigned char* blocks = &image->blocks[(size_t)lev.offset];
+
+	for (int by = 0; by < bh; by++)
+	{
+		for (int bx = 0; bx < bw; bx++)
+		{
+			const unsigned char* src = blocks + (by * bw + bx) * bytes;
+			unsigned char block[16][3];
+
+			if (image->format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT)
+			{
+				DecodeBC1Block(src, block);
+			}
+			else
+			{
+				int n = (image->format == GL_COMPRESSED_RG_RGTC2) ? 2 : 1;
+				for (int k = 0; k < n; k++)
+				{
+					unsigned char v[16];
+					DecodeBC4Block(src + 8 * k, v);
+					for (int i = 0; i < 16; i++)
+						block[i][k] = v[i];
+				}
+			}
+
+			for (int i = 0; i < 16; i++)
+			{
+				int x = 4 * bx + (i & 3);
+				int y = 4 * by + (i >> 2);
+				if (x >= width || y >= height)
+					continue;
+				for (int k = 0; k < comps; k++)
+					texels[(y * width + x) * comps + k] = block[i][k];
+			}
+		}
+	}
+}
+
+
+// read <source>.bcn, if it was made from this version of the source in this format
+// returns 0 on success, 1 if the cache is missing, stale, or damaged:
+
+int
+ReadTextureCache(const char* sourceName, GLenum format, struct CompressedImage* image)
+{
+	unsigned long long sourceSize;
+	long long sourceTime;
+	if (!GetFileStamp(sourceName, &sourceSize, &sourceTime))
+		return 1;
+
+	std::string cacheName(sourceName);
+	cacheName.append(TEXTURE_CACHE_SUFFIX);
+
+	MappedFile file;
+	if (!file.Open(cacheName.c_str()))
+		return 1;
+
+	const char* data = file.Data();
+	size_t size = file.Size();
+
+	if (size < sizeof(struct TextureCacheHeader))
+		return 1;
+
+	struct TextureCacheHeader header;
+	memcpy(&header, data, sizeof(header));
+
+	if (memcmp(header.magic, TEXTURE_CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+		header.version != TEXTURE_CACHE_VERSION ||
+		header.format != format ||
+		header.sourceSize != sourceSize || header.sourceTime != sourceTime)
+	{
+#ifdef _DEBUG
+		fprintf(stderr, "Texture cache '%s' is out of date -- rebuilding it\n", cacheName.c_str());
+#endif
+		return 1;
+	}
+
+	unsigned long long start = sizeof(struct TextureCacheHeader) + (unsigned long long)header.numLevels * sizeof(struct TextureCacheLevel);
+	if (header.numLevels == 0 || start > size)
+		return 1;
+
+	std::vector<struct TextureCacheLevel> levels(header.numLevels);
+	memcpy(&levels[0], data + sizeof(struct TextureCacheHeader), header.numLevels * sizeof(struct TextureCacheLevel));
+
+	unsigned long long total = 0;
+	for (const struct TextureCacheLevel& lev : levels)
+	{
+		unsigned long long expected = (unsigned long long)((lev.width + 3) / 4) * ((lev.height + 3) / 4) * BlockBytes(format);
+		if (lev.bytes != expected || lev.offset != total)
+		{
+			fprintf(stderr, "Texture cache '%s' is damaged -- rebuilding it\n", cacheName.c_str());
+			return 1;
+		}
+		total += lev.bytes;
+	}
+
+	if (start + total > size)
+	{
+		fprintf(stderr, "Texture cache '%s' is truncated\n", cacheName.c_str());
+		return 1;
+	}
+
+	image->format = format;
+	image->levels.swap(levels);
+	image->blocks.assign(data + start, data + start + total);
+	return 0;
+}
+
+
+// write <source>.bcn
+// returns 0 on success, 1 on failure (the half-written file is removed):
+
+int
+WriteTextureCache(const char* sourceName, const struct CompressedImage* image)
+{
+	struct TextureCacheHeader header = { };
+	memcpy(header.magic, TEXTURE_CACHE_MAGIC, sizeof(header.magic));
+	header.version = TEXTURE_CACHE_VERSION;
+	header.format = image->format;
+	header.numLevels = (unsigned int)image->levels.size();
+	if (!GetFileStamp(sourceName, &header.sourceSize, &header.sourceTime))
+		return 1;
+
+	std::string cacheName(sourceName);
+	cacheName.append(TEXTURE_CACHE_SUFFIX);
+
+	FILE* fp;
+	if (fopen_s(&fp, cacheName.c_str(), "wb") != 0)
+	{
+		fprintf(stderr, "Cannot write texture cache '%s'\n", cacheName.c_str());
+		return 1;
+	}
+
+	bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+	if (header.numLevels > 0)
+		ok = ok && fwrite(&image->levels[0], sizeof(struct TextureCacheLevel), header.numLevels, fp) == header.numLevels;
+	if (image->blocks.size() > 0)
+		ok = ok && fwrite(&image->blocks[0], 1, image->blocks.size(), fp) == image->blocks.size();
+
+	ok = (fclose(fp) == 0) && ok;
+
+	if (!ok)
+	{
+		fprintf(stderr, "Cannot write texture cache '%s'\n", cacheName.c_str());
+		remove(cacheName.c_str());
+		return 1;
+	}
+
+	return 0;
+}
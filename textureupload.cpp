@@ -0,0 +1,281 @@
+#include "includes/textureupload.h"
+
+#include <string.h>
+#include <algorithm>
+
+
+// make the ring (on the GL thread, which is then the one Pump( ) has to be called from)
+// returns false if buffers can't be persistently mapped, so textures have to be uploaded directly:
+
+bool
+TextureUploader::Init( size_t _slotSize, int numSlots )
+{
+	if( ! GLEW_ARB_buffer_storage )
+	{
+		fprintf( stderr, "No persistently mapped buffers -- uploading textures before the first frame\n" );
+		return false;
+	}
+
+	slotSize = _slotSize;
+	GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+	glCreateBuffers( 1, &buffer );
+	glNamedBufferStorage( buffer, slotSize * numSlots, NULL, flags );
+	mapped = (unsigned char *)glMapNamedBufferRange( buffer, 0, slotSize * numSlots, flags );
+	if( mapped == NULL )
+	{
+		fprintf( stderr, "Cannot map the texture upload ring\n" );
+		glDeleteBuffers( 1, &buffer );
+		buffer = 0;
+		return false;
+	}
+
+	state.assign( numSlots, SLOT_FREE );
+	fences.assign( numSlots, (GLsync)NULL );
+	glThread = std::this_thread::get_id( );
+
+#ifdef _DEBUG
+	fprintf( stderr, "Texture upload ring: %d slots of %d KB\n", numSlots, (int)( slotSize / 1024 ) );
+#endif
+
+	return true;
+}
+
+
+// is anything asked for not in its texture yet?
+
+bool
+TextureUploader::Busy( )
+{
+	if( outstanding > 0 )
+		return true;
+
+	std::unique_lock<std::mutex> guard( lock );
+	for( int s : state )
+	{
+		if( s != SLOT_FREE )
+			return true;
+	}
+	return false;
+}
+
+
+// on the GL thread: wait until everything that has been asked for is in its texture
+
+void
+TextureUploader::Finish( )
+{
+	while( Busy( ) )
+	{
+		Pump( true );
+		std::this_thread::yield( );
+	}
+}
+
+
+// a slot to copy into, waiting for one if they are all in use, or -1 once Shutdown( ) has been called
+// the GL thread is the one that frees them, so if it is the one waiting it pumps instead:
+
+int
+TextureUploader::AcquireSlot( )
+{
+	std::unique_lock<std::mutex> guard( lock );
+	for( ; ; )
+	{
+		if( shutdown )
+			return -1;
+
+		for( int i = 0; i < (int)state.size( ); i++ )
+		{
+			if( state[i] == SLOT_FREE )
+			{
+				state[i] = SLOT_FILLING;
+				return i;
+			}
+		}
+
+		if( std::this_thread::get_id( ) == glThread )
+		{
+			guard.unlock( );
+			Pump( true );
+			std::this_thread::yield( );
+			guard.lock( );
+		}
+		else
+		{
+			freed.wait( guard, [this]( )
+			{
+				return shutdown  ||  std::find( state.begin( ), state.end( ), (int)SLOT_FREE ) != state.end( );
+			} );
+		}
+	}
+}
+
+
+// stop handing out slots and wake every thread waiting for one, which then drops the rest of its upload,
+// so the thread pool can be torn down without the GL thread pumping any more
+// (the slots already being filled still get queued, and Finish( ) still issues them):
+
+void
+TextureUploader::Shutdown( )
+{
+	{
+		std::unique_lock<std::mutex> guard( lock );
+		shutdown = true;
+	}
+	freed.notify_all( );
+}
+
+
+// on the GL thread, once a frame:
+// copy the queued slots into their textures, then free the slots whose copies have finished
+// (if wait is set and none have, wait for the oldest one)
+
+void
+TextureUploader::Pump( bool wait )
+{
+	std::deque<struct Region> work;
+	{
+		std::unique_lock<std::mutex> guard( lock );
+		work.swap( queued );
+	}
+
+	if( ! work.empty( ) )
+	{
+		glBindBuffer( GL_PIXEL_UNPACK_BUFFER, buffer );
+		glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+
+		for( struct Region &r : work )
+		{
+			const void *offset = (const void *)( (size_t)r.slot * slotSize );
+			if( r.type == 0 )
+			{
+				if( r.layer < 0 )
+					glCompressedTextureSubImage2D( r.texture, r.level, 0, r.y, r.width, r.height, r.format, r.bytes, offset );
+				else
+					glCompressedTextureSubImage3D( r.texture, r.level, 0, r.y, r.layer, r.width, r.height, 1, r.format, r.bytes, offset );
+			}
+			else
+			{
+				if( r.layer < 0 )
+					glTextureSubImage2D( r.texture, r.level, 0, r.y, r.width, r.height, r.format, r.type, offset );
+				else
+					glTextureSubImage3D( r.texture, r.level, 0, r.y, r.layer, r.width, r.height, 1, r.format, r.type, offset );
+			}
+
+			fences[r.slot] = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+			{
+				std::unique_lock<std::mutex> guard( lock );
+				state[r.slot] = SLOT_IN_FLIGHT;
+			}
+			outstanding--;
+		}
+
+		glPixelStorei( GL_UNPACK_ALIGNMENT, 4 );
+		glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
+	}
+
+	int oldest = -1;
+	bool any = false;
+	{
+		std::unique_lock<std::mutex> guard( lock );
+		for( int i = 0; i < (int)state.size( ); i++ )
+		{
+			if( state[i] != SLOT_IN_FLIGHT )
+				continue;
+
+			GLenum status = glClientWaitSync( fences[i], 0, 0 );
+			if( status == GL_ALREADY_SIGNALED  ||  status == GL_CONDITION_SATISFIED )
+			{
+				glDeleteSync( fences[i] );
+				fences[i] = NULL;
+				state[i] = SLOT_FREE;
+				any = true;
+			}
+			else if( oldest < 0 )
+				oldest = i;
+		}
+	}
+
+	if( wait  &&  ! any  &&  oldest >= 0 )
+	{
+		GLenum status = glClientWaitSync( fences[oldest], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000 );
+		if( status == GL_ALREADY_SIGNALED  ||  status == GL_CONDITION_SATISFIED )
+		{
+			glDeleteSync( fences[oldest] );
+			fences[oldest] = NULL;
+			std::unique_lock<std::mutex> guard( lock );
+			state[oldest] = SLOT_FREE;
+			any = true;
+		}
+	}
+
+	if( any )
+		freed.notify_all( );
+}
+
+
+// copy a region into as many slots as it takes, a band of rows in each, and queue them
+// (rowHeight is how many texel rows one row of data is: 1, or 4 for a row of compressed blocks):
+
+void
+TextureUploader::Send( struct Region r, const unsigned char *src, size_t rowBytes, int rowHeight )
+{
+	int rows = ( r.height + rowHeight - 1 ) / rowHeight;
+	int perSlot = (int)( slotSize / rowBytes );
+	if( perSlot < 1 )
+	{
+		fprintf( stderr, "A texture row of %d bytes doesn't fit in an upload slot\n", (int)rowBytes );
+		return;
+	}
+
+	outstanding += ( rows + perSlot - 1 ) / perSlot;
+
+	for( int first = 0; first < rows; first += perSlot )
+	{
+		int n = ( rows - first < perSlot ) ? rows - first : perSlot;
+		int slot = AcquireSlot( );
+		if( slot < 0 )
+		{
+			outstanding -= ( rows - first + perSlot - 1 ) / perSlot;	// the bands that won't be sent
+			return;
+		}
+		memcpy( mapped + (size_t)slot * slotSize, src + (size_t)first * rowBytes, (size_t)n * rowBytes );
+
+		struct Region band = r;
+		band.slot = slot;
+		band.y = first * rowHeight;
+		band.height = ( n * rowHeight < r.height - band.y ) ? n * rowHeight : r.height - band.y;
+		band.bytes = (GLsizei)( (size_t)n * rowBytes );
+
+		std::unique_lock<std::mutex> guard( lock );
+		state[slot] = SLOT_QUEUED;
+		queued.push_back( band );
+	}
+}
+
+
+// from any thread: queue one level (of one layer, or layer < 0 for a 2D texture) of tightly packed texels
+// the texels are copied before this returns:
+
+void
+TextureUploader::Upload( GLuint texture, int level, int layer, int width, int height,
+	GLenum format, GLenum type, int texelBytes, const void *texels )
+{
+	struct Region r = { -1, texture, level, 0, layer, width, height, format, type, 0 };
+	Send( r, (const unsigned char *)texels, (size_t)width * texelBytes, 1 );
+}
+
+
+// the same, for a level of compressed blocks:
+
+void
+TextureUploader::UploadCompressed( GLuint texture, int level, int layer, int width, int height,
+	GLenum format, const void *blocks )
+{
+	int blockBytes = ( format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT  ||  format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT  ||
+			   format == GL_COMPRESSED_RED_RGTC1  ||  format == GL_COMPRESSED_SIGNED_RED_RGTC1 ) ? 8 : 16;
+
+	struct Region r = { -1, texture, level, 0, layer, width, height, format, 0, 0 };
+	Send( r, (const unsigned char *)blocks, (size_t)( ( width + 3 ) / 4 ) * blockBytes, 4 );
+}
@@ -0,0 +1,134 @@
+#include "includes/threadpool.h"
+#include <atomic>
+#include <memory>
+
+
+// numThreads <= 0 means one worker per hardware thread:
+
+ThreadPool::ThreadPool( int numThreads )
+{
+	stopping = false;
+
+	if( numThreads <= 0 )
+		numThreads = (int)std::thread::hardware_concurrency( );
+	if( numThreads <= 0 )
+		numThreads = 1;
+
+	for( int i = 0; i < numThreads; i++ )
+		workers.push_back( std::thread( &ThreadPool::Worker, this ) );
+}
+
+
+ThreadPool::~ThreadPool( )
+{
+	{
+		std::unique_lock<std::mutex> guard( lock );
+		stopping = true;
+	}
+	wake.notify_all( );
+
+	for( std::thread &t : workers )
+		t.join( );
+}
+
+
+void
+ThreadPool::Worker( )
+{
+	for( ; ; )
+	{
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> guard( lock );
+			wake.wait( guard, [this] { return stopping || !jobs.empty( ); } );
+			if( jobs.empty( ) )
+				return;			// stopping, and nothing left to do
+
+			job = std::move( jobs.front( ) );
+			jobs.pop_front( );
+		}
+
+		job( );
+	}
+}
+
+
+int
+ThreadPool::NumThreads( )
+{
+	return (int)workers.size( );
+}
+
+
+// run f( 0 ) ... f( count-1 ), spread across the workers and the calling thread,
+// and return once every one of them has finished:
+
+void
+ThreadPool::ParallelFor( int count, std::function<void(int)> f )
+{
+	if( count <= 0 )
+		return;
+
+	if( count == 1 )
+	{
+		f( 0 );
+		return;
+	}
+
+	struct Batch
+	{
+		std::atomic<int>		next;
+		std::atomic<int>		done;
+		std::mutex			lock;
+		std::condition_variable		finished;
+	};
+
+	std::shared_ptr<Batch> batch = std::make_shared<Batch>( );
+	batch->next = 0;
+	batch->done = 0;
+
+	auto run = [batch, count, f]( )
+	{
+		for( int i; ( i = batch->next++ ) < count; )
+		{
+			f( i );
+			if( ++batch->done == count )
+			{
+				std::unique_lock<std::mutex> guard( batch->lock );
+				batch->finished.notify_all( );
+			}
+		}
+	};
+
+	int helpers = NumThreads( );
+	if( helpers > count - 1 )
+		helpers = count - 1;
+	for( int i = 0; i < helpers; i++ )
+		Submit( run );
+
+	run( );
+
+	std::unique_lock<std::mutex> guard( batch->lock );
+	batch->finished.wait( guard, [batch, count] { return batch->done == count; } );
+}
+
+
+void
+ThreadPool::Submit( std::function<void()> job )
+{
+	{
+		std::unique_lock<std::mutex> guard( lock );
+		jobs.push_back( std::move( job ) );
+	}
+	wake.notify_one( );
+}
+
+
+// one pool for the whole program, created the first time someone asks for it:
+
+ThreadPool *
+ThreadPool::Shared( )
+{
+	static ThreadPool pool;
+	return &pool;
+}
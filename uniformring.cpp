@@ -0,0 +1,112 @@
+#include "includes/uniformring.h"
+
+#include <string.h>
+
+
+// make the ring, on the GL thread
+// returns false if the buffer can't be made:
+
+bool
+UniformRing::Init( size_t _regionSize, int numRegions )
+{
+	GLint align = 256;
+	glGetIntegerv( GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &align );
+	alignment = ( align > 0 ) ? (size_t)align : 256;
+	regionSize = ( _regionSize + alignment - 1 ) / alignment * alignment;
+	size_t total = regionSize * numRegions;
+
+	glCreateBuffers( 1, &buffer );
+	if( buffer == 0 )
+	{
+		fprintf( stderr, "Cannot make the uniform buffer ring\n" );
+		return false;
+	}
+
+	if( GLEW_ARB_buffer_storage )
+	{
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glNamedBufferStorage( buffer, total, NULL, flags );
+		mapped = (unsigned char *)glMapNamedBufferRange( buffer, 0, total, flags );
+	}
+
+	if( mapped == NULL )
+	{
+		fprintf( stderr, "No persistently mapped buffers -- writing the uniform blocks with glNamedBufferSubData( )\n" );
+		glDeleteBuffers( 1, &buffer );
+		glCreateBuffers( 1, &buffer );
+		glNamedBufferData( buffer, total, NULL, GL_DYNAMIC_DRAW );
+	}
+
+	fences.assign( numRegions, (GLsync)NULL );
+	region = numRegions - 1;		// so the first BeginFrame( ) starts at 0
+	used = regionSize;
+
+#ifdef _DEBUG
+	fprintf( stderr, "Uniform buffer ring: %d regions of %d KB\n", numRegions, (int)( regionSize / 1024 ) );
+#endif
+
+	return true;
+}
+
+
+// start writing the next region, once the graphics card is done reading it:
+
+void
+UniformRing::BeginFrame( )
+{
+	if( buffer == 0 )
+		return;
+
+	region = ( region + 1 ) % (int)fences.size( );
+	used = 0;
+
+	GLsync fence = fences[region];
+	if( fence == NULL )
+		return;
+
+	GLenum status = glClientWaitSync( fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0 );
+	while( status == GL_TIMEOUT_EXPIRED )
+		status = glClientWaitSync( fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000 );
+
+	glDeleteSync( fence );
+	fences[region] = NULL;
+}
+
+
+// copy a uniform block into this frame's region, and bind it there for every program that reads that binding:
+
+void
+UniformRing::Bind( GLuint binding, const void *block, size_t size )
+{
+	if( buffer == 0 )
+		return;
+
+	if( used + size > regionSize )
+	{
+		fprintf( stderr, "The uniform buffer ring's %d-byte region is full -- make UNIFORM_RING_SIZE bigger\n", (int)regionSize );
+		return;
+	}
+
+	size_t offset = (size_t)region * regionSize + used;
+	if( mapped != NULL )
+		memcpy( mapped + offset, block, size );
+	else
+		glNamedBufferSubData( buffer, (GLintptr)offset, (GLsizeiptr)size, block );
+
+	glBindBufferRange( GL_UNIFORM_BUFFER, binding, buffer, (GLintptr)offset, (GLsizeiptr)size );
+	used += ( size + alignment - 1 ) / alignment * alignment;
+}
+
+
+// everything this frame reads from its region has been drawn:
+
+void
+UniformRing::EndFrame( )
+{
+	if( buffer == 0 )
+		return;
+
+	if( fences[region] != NULL )
+		glDeleteSync( fences[region] );
+	fences[region] = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+}
@@ -1,4 +1,9 @@
 #include "includes/vertexbufferobject.h"
+#include "includes/meshoptimize.h"
+#include "includes/geometryarena.h"
+#include "includes/hdrimage.h"
+
+#include <stddef.h>
 
 
 static
@@ -11,10 +16,93 @@ FpEq( float f1, float f2 )
 }
 
 
+// welding compares every field of a Point, not just the position
+// with an epsilon, each field is snapped to a grid that size and points landing
+// in the same cell are merged; either way, the (snapped) bits have to match (except -0 == +0):
+
+static const GLuint	WELD_EMPTY = ~0;
+static const int	WELD_FIELDS = sizeof(struct Point) / sizeof(float);
+
+
+static
+inline
+unsigned int
+WeldKey( float f, float invEpsilon )
+{
+	if( invEpsilon > 0. )
+		f = floorf( f * invEpsilon + 0.5f );	// snap, but keep it a float: an int cast is undefined for huge values, inf, and nan
+
+	if( f == 0. )
+		return 0;		// fold -0. into +0.
+
+	unsigned int bits;
+	memcpy( &bits, &f, sizeof(bits) );
+	return bits;
+}
+
+
+static
+inline
+unsigned int
+WeldHash( const struct Point &pt, float invEpsilon )
+{
+	const float *f = &pt.x;
+	unsigned int h = 2166136261u;
+	for( int i = 0; i < WELD_FIELDS; i++ )
+	{
+		h ^= WeldKey( f[i], invEpsilon );
+		h *= 16777619u;
+		h ^= h >> 15;
+	}
+	return h;
+}
+
+
+static
+inline
+bool
+WeldSame( const struct Point &p0, const struct Point &p1, float invEpsilon )
+{
+	const float *f0 = &p0.x;
+	const float *f1 = &p1.x;
+	for( int i = 0; i < WELD_FIELDS; i++ )
+	{
+		if( WeldKey( f0[i], invEpsilon ) != WeldKey( f1[i], invEpsilon ) )
+			return false;
+	}
+	return true;
+}
+
+
 GLuint
 VertexBufferObject::AddVertex( GLfloat x, GLfloat y, GLfloat z )
 {
 	Key key( x, y, z );
+	struct Point pt = { x, y, z,  c_nx, c_ny, c_nz,   c_s, c_t,   c_u, c_v, 0.,   c_uu, c_uv, 0. };
+
+	if( weldVertices )
+	{
+		// keep the table at most half full so the probe runs stay short:
+
+		if( 2 * ( PointVec.size( ) + 1 ) > WeldTable.size( ) )
+			GrowWeldTable( );
+
+		float invEpsilon = weldEpsilon > 0. ? 1.f / weldEpsilon : 0.f;
+		unsigned int mask = (unsigned int)WeldTable.size( ) - 1;
+		unsigned int slot = WeldHash( pt, invEpsilon ) & mask;
+
+		while( WeldTable[slot] != WELD_EMPTY )
+		{
+			GLuint index = WeldTable[slot];
+			if( WeldSame( PointVec[index], pt, invEpsilon ) )
+				return index;
+			slot = ( slot + 1 ) & mask;
+		}
+
+		PointVec.push_back( pt );
+		WeldTable[slot] = (GLuint)PointVec.size( ) - 1;
+		return WeldTable[slot];
+	}
 
 	if( collapseCommonVertices )
 	{
@@ -34,7 +122,6 @@ VertexBufferObject::AddVertex( GLfloat x, GLfloat y, GLfloat z )
 	if( verbose )
 		fprintf( stderr, "Point %8.3f,%8.3f,%8.3f is new\n", x, y, z );
 
-	struct Point pt = { x, y, z,  c_nx, c_ny, c_nz,   c_s, c_t,   c_u, c_v, 0.,   c_uu, c_uv, 0. };
 	PointVec.push_back( pt );
 	int ptindex = (int)PointVec.size( ) - 1;
 	if( collapseCommonVertices )
@@ -43,6 +130,29 @@ VertexBufferObject::AddVertex( GLfloat x, GLfloat y, GLfloat z )
 }
 
 
+// double the weld table (it starts at 1024 slots) and put every point back into it:
+
+void
+VertexBufferObject::GrowWeldTable( )
+{
+	size_t size = WeldTable.size( ) < 1024 ? 1024 : 2 * WeldTable.size( );
+	while( size < 2 * ( PointVec.size( ) + 1 ) )
+		size *= 2;
+
+	WeldTable.assign( size, WELD_EMPTY );
+
+	float invEpsilon = weldEpsilon > 0. ? 1.f / weldEpsilon : 0.f;
+	unsigned int mask = (unsigned int)size - 1;
+	for( GLuint i = 0; i < (GLuint)PointVec.size( ); i++ )
+	{
+		unsigned int slot = WeldHash( PointVec[i], invEpsilon ) & mask;
+		while( WeldTable[slot] != WELD_EMPTY )
+			slot = ( slot + 1 ) & mask;
+		WeldTable[slot] = i;
+	}
+}
+
+
 void
 VertexBufferObject::CollapseCommonVertices( bool tf )
 {
@@ -53,6 +163,55 @@ VertexBufferObject::CollapseCommonVertices( bool tf )
 void
 VertexBufferObject::Draw( )
 {
+	if( isFirstDraw  &&  ! Prepare( ) )
+		return;
+
+	if( arena != NULL )
+	{
+		DrawArena( );
+		return;
+	}
+
+	glBindVertexArray( abuffer );
+	if( collapseCommonVertices || weldVertices )
+		glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, ebuffer );
+
+	// how the vertex shader should unpack this object (see PackVertices( )):
+	// these are "current" attribute values, not per-vertex arrays, so every draw sets them
+
+	glVertexAttrib4f( DECODE_SCALE_ATTRIB, decodeScale[0], decodeScale[1], decodeScale[2], decodeBitangent ? 1.f : 0.f );
+	glVertexAttrib3f( DECODE_BIAS_ATTRIB,  decodeBias[0],  decodeBias[1],  decodeBias[2] );
+
+
+	if( collapseCommonVertices || weldVertices || restartFound )
+	{
+		glDrawElements( topology, numDrawElements, GL_UNSIGNED_INT, BUFFER_OFFSET( 0 ) );
+	}
+	else
+	{
+		glDrawArrays( topology, 0, numDrawPoints);
+	}
+
+	glBindVertexArray( 0 );
+	glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, 0 );
+
+	//glDisableClientState( GL_VERTEX_ARRAY );
+	//glDisableClientState( GL_NORMAL_ARRAY );
+	//glDisableClientState( GL_COLOR_ARRAY );
+	//glDisableClientState( GL_TEXTURE_COORD_ARRAY );
+}
+
+
+// send the points and elements to the graphics card now, instead of at the first Draw( )
+// (anything that needs the object's buffers or arena range before it is drawn calls this)
+// returns false if there is nothing to send:
+
+bool
+VertexBufferObject::Prepare( )
+{
+	if( ! isFirstDraw )
+		return true;
+
 	int numPoints   = (int) PointVec.size( );
 	int numElements = (int) ElementVec.size( );
 
@@ -60,112 +219,359 @@ VertexBufferObject::Draw( )
 	{
 		if( verbose )
 			fprintf( stderr, "Don't have anything to Draw!\n" );
+		return false;
+	}
+
+	Upload( &PointVec[0], numPoints, &ElementVec[0], numElements );
+	return true;
+}
+
+
+// draw this object's range of the shared arena
+// the arena's vertex array is left bound, so drawing its next object doesn't switch anything:
+
+void
+VertexBufferObject::DrawArena( )
+{
+	const struct ArenaRange &range = arena->GetRange( arenaRange );
+
+	glVertexAttrib4f( DECODE_SCALE_ATTRIB, decodeScale[0], decodeScale[1], decodeScale[2], decodeBitangent ? 1.f : 0.f );
+	glVertexAttrib3f( DECODE_BIAS_ATTRIB,  decodeBias[0],  decodeBias[1],  decodeBias[2] );
+
+	arena->Bind( );
+
+	if( collapseCommonVertices || weldVertices || restartFound )
+	{
+		glDrawElementsBaseVertex( topology, range.numIndices, GL_UNSIGNED_INT,
+			BUFFER_OFFSET( range.firstIndex * sizeof(GLuint) ), range.baseVertex );
+	}
+	else
+	{
+		glDrawArrays( topology, range.baseVertex, range.numVertices );
+	}
+}
+
+
+// create the vertex array and the two buffers, filling them straight from the given arrays:
+// (glBufferData( ) copies them, so the caller may let them go as soon as this returns)
+
+void
+VertexBufferObject::Upload( const struct Point *points, int numPoints, const GLuint *elements, int numElements )
+{
+	if( arena != NULL )
+	{
+		UploadArena( points, numPoints, elements, numElements );
 		return;
 	}
 
-	if( isFirstDraw )
+	glGenVertexArrays(1, &abuffer);
+	glGenBuffers( 1, &pbuffer );
+	glBindVertexArray(abuffer);
+	glBindBuffer( GL_ARRAY_BUFFER, pbuffer );
+
+	decodeScale[0] = decodeScale[1] = decodeScale[2] = 1.f;
+	decodeBias[0]  = decodeBias[1]  = decodeBias[2]  = 0.f;
+	decodeBitangent = false;
+
+	if( packing != VBO_PACK_NONE )
 	{
-		glGenVertexArrays(1, &abuffer);
-		glGenBuffers( 1, &pbuffer );
-		glBindVertexArray(abuffer);
-		glBindBuffer( GL_ARRAY_BUFFER, pbuffer );
-		glBufferData( GL_ARRAY_BUFFER, numPoints * sizeof(struct Point), NULL, GL_STATIC_DRAW );
-		parray = (struct Point *) glMapBuffer( GL_ARRAY_BUFFER, GL_WRITE_ONLY );
-		(void) memmove( &parray[0].x, &PointVec[0].x, numPoints * sizeof(struct Point) );
-
-		// note: the memmove is the same as saying:
-		// for( int i = 0; i < numPoints; i++ )
-		// {
-		//	parray[i].x = PointVec[i].x;
-		//	parray[i].y = PointVec[i].y;
-		//	parray[i].z = PointVec[i].z;
-		//	parray[i].nx = PointVec[i].nx;
-		//	parray[i].ny = PointVec[i].ny;
-		//	parray[i].nz = PointVec[i].nz;
-		//	parray[i].r = PointVec[i].r;
-		//	parray[i].g = PointVec[i].g;
-		//	parray[i].b = PointVec[i].b;
-		//	parray[i].s = PointVec[i].s;
-		//	parray[i].t = PointVec[i].t;
-		// }
+		UploadPacked( points, numPoints );
+	}
+	else
+	{
+		glBufferData( GL_ARRAY_BUFFER, numPoints * sizeof(struct Point), points, GL_STATIC_DRAW );
 
 		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, THREE_VALUES, GL_FLOAT, GL_FALSE, sizeof(struct Point), (GLvoid*)ELEMENT_OFFSET(&parray[0].x, &parray[0].x));
+		glVertexAttribPointer(0, THREE_VALUES, GL_FLOAT, GL_FALSE, sizeof(struct Point), (GLvoid*)ELEMENT_OFFSET(&points[0].x, &points[0].x));
 
 		//glEnableClientState( GL_VERTEX_ARRAY );
 		if (hasNormals)
 		{
 			glEnableVertexAttribArray(1);
-			glVertexAttribPointer(1, THREE_VALUES, GL_FLOAT, GL_FALSE, sizeof(struct Point), (GLvoid*)ELEMENT_OFFSET(&parray[0].x, &parray[0].nx));
+			glVertexAttribPointer(1, THREE_VALUES, GL_FLOAT, GL_FALSE, sizeof(struct Point), (GLvoid*)ELEMENT_OFFSET(&points[0].x, &points[0].nx));
 			// the leading THREE_VALUES is implied
-	//glEnableClientState( GL_NORMAL_ARRAY );
 		}
 
-		/*if( hasColors )
-		{
-			glColorPointer(    THREE_VALUES, GL_FLOAT, sizeof(struct Point), ELEMENT_OFFSET( &parray[0].x, &parray[0].r ) );
-			glEnableClientState( GL_COLOR_ARRAY );
-		}*/
-
 		if (hasTexCoords)
 		{
 			glEnableVertexAttribArray(2);
-			glVertexAttribPointer(2, TWO_VALUES, GL_FLOAT, GL_FALSE, sizeof(struct Point), (GLvoid*)ELEMENT_OFFSET(&parray[0].x, &parray[0].s));
-			//glEnableClientState( GL_TEXTURE_COORD_ARRAY );
+			glVertexAttribPointer(2, TWO_VALUES, GL_FLOAT, GL_FALSE, sizeof(struct Point), (GLvoid*)ELEMENT_OFFSET(&points[0].x, &points[0].s));
 		}
 
 		if (hasTangents)
 		{
 			glEnableVertexAttribArray(3);
-			glVertexAttribPointer(3, THREE_VALUES, GL_FLOAT, GL_FALSE, sizeof(struct Point), (GLvoid*)ELEMENT_OFFSET(&parray[0].x, &parray[0].u));
+			glVertexAttribPointer(3, THREE_VALUES, GL_FLOAT, GL_FALSE, sizeof(struct Point), (GLvoid*)ELEMENT_OFFSET(&points[0].x, &points[0].u));
 		}
 
 		if (hasBitangents)
 		{
 			glEnableVertexAttribArray(4);
-			glVertexAttribPointer(4, THREE_VALUES, GL_FLOAT, GL_FALSE, sizeof(struct Point), (GLvoid*)ELEMENT_OFFSET(&parray[0].x, &parray[0].ui));
+			glVertexAttribPointer(4, THREE_VALUES, GL_FLOAT, GL_FALSE, sizeof(struct Point), (GLvoid*)ELEMENT_OFFSET(&points[0].x, &points[0].ui));
 		}
+	}
 
-		glUnmapBuffer( GL_ARRAY_BUFFER );
-		parray = NULL;
+	glGenBuffers( 1, &ebuffer );
+	glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, ebuffer );
+	glBufferData( GL_ELEMENT_ARRAY_BUFFER, numElements * sizeof(GLuint), elements, GL_STATIC_DRAW );
 
-		glGenBuffers( 1, &ebuffer );
-		glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, ebuffer );
-		glBufferData( GL_ELEMENT_ARRAY_BUFFER, numElements * sizeof(GLuint), NULL, GL_STATIC_DRAW );
-		earray = (GLuint *) glMapBuffer( GL_ELEMENT_ARRAY_BUFFER, GL_WRITE_ONLY );
-		for( int i = 0; i < numElements; i++ )
+	glBindVertexArray( 0 );
+
+	numDrawPoints = numPoints;
+	numDrawElements = numElements;
+	isFirstDraw = false;
+}
+
+
+static
+inline
+GLuint
+PackSnorm10( float f )
+{
+	if( f > 1. )	f =  1.;
+	if( f < -1. )	f = -1.;
+	int i = (int)floorf( f * 511.f + 0.5f );
+	return (GLuint)i & 0x3ff;
+}
+
+
+static
+GLuint
+Pack2101010( float x, float y, float z, float w )
+{
+	GLuint iw = ( w < 0. ) ? 0x3 : 0x1;		// 2-bit snorm: -1 or +1
+	return PackSnorm10( x )  |  ( PackSnorm10( y ) << 10 )  |  ( PackSnorm10( z ) << 20 )  |  ( iw << 30 );
+}
+
+
+static
+inline
+GLushort
+PackUnorm16( float f, float bias, float scale )
+{
+	float u = ( scale > 0. ) ? ( f - bias ) / scale : 0.f;
+	if( u < 0. )	u = 0.;
+	if( u > 1. )	u = 1.;
+	return (GLushort)floorf( u * 65535.f + 0.5f );
+}
+
+
+// copy the points, in the arena's layout, and the elements into the shared arena:
+
+void
+VertexBufferObject::UploadArena( const struct Point *points, int numPoints, const GLuint *elements, int numElements )
+{
+	decodeScale[0] = decodeScale[1] = decodeScale[2] = 1.f;
+	decodeBias[0]  = decodeBias[1]  = decodeBias[2]  = 0.f;
+	decodeBitangent = false;
+
+	if( arena->GetPacking( ) != VBO_PACK_NONE )
+	{
+		std::vector<unsigned char> packed;
+		PackPoints( points, numPoints, arena->GetPacking( ), packed );
+		arenaRange = arena->Add( &packed[0], numPoints, elements, numElements );
+	}
+	else
+	{
+		arenaRange = arena->Add( points, numPoints, elements, numElements );
+	}
+
+	numDrawPoints = numPoints;
+	numDrawElements = numElements;
+	isFirstDraw = false;
+}
+
+
+// convert the points to the packed layout for the given VboPacking bits,
+// setting how the shader should decode them, and return the stride:
+
+int
+VertexBufferObject::PackPoints( const struct Point *points, int numPoints, int _packing, std::vector<unsigned char> &packed )
+{
+	bool quantize = ( _packing & VBO_PACK_POSITIONS ) != 0;
+
+	if( quantize )
+	{
+		float lo[3] = { points[0].x, points[0].y, points[0].z };
+		float hi[3] = { points[0].x, points[0].y, points[0].z };
+		for( int i = 1; i < numPoints; i++ )
 		{
-			earray[i] = ElementVec[i];
+			const float *p = &points[i].x;
+			for( int c = 0; c < 3; c++ )
+			{
+				if( p[c] < lo[c] )	lo[c] = p[c];
+				if( p[c] > hi[c] )	hi[c] = p[c];
+			}
+		}
+		for( int c = 0; c < 3; c++ )
+		{
+			decodeBias[c] = lo[c];
+			decodeScale[c] = hi[c] - lo[c];
 		}
-		glUnmapBuffer( GL_ELEMENT_ARRAY_BUFFER );
-		earray = NULL;
-
-		isFirstDraw = false;
 	}
 
-	glBindVertexArray( abuffer );
-	if( collapseCommonVertices )
-		glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, ebuffer );
+	// the bitangent only gets rebuilt in the shader when there was one to begin with:
+
+	decodeBitangent = hasNormals && hasTangents && hasBitangents;
 
+	int stride = quantize ? sizeof(struct PackedQPoint) : sizeof(struct PackedPoint);
+	packed.resize( (size_t)numPoints * stride );
 
-	if( collapseCommonVertices || restartFound )
+	for( int i = 0; i < numPoints; i++ )
 	{
-		glDrawElements( topology, numElements, GL_UNSIGNED_INT, BUFFER_OFFSET( 0 ) );
+		const struct Point &p = points[i];
+
+		GLuint n = Pack2101010( p.nx, p.ny, p.nz, 1. );
+
+		float t[3] = { p.u, p.v, p.h };
+		float tlen = sqrtf( t[0]*t[0] + t[1]*t[1] + t[2]*t[2] );
+		if( tlen > 0. )
+		{
+			t[0] /= tlen;	t[1] /= tlen;	t[2] /= tlen;
+		}
+
+		// handedness: does the stored bitangent agree with normal x tangent?
+
+		float c[3] = { p.ny*t[2] - p.nz*t[1],  p.nz*t[0] - p.nx*t[2],  p.nx*t[1] - p.ny*t[0] };
+		float handedness = ( c[0]*p.ui + c[1]*p.vi + c[2]*p.hi < 0. ) ? -1.f : 1.f;
+		GLuint tp = Pack2101010( t[0], t[1], t[2], handedness );
+
+		if( quantize )
+		{
+			struct PackedQPoint *q = (struct PackedQPoint *) &packed[ (size_t)i * stride ];
+			q->x = PackUnorm16( p.x, decodeBias[0], decodeScale[0] );
+			q->y = PackUnorm16( p.y, decodeBias[1], decodeScale[1] );
+			q->z = PackUnorm16( p.z, decodeBias[2], decodeScale[2] );
+			q->w = 0;
+			q->n = n;
+			q->t = tp;
+			q->s  = FloatToHalf( p.s );
+			q->tt = FloatToHalf( p.t );
+		}
+		else
+		{
+			struct PackedPoint *q = (struct PackedPoint *) &packed[ (size_t)i * stride ];
+			q->x = p.x;
+			q->y = p.y;
+			q->z = p.z;
+			q->n = n;
+			q->t = tp;
+			q->s  = FloatToHalf( p.s );
+			q->tt = FloatToHalf( p.t );
+		}
 	}
+
+	return stride;
+}
+
+
+// fill the array buffer with the packed layout and point the attributes at it:
+
+void
+VertexBufferObject::UploadPacked( const struct Point *points, int numPoints )
+{
+	bool quantize = ( packing & VBO_PACK_POSITIONS ) != 0;
+
+	std::vector<unsigned char> packed;
+	int stride = PackPoints( points, numPoints, packing, packed );
+
+	glBufferData( GL_ARRAY_BUFFER, packed.size( ), &packed[0], GL_STATIC_DRAW );
+
+	size_t n  = quantize ? offsetof(struct PackedQPoint, n) : offsetof(struct PackedPoint, n);
+	size_t t  = quantize ? offsetof(struct PackedQPoint, t) : offsetof(struct PackedPoint, t);
+	size_t st = quantize ? offsetof(struct PackedQPoint, s) : offsetof(struct PackedPoint, s);
+
+	glEnableVertexAttribArray(0);
+	if( quantize )
+		glVertexAttribPointer(0, THREE_VALUES, GL_UNSIGNED_SHORT, GL_TRUE, stride, BUFFER_OFFSET( 0 ));
 	else
+		glVertexAttribPointer(0, THREE_VALUES, GL_FLOAT, GL_FALSE, stride, BUFFER_OFFSET( 0 ));
+
+	if (hasNormals)
 	{
-		glDrawArrays( topology, 0, numPoints);
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, BUFFER_OFFSET( n ));
 	}
 
-	glBindVertexArray( 0 );
-	glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, 0 );
+	if (hasTexCoords)
+	{
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, TWO_VALUES, GL_HALF_FLOAT, GL_FALSE, stride, BUFFER_OFFSET( st ));
+	}
 
-	//glDisableClientState( GL_VERTEX_ARRAY );
-	//glDisableClientState( GL_NORMAL_ARRAY );
-	//glDisableClientState( GL_COLOR_ARRAY );
-	//glDisableClientState( GL_TEXTURE_COORD_ARRAY );
+	if (hasTangents)
+	{
+		glEnableVertexAttribArray(3);
+		glVertexAttribPointer(3, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, BUFFER_OFFSET( t ));
+	}
+
+	// no bitangent array: the shader crosses the normal and tangent instead
+}
+
+
+// whether the shader has to rebuild the bitangent (set once the points have been packed):
+
+bool
+VertexBufferObject::DecodesBitangent( )
+{
+	return decodeBitangent;
+}
+
+
+int
+VertexBufferObject::GetAttributes( )
+{
+	int attributes = 0;
+	if( hasNormals )				attributes |= VBO_NORMALS;
+	if( hasColors )					attributes |= VBO_COLORS;
+	if( hasTexCoords )				attributes |= VBO_TEXCOORDS;
+	if( hasTangents )				attributes |= VBO_TANGENTS;
+	if( hasBitangents )				attributes |= VBO_BITANGENTS;
+	if( collapseCommonVertices || weldVertices || restartFound )
+							attributes |= VBO_INDEXED;
+	return attributes;
+}
+
+
+// which of its arena's ranges this object was put in, or -1 if it isn't in one (yet):
+
+int
+VertexBufferObject::GetArenaRange( )
+{
+	return ( arena != NULL ) ? arenaRange : -1;
+}
+
+
+const std::vector<GLuint>&
+VertexBufferObject::GetElements( )
+{
+	return ElementVec;
+}
+
+
+const std::vector<struct Point>&
+VertexBufferObject::GetPoints( )
+{
+	return PointVec;
+}
+
+
+GLenum
+VertexBufferObject::GetTopology( )
+{
+	return topology;
+}
+
+
+// whether Draw( ) goes through the element array (rather than just the points in order):
+
+bool
+VertexBufferObject::IsIndexed( )
+{
+	return collapseCommonVertices || weldVertices || restartFound;
 }
 
+
 std::string
 VertexBufferObject::GetMaterial()
 {
@@ -178,6 +584,39 @@ VertexBufferObject::SetMaterial(char* mat)
 	material.append(mat);
 }
 
+// send this object to the graphics card in a smaller vertex layout (VboPacking bits)
+// has to be set before the first Draw( ) (or UseBuffers( )) to do anything:
+
+void
+VertexBufferObject::PackVertices( int _packing )
+{
+	packing = _packing;
+}
+
+
+// sub-allocate this object out of a shared GeometryArena instead of giving it its own buffers
+// has to be set before the first Draw( ) (or UseBuffers( )); the arena's packing wins over PackVertices( ):
+
+void
+VertexBufferObject::SetArena( GeometryArena *_arena )
+{
+	arena = _arena;
+}
+
+
+// merge vertices whose position, normal, texture coordinates, and tangents all match
+// (to within epsilon, if one is given) and draw with the element array
+// unlike CollapseCommonVertices( ), vertices sharing just a position stay apart:
+
+void
+VertexBufferObject::WeldVertices( bool tf, float epsilon )
+{
+	weldVertices = tf;
+	weldEpsilon = epsilon;
+	WeldTable.clear( );
+}
+
+
 void
 VertexBufferObject::glBegin( GLenum _topology )
 {
@@ -268,6 +707,47 @@ VertexBufferObject::AddBitangent(GLfloat u, GLfloat v, GLfloat w)
 }
 
 
+// reorder the triangles for the vertex cache and overdraw, then the points for fetching
+// only for indexed triangle lists that haven't been sent to the graphics card yet
+// returns false (and leaves everything alone) otherwise:
+
+bool
+VertexBufferObject::Optimize( int cacheSize, struct VertexCacheStats *before, struct VertexCacheStats *after )
+{
+	if( topology != GL_TRIANGLES  ||  restartFound  ||  ! isFirstDraw )
+		return false;
+
+	if( ! ( collapseCommonVertices || weldVertices )  ||  PointVec.size( ) == 0 )
+		return false;
+
+	if( before != NULL )
+		*before = AnalyzeVertexCache( ElementVec, (int)PointVec.size( ), cacheSize );
+
+	OptimizeTriangleOrder( ElementVec, PointVec, cacheSize );
+	OptimizeVertexFetch( PointVec, ElementVec );
+
+	if( after != NULL )
+		*after = AnalyzeVertexCache( ElementVec, (int)PointVec.size( ), cacheSize );
+
+
+	// the points moved, so the lookups have to be rebuilt before any more can be added:
+
+	WeldTable.clear( );
+	PointMap.clear( );
+	if( collapseCommonVertices )
+	{
+		for( int i = 0; i < (int)PointVec.size( ); i++ )
+		{
+			Key key( PointVec[i].x, PointVec[i].y, PointVec[i].z );
+			if( PointMap.find( key ) == PointMap.end( ) )
+				PointMap[ key ] = i;
+		}
+	}
+
+	return true;
+}
+
+
 void
 VertexBufferObject::Print( char *text, FILE *fpout )
 {
@@ -335,6 +815,12 @@ VertexBufferObject::Reset( )
 {
 	isFirstDraw = true;
 	hasVertices = hasNormals = hasColors = hasTexCoords = false;
+	numDrawPoints = numDrawElements = 0;
+	c_r = c_g = c_b = 0.;
+	c_nx = c_ny = c_nz = 0.;
+	c_s = c_t = 0.;
+	c_u = c_v = c_w = 0.;
+	c_uu = c_uv = c_uw = 0.;	// welding compares these, so they can't be left as garbage
 	glPrimitiveRestartIndex( VertexBufferObject::RESTART_INDEX );
 	glEnable( GL_PRIMITIVE_RESTART );
 	if( parray != NULL )
@@ -360,6 +846,7 @@ VertexBufferObject::Reset( )
 
 	PointVec.clear( );
 	PointMap.clear( );
+	WeldTable.clear( );
 	ElementVec.clear( );
 }
 
@@ -379,6 +866,32 @@ VertexBufferObject::SetVerbose( bool v )
 }
 
 
+// take ready-made arrays (e.g., from a mesh cache) instead of going through glBegin( )...glEnd( )
+// they are handed straight to the graphics card, so nothing is kept on the cpu side:
+
+void
+VertexBufferObject::UseBuffers( GLenum _topology, int attributes, const struct Point *points, int numPoints,
+				const GLuint *elements, int numElements )
+{
+	topology = _topology;
+	Reset( );
+
+	if( numPoints == 0  ||  numElements == 0 )
+		return;
+
+	hasVertices   = true;
+	hasNormals    = ( attributes & VBO_NORMALS )    != 0;
+	hasColors     = ( attributes & VBO_COLORS )     != 0;
+	hasTexCoords  = ( attributes & VBO_TEXCOORDS )  != 0;
+	hasTangents   = ( attributes & VBO_TANGENTS )   != 0;
+	hasBitangents = ( attributes & VBO_BITANGENTS ) != 0;
+	collapseCommonVertices = weldVertices = false;
+	restartFound  = ( attributes & VBO_INDEXED )    != 0;
+
+	Upload( points, numPoints, elements, numElements );
+}
+
+
 // these are here to make the map functions work:
 // (Do an L1 test for tolerance equality -- presume it's faster than an L2 sqrt)
 